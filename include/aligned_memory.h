@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Default alignment (bytes) of large buffers, one cache line
+     */
+    const size_t kBufferAlignment = 64;
+
+    /**
+     * @brief Rounds size up to a multiple of align
+     * @param size The size to round
+     * @param align The alignment, must be a power of 2
+     * @return The rounded size
+     */
+    inline size_t AlignUp(size_t size, size_t align)
+    {
+        return (size + align - 1) & ~(align - 1);
+    }
+
+    /**
+     * @brief Allocates a zeroed, aligned and contiguous byte buffer
+     * @param bytes Size of the buffer
+     * @param align The alignment, must be a power of 2
+     * @return Shared pointer owning the buffer, nullptr if bytes == 0
+     * @attention Throws std::bad_alloc if the allocation fails
+     */
+    inline std::shared_ptr<std::uint8_t> MakeAlignedBytes(size_t bytes, size_t align = kBufferAlignment)
+    {
+        if (bytes == 0)
+        {
+            return nullptr;
+        }
+        size_t alloc_bytes = AlignUp(bytes, align);
+        std::uint8_t * ptr = static_cast<std::uint8_t *>(std::aligned_alloc(align, alloc_bytes));
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        memset(ptr, 0, alloc_bytes);
+        return std::shared_ptr<std::uint8_t>(ptr, std::free);
+    }
+
+    /**
+     * @brief Allocator of aligned memory for std containers, e.g. std::vector<T, AlignedAllocator<T>>
+     * @tparam T The value type
+     * @tparam align The alignment, must be a power of 2 and >= alignof(T)
+     */
+    template <class T, size_t align = kBufferAlignment>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+
+        template <class U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, align>;
+        };
+
+        AlignedAllocator() = default;
+
+        template <class U>
+        AlignedAllocator(const AlignedAllocator<U, align> &)
+        {
+        }
+
+        /**
+         * @attention Throws std::bad_alloc if the allocation fails
+         */
+        T * allocate(size_t n)
+        {
+            void * ptr = std::aligned_alloc(align, AlignUp(std::max<size_t>(n * sizeof(T), 1), align));
+            if (ptr == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T *>(ptr);
+        }
+
+        void deallocate(T * ptr, size_t)
+        {
+            std::free(ptr);
+        }
+
+        template <class U>
+        bool operator==(const AlignedAllocator<U, align> &) const
+        {
+            return true;
+        }
+
+        template <class U>
+        bool operator!=(const AlignedAllocator<U, align> &) const
+        {
+            return false;
+        }
+    };
+
+}
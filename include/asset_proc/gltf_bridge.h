@@ -0,0 +1,981 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tiny_obj_bridge.h"
+#include "../base_data_struct.h"
+#include "../mapped_file.h"
+
+namespace mistery_render
+{
+
+/**
+ * @brief Value of a JSON document, enough for the JSON chunk of glTF files
+ */
+struct JsonValue
+{
+    enum class Type
+    {
+        kNull,
+        kBool,
+        kNumber,
+        kString,
+        kArray,
+        kObject
+    };
+
+    Type type = Type::kNull;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    /**
+     * @brief Member of an object
+     * @return nullptr if this is not an object or has no such member
+     */
+    inline const JsonValue * Find(const std::string &key) const
+    {
+        for (const std::pair<std::string, JsonValue> &member : object)
+        {
+            if (member.first == key)
+            {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Number member of an object, default_value if missing or not a number
+     */
+    inline double GetNumber(const std::string &key, double default_value) const
+    {
+        const JsonValue * value = Find(key);
+        return (value != nullptr && value->type == Type::kNumber) ? value->number : default_value;
+    }
+
+    /**
+     * @brief Index member of an object (a non-negative integer), -1 if missing or invalid
+     */
+    inline long GetIndex(const std::string &key) const
+    {
+        double value = GetNumber(key, -1);
+        return (value >= 0 && value == std::floor(value) && value < 2147483648.0) ? static_cast<long>(value) : -1;
+    }
+
+    /**
+     * @brief String member of an object, empty if missing or not a string
+     */
+    inline std::string GetString(const std::string &key) const
+    {
+        const JsonValue * value = Find(key);
+        return (value != nullptr && value->type == Type::kString) ? value->string : std::string();
+    }
+
+    /**
+     * @brief Elements of an array member of an object, empty if missing or not an array
+     */
+    inline const std::vector<JsonValue> &GetArray(const std::string &key) const
+    {
+        static const std::vector<JsonValue> kEmpty;
+        const JsonValue * value = Find(key);
+        return (value != nullptr && value->type == Type::kArray) ? value->array : kEmpty;
+    }
+};
+
+/**
+ * @brief Maximum nesting of JSON arrays and objects, deeper documents are rejected instead of overflowing the stack
+ */
+const int kJsonMaxDepth = 128;
+
+inline const char * SkipJsonSpace(const char * p, const char * end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief Parses a JSON string starting after its opening quote, escapes are decoded to UTF-8
+ * @return The position after the closing quote, nullptr if the string is broken
+ */
+inline const char * ParseJsonString(const char * p, const char * end, std::string &value)
+{
+    auto hex4 = [&](std::uint32_t &code)
+    {
+        if (end - p < 4)
+        {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; i++, p++)
+        {
+            char c = *p;
+            int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                        (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (digit < 0)
+            {
+                return false;
+            }
+            code = code * 16 + static_cast<std::uint32_t>(digit);
+        }
+        return true;
+    };
+    value.clear();
+    while (p < end && *p != '"')
+    {
+        if (*p != '\\')
+        {
+            value.push_back(*p++);
+            continue;
+        }
+        if (++p >= end)
+        {
+            return nullptr;
+        }
+        char escape = *p++;
+        switch (escape)
+        {
+            case '"': value.push_back('"'); break;
+            case '\\': value.push_back('\\'); break;
+            case '/': value.push_back('/'); break;
+            case 'b': value.push_back('\b'); break;
+            case 'f': value.push_back('\f'); break;
+            case 'n': value.push_back('\n'); break;
+            case 'r': value.push_back('\r'); break;
+            case 't': value.push_back('\t'); break;
+            case 'u':
+            {
+                std::uint32_t code = 0;
+                if (!hex4(code))
+                {
+                    return nullptr;
+                }
+                if (code >= 0xd800 && code < 0xdc00)
+                {
+                    std::uint32_t low = 0;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u' || (p += 2, !hex4(low)) || low < 0xdc00 || low >= 0xe000)
+                    {
+                        return nullptr;
+                    }
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                if (code < 0x80)
+                {
+                    value.push_back(static_cast<char>(code));
+                }
+                else if (code < 0x800)
+                {
+                    value.push_back(static_cast<char>(0xc0 | (code >> 6)));
+                    value.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                }
+                else if (code < 0x10000)
+                {
+                    value.push_back(static_cast<char>(0xe0 | (code >> 12)));
+                    value.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                }
+                else
+                {
+                    value.push_back(static_cast<char>(0xf0 | (code >> 18)));
+                    value.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                }
+                break;
+            }
+            default:
+                return nullptr;
+        }
+    }
+    return p < end ? p + 1 : nullptr;
+}
+
+/**
+ * @brief Parses a JSON value
+ * @param p Start of the value, leading spaces are skipped
+ * @param end End of the text, the text need not be null terminated
+ * @param value Output value
+ * @param depth Nesting depth of the value
+ * @return The position after the value, nullptr if the text is not valid JSON
+ */
+inline const char * ParseJson(const char * p, const char * end, JsonValue &value, int depth = 0)
+{
+    p = SkipJsonSpace(p, end);
+    if (p >= end || depth > kJsonMaxDepth)
+    {
+        return nullptr;
+    }
+    auto literal = [&](const char * word)
+    {
+        size_t length = strlen(word);
+        return static_cast<size_t>(end - p) >= length && memcmp(p, word, length) == 0 ? p + length : nullptr;
+    };
+    value = JsonValue();
+    if (*p == '{')
+    {
+        value.type = JsonValue::Type::kObject;
+        p = SkipJsonSpace(p + 1, end);
+        if (p < end && *p == '}')
+        {
+            return p + 1;
+        }
+        while (p != nullptr)
+        {
+            p = SkipJsonSpace(p, end);
+            if (p >= end || *p != '"')
+            {
+                return nullptr;
+            }
+            value.object.emplace_back();
+            p = ParseJsonString(p + 1, end, value.object.back().first);
+            p = p == nullptr ? nullptr : SkipJsonSpace(p, end);
+            if (p == nullptr || p >= end || *p != ':')
+            {
+                return nullptr;
+            }
+            p = ParseJson(p + 1, end, value.object.back().second, depth + 1);
+            p = p == nullptr ? nullptr : SkipJsonSpace(p, end);
+            if (p == nullptr || p >= end)
+            {
+                return nullptr;
+            }
+            if (*p == '}')
+            {
+                return p + 1;
+            }
+            p = *p == ',' ? p + 1 : nullptr;
+        }
+        return nullptr;
+    }
+    if (*p == '[')
+    {
+        value.type = JsonValue::Type::kArray;
+        p = SkipJsonSpace(p + 1, end);
+        if (p < end && *p == ']')
+        {
+            return p + 1;
+        }
+        while (p != nullptr)
+        {
+            value.array.emplace_back();
+            p = ParseJson(p, end, value.array.back(), depth + 1);
+            p = p == nullptr ? nullptr : SkipJsonSpace(p, end);
+            if (p == nullptr || p >= end)
+            {
+                return nullptr;
+            }
+            if (*p == ']')
+            {
+                return p + 1;
+            }
+            p = *p == ',' ? p + 1 : nullptr;
+        }
+        return nullptr;
+    }
+    if (*p == '"')
+    {
+        value.type = JsonValue::Type::kString;
+        return ParseJsonString(p + 1, end, value.string);
+    }
+    if (const char * after = literal("true"))
+    {
+        value.type = JsonValue::Type::kBool;
+        value.boolean = true;
+        return after;
+    }
+    if (const char * after = literal("false"))
+    {
+        value.type = JsonValue::Type::kBool;
+        return after;
+    }
+    if (const char * after = literal("null"))
+    {
+        return after;
+    }
+    // the text is not null terminated, so strtod reads a copy of the number
+    const char * number_end = p;
+    while (number_end < end && strchr("+-0123456789.eE", *number_end) != nullptr)
+    {
+        number_end++;
+    }
+    std::string number(p, number_end);
+    char * parsed_end = nullptr;
+    value.type = JsonValue::Type::kNumber;
+    value.number = strtod(number.c_str(), &parsed_end);
+    return (!number.empty() && parsed_end == number.c_str() + number.size()) ? number_end : nullptr;
+}
+
+/**
+ * @brief Component types of glTF accessors
+ */
+enum class GltfComponentType
+{
+    kByte = 5120,
+    kUnsignedByte = 5121,
+    kShort = 5122,
+    kUnsignedShort = 5123,
+    kUnsignedInt = 5125,
+    kFloat = 5126
+};
+
+inline size_t GltfComponentBytes(GltfComponentType type)
+{
+    switch (type)
+    {
+        case GltfComponentType::kByte:
+        case GltfComponentType::kUnsignedByte:
+            return 1;
+        case GltfComponentType::kShort:
+        case GltfComponentType::kUnsignedShort:
+            return 2;
+        case GltfComponentType::kUnsignedInt:
+        case GltfComponentType::kFloat:
+            return 4;
+    }
+    return 0;
+}
+
+/**
+ * @brief Number of components of a glTF accessor type ("SCALAR", "VEC3", ...), 0 if unknown
+ */
+inline size_t GltfComponentNum(const std::string &type)
+{
+    const std::pair<const char *, size_t> kTypes[] = {{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4},
+                                                      {"MAT2", 4}, {"MAT3", 9}, {"MAT4", 16}};
+    for (const std::pair<const char *, size_t> &known : kTypes)
+    {
+        if (type == known.first)
+        {
+            return known.second;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Typed view of a glTF accessor into the binary chunk of a GLB file, nothing is copied
+ * @attention Valid while the GlbFile (its mapping) is alive
+ */
+struct GltfAccessor
+{
+    const std::uint8_t * data = nullptr;    // first element, nullptr if the accessor is default constructed
+    size_t count = 0;
+    size_t stride = 0;                      // bytes between elements
+    GltfComponentType component_type = GltfComponentType::kFloat;
+    size_t component_num = 0;
+    bool normalized = false;
+
+    /**
+     * @brief Reads a component as float, normalized integers are mapped to [0, 1] or [-1, 1]
+     * @param i Index of the element
+     * @param k Index of the component
+     */
+    inline float Read(size_t i, size_t k) const
+    {
+        if (data == nullptr)
+        {
+            return 0.0f;
+        }
+        const std::uint8_t * p = data + i * stride + k * GltfComponentBytes(component_type);
+        switch (component_type)
+        {
+            case GltfComponentType::kByte:
+            {
+                std::int8_t v = static_cast<std::int8_t>(*p);
+                return normalized ? std::max(v / 127.0f, -1.0f) : v;
+            }
+            case GltfComponentType::kUnsignedByte:
+                return normalized ? *p / 255.0f : *p;
+            case GltfComponentType::kShort:
+            {
+                std::int16_t v;
+                memcpy(&v, p, sizeof(v));
+                return normalized ? std::max(v / 32767.0f, -1.0f) : v;
+            }
+            case GltfComponentType::kUnsignedShort:
+            {
+                std::uint16_t v;
+                memcpy(&v, p, sizeof(v));
+                return normalized ? v / 65535.0f : v;
+            }
+            case GltfComponentType::kUnsignedInt:
+            {
+                std::uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return static_cast<float>(v);
+            }
+            case GltfComponentType::kFloat:
+            {
+                float v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+        }
+        return 0.0f;
+    }
+
+    /**
+     * @brief Reads an element of an index accessor (unsigned byte, short or int)
+     */
+    inline std::uint32_t ReadIndex(size_t i) const
+    {
+        if (data == nullptr)
+        {
+            return 0;
+        }
+        const std::uint8_t * p = data + i * stride;
+        switch (component_type)
+        {
+            case GltfComponentType::kUnsignedByte:
+                return *p;
+            case GltfComponentType::kUnsignedShort:
+            {
+                std::uint16_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            case GltfComponentType::kUnsignedInt:
+            {
+                std::uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            default:
+                return 0;
+        }
+    }
+
+    /**
+     * @brief The elements as a tightly packed array of T (one T per component)
+     * @return nullptr if the components are not T, the elements are interleaved with others, or the data is not aligned for T
+     */
+    template <class T>
+    inline const T * Typed(GltfComponentType expect) const
+    {
+        if (data == nullptr || component_type != expect || sizeof(T) != GltfComponentBytes(component_type) ||
+            stride != sizeof(T) * component_num || reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(data);
+    }
+};
+
+/**
+ * @brief A memory mapped GLB (binary glTF 2.0) file: its JSON document and accessor views into its binary chunk
+ */
+struct GlbFile
+{
+    std::shared_ptr<std::uint8_t> mapping;  // owner of the data of the accessors
+    size_t size = 0;
+    JsonValue json;
+    const std::uint8_t * bin = nullptr;
+    size_t bin_size = 0;
+    std::vector<GltfAccessor> accessors;
+    std::string error;
+};
+
+/**
+ * @brief Maps a GLB file and makes the views of its accessors, the buffers must be the binary chunk of the file
+ * @attention External buffers (.bin files, data URIs) and sparse accessors are not supported
+ * @param glb_path Path of the GLB file
+ * @param file Output file, file.error tells why reading failed
+ * @return false if the file is missing or not a valid GLB file
+ */
+inline bool ReadGlb(const std::string &glb_path, GlbFile &file)
+{
+    const std::uint32_t kMagic = 0x46546c67;        // "glTF"
+    const std::uint32_t kChunkJson = 0x4e4f534a;    // "JSON"
+    const std::uint32_t kChunkBin = 0x004e4942;     // "BIN\0"
+    file = GlbFile();
+    file.mapping = MapFile(glb_path, file.size);
+    if (file.mapping == nullptr)
+    {
+        file.error = "can not read the file";
+        return false;
+    }
+    const std::uint8_t * bytes = file.mapping.get();
+    auto read_u32 = [&](size_t offset)
+    {
+        std::uint32_t value;
+        memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    };
+    if (file.size < 20 || read_u32(0) != kMagic || read_u32(4) != 2 || read_u32(8) > file.size)
+    {
+        file.error = "not a glTF 2.0 binary file";
+        return false;
+    }
+    size_t total = read_u32(8);
+    const char * json_text = nullptr;
+    size_t json_size = 0;
+    for (size_t offset = 12; offset + 8 <= total;)
+    {
+        size_t chunk_size = read_u32(offset);
+        std::uint32_t chunk_type = read_u32(offset + 4);
+        if (chunk_size > total - offset - 8)
+        {
+            file.error = "broken chunk";
+            return false;
+        }
+        if (chunk_type == kChunkJson && json_text == nullptr)
+        {
+            json_text = reinterpret_cast<const char *>(bytes + offset + 8);
+            json_size = chunk_size;
+        }
+        else if (chunk_type == kChunkBin && file.bin == nullptr)
+        {
+            file.bin = bytes + offset + 8;
+            file.bin_size = chunk_size;
+        }
+        offset += 8 + (chunk_size + 3) / 4 * 4;
+    }
+    const char * json_end = json_text == nullptr ? nullptr : ParseJson(json_text, json_text + json_size, file.json);
+    if (json_end == nullptr || file.json.type != JsonValue::Type::kObject)
+    {
+        file.error = "broken JSON chunk";
+        return false;
+    }
+
+    // sizes of a GLB file fit in 32 bits, larger values are clamped so they convert to size_t safely
+    auto read_size = [](const JsonValue &json, const std::string &key)
+    {
+        return static_cast<size_t>(std::min(std::max(json.GetNumber(key, 0), 0.0), 4294967295.0));
+    };
+    const std::vector<JsonValue> &buffers = file.json.GetArray("buffers");
+    const std::vector<JsonValue> &views = file.json.GetArray("bufferViews");
+    for (const JsonValue &accessor_json : file.json.GetArray("accessors"))
+    {
+        GltfAccessor accessor;
+        accessor.count = read_size(accessor_json, "count");
+        accessor.component_type = static_cast<GltfComponentType>(accessor_json.GetIndex("componentType"));
+        accessor.component_num = GltfComponentNum(accessor_json.GetString("type"));
+        const JsonValue * normalized = accessor_json.Find("normalized");
+        accessor.normalized = normalized != nullptr && normalized->boolean;
+        size_t element_bytes = GltfComponentBytes(accessor.component_type) * accessor.component_num;
+        // accessors without a buffer view are all zeros, only useful with sparse data which is not supported either
+        long view_index = accessor_json.GetIndex("bufferView");
+        if (element_bytes == 0 || accessor_json.Find("sparse") != nullptr || view_index < 0)
+        {
+            file.error = "unsupported accessor";
+            return false;
+        }
+        if (static_cast<size_t>(view_index) >= views.size())
+        {
+            file.error = "broken accessor";
+            return false;
+        }
+        const JsonValue &view = views[view_index];
+        long buffer_index = view.GetIndex("buffer");
+        if (buffer_index != 0 || buffers.empty() || buffers[0].Find("uri") != nullptr || file.bin == nullptr)
+        {
+            file.error = "buffers outside the binary chunk are not supported";
+            return false;
+        }
+        size_t view_offset = read_size(view, "byteOffset");
+        size_t view_length = read_size(view, "byteLength");
+        size_t offset = read_size(accessor_json, "byteOffset");
+        accessor.stride = read_size(view, "byteStride");
+        accessor.stride = accessor.stride == 0 ? element_bytes : accessor.stride;
+        // bounds count and stride (at most 252 by the spec) first, so the end of the accessor does not wrap
+        if (accessor.count > file.bin_size / element_bytes || accessor.stride > 252)
+        {
+            file.error = "accessor out of the binary chunk";
+            return false;
+        }
+        size_t used = accessor.count == 0 ? 0 : offset + accessor.stride * (accessor.count - 1) + element_bytes;
+        if (view_offset > file.bin_size || view_length > file.bin_size - view_offset || used > view_length)
+        {
+            file.error = "accessor out of the binary chunk";
+            return false;
+        }
+        accessor.data = file.bin + view_offset + offset;
+        file.accessors.push_back(accessor);
+    }
+    return true;
+}
+
+/**
+ * @brief Column major 4x4 matrix of a glTF node, from "matrix" or from "translation", "rotation" and "scale"
+ */
+inline std::array<double, 16> GltfNodeMatrix(const JsonValue &node)
+{
+    std::array<double, 16> m = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    const std::vector<JsonValue> &matrix = node.GetArray("matrix");
+    if (matrix.size() == 16)
+    {
+        for (size_t i = 0; i < 16; i++)
+        {
+            m[i] = matrix[i].number;
+        }
+        return m;
+    }
+    auto read = [&](const std::string &key, std::array<double, 4> value)
+    {
+        const std::vector<JsonValue> &values = node.GetArray(key);
+        for (size_t i = 0; i < values.size() && i < value.size(); i++)
+        {
+            value[i] = values[i].number;
+        }
+        return value;
+    };
+    std::array<double, 4> t = read("translation", {0, 0, 0, 0});
+    std::array<double, 4> q = read("rotation", {0, 0, 0, 1});
+    std::array<double, 4> s = read("scale", {1, 1, 1, 0});
+    double x = q[0], y = q[1], z = q[2], w = q[3];
+    std::array<double, 9> r = {1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+                               2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+                               2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)};
+    for (size_t column = 0; column < 3; column++)
+    {
+        for (size_t row = 0; row < 3; row++)
+        {
+            m[column * 4 + row] = r[column * 3 + row] * s[column];
+        }
+        m[12 + column] = t[column];
+    }
+    return m;
+}
+
+inline std::array<double, 16> MultiplyGltfMatrix(const std::array<double, 16> &a, const std::array<double, 16> &b)
+{
+    std::array<double, 16> m = {};
+    for (size_t column = 0; column < 4; column++)
+    {
+        for (size_t row = 0; row < 4; row++)
+        {
+            for (size_t k = 0; k < 4; k++)
+            {
+                m[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+            }
+        }
+    }
+    return m;
+}
+
+/**
+ * @brief Makes a mesh of a triangle primitive of a glTF mesh, in world space of its node
+ * @attention A primitive without a material uses the glTF default material, see GltfMaterials(); the attributes are interleaved into MeshVertex, which is the only copy; UNSIGNED_INT indices are used
+ * in place in the mapping unless the node mirrors the mesh (the winding is flipped then)
+ * @param file The GLB file
+ * @param primitive The primitive
+ * @param world Column major world matrix of the node
+ * @param mesh Output mesh
+ * @return false if the primitive is not made of triangles or is broken, e.g. its indices are not unsigned integers
+ */
+inline bool GltfPrimitiveToMeshBuffer(const GlbFile &file, const JsonValue &primitive, const std::array<double, 16> &world,
+                                      MeshBuffer &mesh)
+{
+    const JsonValue * attributes = primitive.Find("attributes");
+    if (primitive.GetNumber("mode", 4) != 4 || attributes == nullptr)
+    {
+        return false;
+    }
+    auto accessor_of = [&](const JsonValue &owner, const std::string &key) -> const GltfAccessor *
+    {
+        long index = owner.GetIndex(key);
+        return (index >= 0 && static_cast<size_t>(index) < file.accessors.size()) ? &file.accessors[index] : nullptr;
+    };
+    const GltfAccessor * position = accessor_of(*attributes, "POSITION");
+    const GltfAccessor * normal = accessor_of(*attributes, "NORMAL");
+    const GltfAccessor * texcoord = accessor_of(*attributes, "TEXCOORD_0");
+    const GltfAccessor * index = accessor_of(primitive, "indices");
+    if (position == nullptr || position->component_num != 3 || (normal != nullptr && normal->component_num != 3) ||
+        (texcoord != nullptr && texcoord->component_num != 2) || (index != nullptr && index->component_num != 1))
+    {
+        return false;
+    }
+    if (index != nullptr && index->component_type != GltfComponentType::kUnsignedByte &&
+        index->component_type != GltfComponentType::kUnsignedShort && index->component_type != GltfComponentType::kUnsignedInt)
+    {
+        return false;
+    }
+
+    // normals are transformed by the cofactor matrix (the inverse transpose scaled by the determinant), its columns
+    // are the cross products of the columns of the matrix
+    const std::array<double, 16> &m = world;
+    auto cross = [&](size_t a, size_t b)
+    {
+        return std::array<double, 3>{m[a + 1] * m[b + 2] - m[a + 2] * m[b + 1], m[a + 2] * m[b] - m[a] * m[b + 2],
+                                     m[a] * m[b + 1] - m[a + 1] * m[b]};
+    };
+    std::array<std::array<double, 3>, 3> cofactor = {cross(4, 8), cross(8, 0), cross(0, 4)};
+    double determinant = m[0] * cofactor[0][0] + m[1] * cofactor[0][1] + m[2] * cofactor[0][2];
+    std::vector<MeshVertex> vertices(position->count);
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        double p[3] = {position->Read(i, 0), position->Read(i, 1), position->Read(i, 2)};
+        for (size_t k = 0; k < 3; k++)
+        {
+            vertices[i].position[k] = static_cast<float>(m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k]);
+        }
+        if (normal != nullptr)
+        {
+            double n[3] = {normal->Read(i, 0), normal->Read(i, 1), normal->Read(i, 2)};
+            double world_normal[3], length = 0;
+            for (size_t k = 0; k < 3; k++)
+            {
+                world_normal[k] = cofactor[0][k] * n[0] + cofactor[1][k] * n[1] + cofactor[2][k] * n[2];
+                length += world_normal[k] * world_normal[k];
+            }
+            length = (determinant < 0 ? -1 : 1) * std::sqrt(length);
+            for (size_t k = 0; k < 3 && length != 0; k++)
+            {
+                vertices[i].normal[k] = static_cast<float>(world_normal[k] / length);
+            }
+        }
+        if (texcoord != nullptr)
+        {
+            // glTF puts v == 0 at the top of the image, the textures here at the bottom like OBJ
+            vertices[i].texcoord = {texcoord->Read(i, 0), 1.0f - texcoord->Read(i, 1)};
+        }
+    }
+
+    size_t index_num = (index != nullptr ? index->count : position->count) / 3 * 3;
+    const std::uint32_t * in_place = index != nullptr ? index->Typed<std::uint32_t>(GltfComponentType::kUnsignedInt) : nullptr;
+    if (in_place != nullptr && determinant >= 0)
+    {
+        mesh.indices = SharedArray<std::uint32_t>(std::shared_ptr<const std::uint32_t>(file.mapping, in_place), index_num);
+    }
+    else
+    {
+        std::vector<std::uint32_t> indices(index_num);
+        for (size_t i = 0; i < index_num; i++)
+        {
+            indices[i] = index != nullptr ? index->ReadIndex(i) : static_cast<std::uint32_t>(i);
+        }
+        for (size_t i = 0; i < index_num && determinant < 0; i += 3)
+        {
+            std::swap(indices[i + 1], indices[i + 2]);
+        }
+        mesh.indices = SharedArray<std::uint32_t>(std::move(indices));
+    }
+    for (std::uint32_t i : mesh.indices)
+    {
+        if (i >= vertices.size())
+        {
+            return false;
+        }
+    }
+    long material = primitive.GetIndex("material");
+    size_t material_num = file.json.GetArray("materials").size();
+    if (material < 0 || static_cast<size_t>(material) >= material_num)
+    {
+        material = static_cast<long>(material_num);     // the default material appended by GltfMaterials()
+    }
+    mesh.vertices = SharedArray<MeshVertex>(std::move(vertices));
+    mesh.materials = SharedArray<std::int32_t>(std::vector<std::int32_t>(index_num / 3, static_cast<std::int32_t>(material)));
+    return true;
+}
+
+/**
+ * @brief Makes the meshes of the default scene of a GLB file, one per triangle primitive of each node, in world space
+ * @attention Without scenes every mesh is made once in its own space; primitives of other modes are skipped
+ * @param file The GLB file
+ * @return The meshes
+ */
+inline std::vector<MeshBuffer> GltfMeshBuffers(const GlbFile &file)
+{
+    const std::vector<JsonValue> &nodes = file.json.GetArray("nodes");
+    const std::vector<JsonValue> &meshes_json = file.json.GetArray("meshes");
+    std::vector<MeshBuffer> meshes;
+    auto add_mesh = [&](long mesh_index, const std::array<double, 16> &world)
+    {
+        if (mesh_index < 0 || static_cast<size_t>(mesh_index) >= meshes_json.size())
+        {
+            return;
+        }
+        const JsonValue &mesh_json = meshes_json[mesh_index];
+        for (const JsonValue &primitive : mesh_json.GetArray("primitives"))
+        {
+            MeshBuffer mesh;
+            mesh.name = mesh_json.GetString("name");
+            if (GltfPrimitiveToMeshBuffer(file, primitive, world, mesh))
+            {
+                meshes.push_back(mesh);
+            }
+        }
+    };
+
+    const std::vector<JsonValue> &scenes = file.json.GetArray("scenes");
+    long scene_index = std::max(file.json.GetIndex("scene"), 0L);
+    if (static_cast<size_t>(scene_index) >= scenes.size())
+    {
+        for (size_t i = 0; i < meshes_json.size(); i++)
+        {
+            add_mesh(static_cast<long>(i), GltfNodeMatrix(JsonValue()));
+        }
+        return meshes;
+    }
+    // depth first over the node tree, the depth limit stops cycles of broken files
+    std::vector<std::pair<long, std::array<double, 16>>> stack;
+    std::vector<size_t> depths;
+    for (const JsonValue &root : scenes[scene_index].GetArray("nodes"))
+    {
+        stack.emplace_back(static_cast<long>(root.number), GltfNodeMatrix(JsonValue()));
+        depths.push_back(0);
+    }
+    std::reverse(stack.begin(), stack.end());
+    while (!stack.empty())
+    {
+        std::pair<long, std::array<double, 16>> item = stack.back();
+        size_t depth = depths.back();
+        stack.pop_back();
+        depths.pop_back();
+        if (item.first < 0 || static_cast<size_t>(item.first) >= nodes.size() || depth > nodes.size())
+        {
+            continue;
+        }
+        const JsonValue &node = nodes[item.first];
+        std::array<double, 16> world = MultiplyGltfMatrix(item.second, GltfNodeMatrix(node));
+        add_mesh(node.GetIndex("mesh"), world);
+        const std::vector<JsonValue> &children = node.GetArray("children");
+        for (size_t i = children.size(); i > 0; i--)
+        {
+            stack.emplace_back(static_cast<long>(children[i - 1].number), world);
+            depths.push_back(depth + 1);
+        }
+    }
+    return meshes;
+}
+
+/**
+ * @brief The glTF default material as a tinyobj material: white base color, metallic 1, roughness 1
+ */
+inline tinyobj::material_t GltfDefaultMaterial()
+{
+    tinyobj::material_t mat = tinyobj::material_t();
+    mat.ior = 1.5f;
+    mat.dissolve = 1.0f;
+    mat.illum = 2;
+    mat.metallic = 1.0f;
+    mat.roughness = 1.0f;
+    for (size_t k = 0; k < 3; k++)
+    {
+        mat.diffuse[k] = 1.0f;
+    }
+    return mat;
+}
+
+/**
+ * @brief Converts the materials of a GLB file to tinyobj materials, so they are made like OBJ materials
+ * @attention Base color, emission, metallic and roughness factors are kept; textures are kept if their image is an
+ * external file (its URI relative to the GLB file), images embedded in the binary chunk are not decoded; the default
+ * material is appended if a primitive has no material
+ * @param file The GLB file
+ * @return The materials
+ */
+inline std::vector<tinyobj::material_t> GltfMaterials(const GlbFile &file)
+{
+    const std::vector<JsonValue> &textures = file.json.GetArray("textures");
+    const std::vector<JsonValue> &images = file.json.GetArray("images");
+    auto texture_uri = [&](const JsonValue * texture_info)
+    {
+        long texture = texture_info == nullptr ? -1 : texture_info->GetIndex("index");
+        long image = (texture >= 0 && static_cast<size_t>(texture) < textures.size()) ? textures[texture].GetIndex("source") : -1;
+        std::string uri = (image >= 0 && static_cast<size_t>(image) < images.size()) ? images[image].GetString("uri") : "";
+        if (uri.compare(0, 5, "data:") == 0)
+        {
+            return std::string();
+        }
+        // URIs are percent encoded
+        std::string path;
+        for (size_t i = 0; i < uri.size(); i++)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size())
+            {
+                path.push_back(static_cast<char>(strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16)));
+                i += 2;
+            }
+            else
+            {
+                path.push_back(uri[i]);
+            }
+        }
+        return path;
+    };
+
+    std::vector<tinyobj::material_t> materials;
+    for (const JsonValue &material_json : file.json.GetArray("materials"))
+    {
+        tinyobj::material_t mat = GltfDefaultMaterial();
+        mat.name = material_json.GetString("name");
+        const JsonValue * pbr = material_json.Find("pbrMetallicRoughness");
+        if (pbr != nullptr)
+        {
+            const std::vector<JsonValue> &base_color = pbr->GetArray("baseColorFactor");
+            for (size_t k = 0; k < 3 && k < base_color.size(); k++)
+            {
+                mat.diffuse[k] = static_cast<tinyobj::real_t>(base_color[k].number);
+            }
+            mat.dissolve = base_color.size() == 4 ? static_cast<tinyobj::real_t>(base_color[3].number) : mat.dissolve;
+            mat.metallic = static_cast<tinyobj::real_t>(pbr->GetNumber("metallicFactor", 1));
+            mat.roughness = static_cast<tinyobj::real_t>(pbr->GetNumber("roughnessFactor", 1));
+            mat.diffuse_texname = texture_uri(pbr->Find("baseColorTexture"));
+        }
+        const std::vector<JsonValue> &emission = material_json.GetArray("emissiveFactor");
+        for (size_t k = 0; k < 3 && k < emission.size(); k++)
+        {
+            mat.emission[k] = static_cast<tinyobj::real_t>(emission[k].number);
+        }
+        mat.normal_texname = texture_uri(material_json.Find("normalTexture"));
+        mat.emissive_texname = texture_uri(material_json.Find("emissiveTexture"));
+        materials.push_back(mat);
+    }
+
+    bool use_default = false;
+    for (const JsonValue &mesh_json : file.json.GetArray("meshes"))
+    {
+        for (const JsonValue &primitive : mesh_json.GetArray("primitives"))
+        {
+            long material = primitive.GetIndex("material");
+            use_default = use_default || material < 0 || static_cast<size_t>(material) >= materials.size();
+        }
+    }
+    if (use_default)
+    {
+        materials.push_back(GltfDefaultMaterial());
+        materials.back().name = "default";
+    }
+    return materials;
+}
+
+/**
+ * @brief Loads a GLB (binary glTF 2.0) file into the same materials and compact meshes as load_obj()
+ * @attention The meshes are in world space of the default scene; UNSIGNED_INT indices keep the file mapped while the
+ * models are alive
+ * @return Empty if succeeded, else the error message
+ */
+template <class real_t, size_t tex_n>
+inline std::string load_glb(const std::string &glb_path,
+                            std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                            std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                            std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    GlbFile file;
+    if (!ReadGlb(glb_path, file))
+    {
+        return "Failed to load: " + glb_path + ": " + file.error;
+    }
+    BuildObjMaterials(GltfMaterials(file), glb_path, material_list, texture_pool);
+    for (const MeshBuffer &mesh : GltfMeshBuffers(file))
+    {
+        model_list->push_back(ModelObj<real_t>(mesh, material_list));
+    }
+    return "";
+}
+
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "texture_cache_file.h"
+#include "../base_data_struct.h"
+#include "../mapped_file.h"
+
+namespace mistery_render
+{
+
+/**
+ * @brief A source file of a mesh cache file (the OBJ file or a MTL file), the cache is stale if it changes
+ */
+struct MeshCacheSource
+{
+    std::string path;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+};
+
+/**
+ * @brief Flag of a mesh cache file whose meshes were optimized by OptimizeMesh() when it was written
+ */
+const std::uint32_t kMeshCacheOptimized = 1;
+
+/**
+ * @brief Flag of a mesh cache file whose meshes were quantized by QuantizeMesh(), its vertex array is QuantizedMeshVertex
+ */
+const std::uint32_t kMeshCacheQuantized = 2;
+
+/**
+ * @brief Bytes of a vertex in a mesh cache file of the flags
+ */
+inline size_t MeshCacheVertexBytes(std::uint32_t flags)
+{
+    return (flags & kMeshCacheQuantized) != 0 ? sizeof(QuantizedMeshVertex) : sizeof(MeshVertex);
+}
+
+#pragma pack(push, 1)
+/**
+ * @brief Header of a mesh cache file, followed by the table (sources, materials, shapes) and the arrays at their offsets
+ */
+struct MeshCacheHeader
+{
+    char magic[8] = {'M', 'R', 'M', 'E', 'S', 'H', 'C', 'H'};
+    std::uint32_t version = 3;
+    std::uint32_t flags = 0;            // kMeshCacheOptimized | kMeshCacheQuantized
+    std::uint32_t source_num = 0;
+    std::uint32_t material_num = 0;
+    std::uint32_t shape_num = 0;
+    std::uint64_t table_bytes = 0;
+    std::uint64_t vertex_offset = 0;    // MeshVertex or QuantizedMeshVertex array, multiple of kBufferAlignment
+    std::uint64_t vertex_num = 0;
+    std::uint64_t index_offset = 0;     // uint32 array
+    std::uint64_t index_num = 0;
+    std::uint64_t material_offset = 0;  // int32 array, one per triangle (index_num / 3)
+};
+#pragma pack(pop)
+
+/**
+ * @brief Stats a source file of a mesh cache
+ * @return false if the file does not exist
+ */
+inline bool MakeMeshCacheSource(const std::string &path, MeshCacheSource &source)
+{
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        return false;
+    }
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        return false;
+    }
+    source.path = path;
+    source.size = size;
+    source.mtime = static_cast<std::int64_t>(mtime.time_since_epoch().count());
+    return true;
+}
+
+/**
+ * @brief Path of the mesh cache file of an OBJ file: cache_dir/<64-bit FNV-1a hash of obj_path>.mrmesh
+ */
+inline std::string MeshCachePath(const std::string &cache_dir, const std::string &obj_path)
+{
+    return CacheFilePath(cache_dir, obj_path, "mrmesh");
+}
+
+/**
+ * @brief Little helpers to write and read the table of a mesh cache file
+ */
+struct MeshCacheTable
+{
+    std::string bytes;
+    const char * read_pos = nullptr;
+    const char * read_end = nullptr;
+
+    template <class T>
+    inline void Put(const T &value)
+    {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    inline void PutString(const std::string &value)
+    {
+        Put(static_cast<std::uint32_t>(value.size()));
+        bytes.append(value);
+    }
+
+    template <class T>
+    inline bool Get(T &value)
+    {
+        if (read_end - read_pos < static_cast<std::ptrdiff_t>(sizeof(value)))
+        {
+            return false;
+        }
+        memcpy(&value, read_pos, sizeof(value));
+        read_pos += sizeof(value);
+        return true;
+    }
+
+    inline bool GetString(std::string &value)
+    {
+        std::uint32_t length = 0;
+        if (!Get(length) || read_end - read_pos < static_cast<std::ptrdiff_t>(length))
+        {
+            return false;
+        }
+        value.assign(read_pos, length);
+        read_pos += length;
+        return true;
+    }
+
+    /**
+     * @brief Writes (write == true) or reads a value
+     */
+    template <class T>
+    inline bool Field(T &value, bool write)
+    {
+        if (write)
+        {
+            Put(value);
+            return true;
+        }
+        return Get(value);
+    }
+
+    inline bool Field(std::string &value, bool write)
+    {
+        if (write)
+        {
+            PutString(value);
+            return true;
+        }
+        return GetString(value);
+    }
+
+    /**
+     * @brief Writes (write == true) or reads the fields of a material the renderer uses
+     * @return false if reading ran out of the table
+     */
+    inline bool Material(tinyobj::material_t &mat, bool write)
+    {
+        tinyobj::real_t * reals[] = {&mat.shininess, &mat.ior, &mat.dissolve, &mat.roughness, &mat.metallic, &mat.sheen,
+                                     &mat.clearcoat_thickness, &mat.clearcoat_roughness, &mat.anisotropy,
+                                     &mat.anisotropy_rotation, &mat.pad0};
+        tinyobj::real_t * colors[] = {mat.ambient, mat.diffuse, mat.specular, mat.transmittance, mat.emission};
+        std::string * strings[] = {&mat.name, &mat.ambient_texname, &mat.diffuse_texname, &mat.specular_texname,
+                                   &mat.specular_highlight_texname, &mat.bump_texname, &mat.displacement_texname,
+                                   &mat.alpha_texname, &mat.reflection_texname, &mat.roughness_texname,
+                                   &mat.metallic_texname, &mat.sheen_texname, &mat.emissive_texname, &mat.normal_texname};
+        bool ok = true;
+        for (tinyobj::real_t * color : colors)
+        {
+            ok = ok && Field(color[0], write) && Field(color[1], write) && Field(color[2], write);
+        }
+        for (tinyobj::real_t * real : reals)
+        {
+            ok = ok && Field(*real, write);
+        }
+        ok = ok && Field(mat.illum, write) && Field(mat.dummy, write);
+        for (std::string * str : strings)
+        {
+            ok = ok && Field(*str, write);
+        }
+        return ok;
+    }
+};
+
+/**
+ * @brief Writes meshes and their materials to a mesh cache file
+ * @attention The file is written to a temporary file first and renamed, so readers never see a partial file
+ * @param cache_path Path of the cache file
+ * @param sources Source files, the OBJ file first, then its MTL files
+ * @param materials Materials, texture names are kept as references and loaded by the reader
+ * @param meshes Meshes, one per shape, quantized if and only if flags has kMeshCacheQuantized
+ * @param flags Flags describing how the meshes were processed, e.g. kMeshCacheOptimized
+ * @return false if writing failed
+ */
+inline bool WriteMeshCache(const std::string &cache_path, const std::vector<MeshCacheSource> &sources,
+                           const std::vector<tinyobj::material_t> &materials, const std::vector<MeshBuffer> &meshes,
+                           std::uint32_t flags = 0)
+{
+    MeshCacheHeader header;
+    header.flags = flags;
+    bool quantized = (flags & kMeshCacheQuantized) != 0;
+    for (const MeshBuffer &mesh : meshes)
+    {
+        if (mesh.IsQuantized() != quantized && mesh.VertexNum() > 0)
+        {
+            return false;
+        }
+    }
+    header.source_num = static_cast<std::uint32_t>(sources.size());
+    header.material_num = static_cast<std::uint32_t>(materials.size());
+    header.shape_num = static_cast<std::uint32_t>(meshes.size());
+
+    MeshCacheTable table;
+    for (const MeshCacheSource &source : sources)
+    {
+        table.PutString(source.path);
+        table.Put(source.size);
+        table.Put(source.mtime);
+    }
+    for (tinyobj::material_t mat : materials)
+    {
+        table.Material(mat, true);
+    }
+    for (const MeshBuffer &mesh : meshes)
+    {
+        table.PutString(mesh.name);
+        table.Put(static_cast<std::uint64_t>(header.vertex_num));
+        table.Put(static_cast<std::uint64_t>(mesh.VertexNum()));
+        table.Put(static_cast<std::uint64_t>(header.index_num));
+        table.Put(static_cast<std::uint64_t>(mesh.indices.size));
+        if (quantized)
+        {
+            table.Put(mesh.quantization);
+        }
+        header.vertex_num += mesh.VertexNum();
+        header.index_num += mesh.indices.size;
+    }
+    header.table_bytes = table.bytes.size();
+    header.vertex_offset = AlignUp(sizeof(header) + table.bytes.size(), kBufferAlignment);
+    header.index_offset = AlignUp(header.vertex_offset + header.vertex_num * MeshCacheVertexBytes(flags), kBufferAlignment);
+    header.material_offset = AlignUp(header.index_offset + header.index_num * sizeof(std::uint32_t), kBufferAlignment);
+
+    std::string tmp_path = CacheTempPath(cache_path);
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        std::vector<char> padding(kBufferAlignment, 0);
+        auto pad_to = [&](std::uint64_t offset)
+        {
+            out.write(padding.data(), offset - static_cast<std::uint64_t>(out.tellp()));
+        };
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(table.bytes.data(), table.bytes.size());
+        pad_to(header.vertex_offset);
+        for (const MeshBuffer &mesh : meshes)
+        {
+            if (quantized)
+            {
+                out.write(reinterpret_cast<const char *>(mesh.quantized_vertices.begin()), mesh.quantized_vertices.size * sizeof(QuantizedMeshVertex));
+            }
+            else
+            {
+                out.write(reinterpret_cast<const char *>(mesh.vertices.begin()), mesh.vertices.size * sizeof(MeshVertex));
+            }
+        }
+        pad_to(header.index_offset);
+        for (const MeshBuffer &mesh : meshes)
+        {
+            out.write(reinterpret_cast<const char *>(mesh.indices.begin()), mesh.indices.size * sizeof(std::uint32_t));
+        }
+        pad_to(header.material_offset);
+        for (const MeshBuffer &mesh : meshes)
+        {
+            out.write(reinterpret_cast<const char *>(mesh.materials.begin()), mesh.materials.size * sizeof(std::int32_t));
+        }
+        if (!out.good())
+        {
+            out.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Maps a mesh cache file, the meshes use the mapped arrays directly without any per vertex conversion
+ * @param cache_path Path of the cache file
+ * @param obj_path Path of the OBJ file, must be the first source of the file
+ * @param materials Output materials
+ * @param meshes Output meshes, one per shape
+ * @param flags Flags the file must have been written with
+ * @return false if the file is missing, broken, of another version or flags, or a source file changed since it was written
+ */
+inline bool ReadMeshCache(const std::string &cache_path, const std::string &obj_path,
+                          std::vector<tinyobj::material_t> &materials, std::vector<MeshBuffer> &meshes,
+                          std::uint32_t flags = 0)
+{
+    size_t file_size = 0;
+    std::shared_ptr<std::uint8_t> file = MapFile(cache_path, file_size);
+    if (file == nullptr || file_size < sizeof(MeshCacheHeader))
+    {
+        return false;
+    }
+    MeshCacheHeader header;
+    const MeshCacheHeader expect;
+    memcpy(&header, file.get(), sizeof(header));
+    if (memcmp(header.magic, expect.magic, sizeof(header.magic)) != 0 || header.version != expect.version || header.flags != flags ||
+        header.source_num == 0 || header.index_num % 3 != 0 || sizeof(header) + header.table_bytes > file_size ||
+        header.vertex_offset % kBufferAlignment != 0 || header.index_offset % kBufferAlignment != 0 ||
+        header.material_offset % kBufferAlignment != 0 ||
+        header.vertex_offset + header.vertex_num * MeshCacheVertexBytes(flags) > file_size ||
+        header.index_offset + header.index_num * sizeof(std::uint32_t) > file_size ||
+        header.material_offset + header.index_num / 3 * sizeof(std::int32_t) > file_size)
+    {
+        return false;
+    }
+
+    MeshCacheTable table;
+    table.read_pos = reinterpret_cast<const char *>(file.get()) + sizeof(header);
+    table.read_end = table.read_pos + header.table_bytes;
+    for (std::uint32_t i = 0; i < header.source_num; i++)
+    {
+        MeshCacheSource stored, current;
+        if (!table.GetString(stored.path) || !table.Get(stored.size) || !table.Get(stored.mtime) ||
+            (i == 0 && stored.path != obj_path) || !MakeMeshCacheSource(stored.path, current) ||
+            current.size != stored.size || current.mtime != stored.mtime)
+        {
+            return false;
+        }
+    }
+    std::vector<tinyobj::material_t> read_materials(header.material_num);
+    for (tinyobj::material_t &mat : read_materials)
+    {
+        if (!table.Material(mat, false))
+        {
+            return false;
+        }
+    }
+
+    // the meshes share ownership of the mapping
+    const MeshVertex * vertices = reinterpret_cast<const MeshVertex *>(file.get() + header.vertex_offset);
+    const QuantizedMeshVertex * quantized_vertices = reinterpret_cast<const QuantizedMeshVertex *>(file.get() + header.vertex_offset);
+    bool quantized = (flags & kMeshCacheQuantized) != 0;
+    const std::uint32_t * indices = reinterpret_cast<const std::uint32_t *>(file.get() + header.index_offset);
+    const std::int32_t * triangle_materials = reinterpret_cast<const std::int32_t *>(file.get() + header.material_offset);
+    std::vector<MeshBuffer> read_meshes(header.shape_num);
+    for (MeshBuffer &mesh : read_meshes)
+    {
+        std::uint64_t vertex_begin = 0, vertex_num = 0, index_begin = 0, index_num = 0;
+        if (!table.GetString(mesh.name) || !table.Get(vertex_begin) || !table.Get(vertex_num) ||
+            !table.Get(index_begin) || !table.Get(index_num) || vertex_begin + vertex_num > header.vertex_num ||
+            index_begin + index_num > header.index_num || index_begin % 3 != 0 || index_num % 3 != 0 ||
+            (quantized && !table.Get(mesh.quantization)))
+        {
+            return false;
+        }
+        for (std::uint64_t i = 0; i < index_num; i++)
+        {
+            if (indices[index_begin + i] >= vertex_num)
+            {
+                return false;
+            }
+        }
+        if (quantized)
+        {
+            mesh.quantized_vertices = SharedArray<QuantizedMeshVertex>(
+                std::shared_ptr<const QuantizedMeshVertex>(file, quantized_vertices + vertex_begin), vertex_num);
+        }
+        else
+        {
+            mesh.vertices = SharedArray<MeshVertex>(std::shared_ptr<const MeshVertex>(file, vertices + vertex_begin), vertex_num);
+        }
+        mesh.indices = SharedArray<std::uint32_t>(std::shared_ptr<const std::uint32_t>(file, indices + index_begin), index_num);
+        mesh.materials = SharedArray<std::int32_t>(std::shared_ptr<const std::int32_t>(file, triangle_materials + index_begin / 3), index_num / 3);
+    }
+    materials = std::move(read_materials);
+    meshes = std::move(read_meshes);
+    return true;
+}
+
+}
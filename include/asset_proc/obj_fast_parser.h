@@ -0,0 +1,600 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "../mapped_file.h"
+#include "../parallel.h"
+
+namespace mistery_render
+{
+
+/**
+ * @brief Mesh data of an OBJ file in tinyobj structures, filled by ParseObjFast()
+ * @attention Same accessors as tinyobj::ObjReader, so ModelObj reads both
+ */
+struct ObjMeshData
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::vector<std::string> material_libs;     // paths of the loaded MTL files
+    std::string warning;
+    std::string error;
+
+    const tinyobj::attrib_t &GetAttrib() const
+    {
+        return attrib;
+    }
+
+    const std::vector<tinyobj::shape_t> &GetShapes() const
+    {
+        return shapes;
+    }
+
+    const std::vector<tinyobj::material_t> &GetMaterials() const
+    {
+        return materials;
+    }
+};
+
+/**
+ * @brief Bytes of an OBJ file parsed by one task of ParseObjFast(), smaller files are parsed by one thread
+ */
+const size_t kObjChunkBytes = 256 * 1024;
+
+/**
+ * @brief Parses a decimal float in [s, end), like strtod but without locale or a terminating '\0'
+ * @param s Start of the number
+ * @param end End of the text
+ * @param value Output value, not changed if there is no number at s
+ * @return Pointer after the number, s if there is no number
+ */
+inline const char * ParseObjFloat(const char * s, const char * end, tinyobj::real_t &value)
+{
+    static const double kPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char * p = s;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    std::uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in mantissa
+    int exponent = 0;
+    bool any_digit = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        any_digit = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += (mantissa != 0);
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            any_digit = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+    if (!any_digit)
+    {
+        return s;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char * q = p + 1;
+        bool exp_negative = false;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            exp_negative = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int exp_value = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+            {
+                exp_value = exp_value < 10000 ? exp_value * 10 + (*q - '0') : exp_value;
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = q;
+        }
+    }
+
+    double result;
+    if (mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+    {
+        // exact mantissa and power of ten, one correctly rounded operation
+        result = exponent < 0 ? mantissa / kPow10[-exponent] : mantissa * kPow10[exponent];
+    }
+    else
+    {
+        char buffer[64];
+        size_t length = std::min<size_t>(p - s, sizeof(buffer) - 1);
+        memcpy(buffer, s, length);
+        buffer[length] = '\0';
+        result = std::fabs(strtod(buffer, nullptr));
+    }
+    value = static_cast<tinyobj::real_t>(negative ? -result : result);
+    return p;
+}
+
+/**
+ * @brief Command of an OBJ chunk that changes the state of the following faces
+ */
+struct ObjCommand
+{
+    enum Type
+    {
+        kObject,
+        kGroup,
+        kMaterial,
+        kSmoothing,
+        kMaterialLib
+    };
+
+    Type type = kObject;
+    size_t triangle_begin = 0;  // triangles of the chunk before the command
+    std::string value;
+    unsigned int smoothing = 0;
+};
+
+/**
+ * @brief Parse result of a line aligned range of an OBJ file, merged in file order by ParseObjFast()
+ * @attention Negative (relative) indices are resolved against the attributes of the chunk, they are listed in
+ * relative_indices and offset by the attributes of previous chunks when merging
+ */
+struct ObjChunk
+{
+    std::vector<tinyobj::real_t> vertices;
+    std::vector<tinyobj::real_t> normals;
+    std::vector<tinyobj::real_t> texcoords;
+    std::vector<tinyobj::index_t> indices;      // 3 per triangle
+    std::vector<ObjCommand> commands;
+    std::vector<std::pair<size_t, int>> relative_indices;  // (position in indices, 0 vertex / 1 normal / 2 texcoord)
+    std::string error;
+};
+
+inline const char * SkipObjSpace(const char * p, const char * end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    return p;
+}
+
+inline const char * ParseObjFloats(const char * p, const char * end, tinyobj::real_t * values, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = 0;
+        p = SkipObjSpace(p, end);
+        p = ParseObjFloat(p, end, values[i]);
+        while (p < end && *p != ' ' && *p != '\t')
+        {
+            p++;    // skip the rest of a malformed token, like tinyobj
+        }
+    }
+    return p;
+}
+
+/**
+ * @brief Parses an OBJ index, fixes it to 0-based
+ * @param count Number of attributes before the line in the chunk, relative indices are resolved against it
+ * @param index Output index, -1 if there is none
+ * @param relative Set if the index is relative
+ * @return Pointer after the index, nullptr if the index is 0 or larger than INT_MAX
+ */
+inline const char * ParseObjIndex(const char * p, const char * end, size_t count, int &index, bool &relative)
+{
+    bool negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9')
+    {
+        index = -1;
+        return p;
+    }
+    long long value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        value = value * 10 + (*p - '0');
+        if (value > std::numeric_limits<int>::max())
+        {
+            return nullptr;
+        }
+    }
+    if (value == 0)
+    {
+        return nullptr;
+    }
+    relative = negative;
+    index = static_cast<int>(negative ? static_cast<long long>(count) - value : value - 1);
+    return p;
+}
+
+/**
+ * @brief Parses the lines of [begin, end) into a chunk
+ * @return false on a parse error, the message is in chunk.error
+ */
+inline bool ParseObjChunk(const char * begin, const char * end, ObjChunk &chunk)
+{
+    struct FaceVertex
+    {
+        tinyobj::index_t index = {-1, -1, -1};
+        int relative = 0;   // bit 0 vertex, bit 1 normal, bit 2 texcoord
+    };
+    std::vector<FaceVertex> face;
+    face.reserve(8);
+
+    const char * line = begin;
+    while (line < end)
+    {
+        const char * line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+        line_end = line_end ? line_end : end;
+        const char * next_line = line_end < end ? line_end + 1 : end;
+        if (line_end > line && line_end[-1] == '\r')
+        {
+            line_end--;
+        }
+        const char * p = SkipObjSpace(line, line_end);
+        line = next_line;
+        if (p + 1 >= line_end || *p == '#')
+        {
+            continue;
+        }
+
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            tinyobj::real_t values[3];
+            ParseObjFloats(p + 2, line_end, values, 3);
+            chunk.vertices.insert(chunk.vertices.end(), values, values + 3);
+        }
+        else if (p[0] == 'v' && p[1] == 'n' && p + 2 < line_end && (p[2] == ' ' || p[2] == '\t'))
+        {
+            tinyobj::real_t values[3];
+            ParseObjFloats(p + 3, line_end, values, 3);
+            chunk.normals.insert(chunk.normals.end(), values, values + 3);
+        }
+        else if (p[0] == 'v' && p[1] == 't' && p + 2 < line_end && (p[2] == ' ' || p[2] == '\t'))
+        {
+            tinyobj::real_t values[2];
+            ParseObjFloats(p + 3, line_end, values, 2);
+            chunk.texcoords.insert(chunk.texcoords.end(), values, values + 2);
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            face.clear();
+            p = SkipObjSpace(p + 2, line_end);
+            while (p < line_end)
+            {
+                // v, v/vt, v//vn or v/vt/vn
+                FaceVertex fv;
+                bool relative = false;
+                p = ParseObjIndex(p, line_end, chunk.vertices.size() / 3, fv.index.vertex_index, relative);
+                fv.relative |= relative ? 1 : 0;
+                if (p && p < line_end && *p == '/')
+                {
+                    relative = false;
+                    p = ParseObjIndex(p + 1, line_end, chunk.texcoords.size() / 2, fv.index.texcoord_index, relative);
+                    fv.relative |= relative ? 4 : 0;
+                    if (p && p < line_end && *p == '/')
+                    {
+                        relative = false;
+                        p = ParseObjIndex(p + 1, line_end, chunk.normals.size() / 3, fv.index.normal_index, relative);
+                        fv.relative |= relative ? 2 : 0;
+                    }
+                }
+                if (!p || (fv.index.vertex_index < 0 && !(fv.relative & 1)))
+                {
+                    chunk.error = "Failed parse `f' line(e.g. zero value for face index.)\n";
+                    return false;
+                }
+                face.push_back(fv);
+                p = SkipObjSpace(p, line_end);
+            }
+            // fan triangulation, the same triangles as the ear clipping of tinyobj for convex polygons
+            for (size_t i = 1; i + 1 < face.size(); i++)
+            {
+                const FaceVertex * corners[3] = {&face[0], &face[i], &face[i + 1]};
+                for (const FaceVertex * corner : corners)
+                {
+                    for (int component = 0; component < 3; component++)
+                    {
+                        if (corner->relative & (1 << component))
+                        {
+                            chunk.relative_indices.emplace_back(chunk.indices.size(), component);
+                        }
+                    }
+                    chunk.indices.push_back(corner->index);
+                }
+            }
+        }
+        else
+        {
+            const char * token_end = p;
+            while (token_end < line_end && *token_end != ' ' && *token_end != '\t')
+            {
+                token_end++;
+            }
+            std::string token(p, token_end);
+            const char * value = SkipObjSpace(token_end, line_end);
+            ObjCommand command;
+            command.triangle_begin = chunk.indices.size() / 3;
+            if (token == "o" || token == "g")
+            {
+                command.type = token == "o" ? ObjCommand::kObject : ObjCommand::kGroup;
+                command.value.assign(token == "o" ? p + 2 : value, line_end);
+                if (command.type == ObjCommand::kGroup)
+                {
+                    // multiple group names are joined with a space, like tinyobj
+                    std::string joined;
+                    size_t pos = 0;
+                    while (pos < command.value.size())
+                    {
+                        size_t name_begin = command.value.find_first_not_of(" \t", pos);
+                        if (name_begin == std::string::npos)
+                        {
+                            break;
+                        }
+                        size_t name_end = command.value.find_first_of(" \t", name_begin);
+                        name_end = name_end == std::string::npos ? command.value.size() : name_end;
+                        joined += (joined.empty() ? "" : " ") + command.value.substr(name_begin, name_end - name_begin);
+                        pos = name_end;
+                    }
+                    command.value = joined;
+                }
+            }
+            else if (token == "usemtl")
+            {
+                command.type = ObjCommand::kMaterial;
+                const char * name_end = value;
+                while (name_end < line_end && *name_end != ' ' && *name_end != '\t')
+                {
+                    name_end++;
+                }
+                command.value.assign(value, name_end);
+            }
+            else if (token == "mtllib")
+            {
+                command.type = ObjCommand::kMaterialLib;
+                command.value.assign(value, line_end);
+            }
+            else if (token == "s")
+            {
+                command.type = ObjCommand::kSmoothing;
+                if (value < line_end && *value != 'o')
+                {
+                    int id = atoi(std::string(value, line_end).c_str());
+                    command.smoothing = id < 0 ? 0 : static_cast<unsigned int>(id);
+                }
+            }
+            else
+            {
+                continue;   // unknown or unsupported command (lines, points, tags)
+            }
+            chunk.commands.push_back(std::move(command));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Parses an OBJ file on multiple threads: the file is mapped, split at line boundaries into chunks of about
+ * kObjChunkBytes, the chunks are parsed in parallel and merged in file order; materials are loaded by tinyobj
+ * @attention Same result as tinyobj::ObjReader with triangulation for v/vn/vt/f/o/g/usemtl/mtllib/s lines; polygons
+ * are fan triangulated (the same as tinyobj for convex ones); vertex colors, lines, points and tags are not parsed
+ * @param obj_path Path of the OBJ file, mtllib files are searched in its directory
+ * @param data Output mesh data, the error message is in data.error if parsing fails
+ * @param thread_num Number of threads
+ * @return Whether parsing succeeded
+ */
+inline bool ParseObjFast(const std::string &obj_path, ObjMeshData &data, size_t thread_num = DefaultThreadNum())
+{
+    data = ObjMeshData();
+    size_t size = 0;
+    std::shared_ptr<std::uint8_t> file = MapFile(obj_path, size);
+    if (!file)
+    {
+        // MapFile also fails on an empty file, which tinyobj loads as a file without shapes
+        std::ifstream in(obj_path, std::ios::binary);
+        if (in.is_open() && in.peek() == std::ifstream::traits_type::eof())
+        {
+            return true;
+        }
+        data.error = "Cannot open file [" + obj_path + "]\n";
+        return false;
+    }
+    const char * text = reinterpret_cast<const char *>(file.get());
+
+    // split into chunks at line boundaries
+    size_t chunk_num = std::max<size_t>(1, std::min(size / kObjChunkBytes, thread_num * 4));
+    std::vector<const char *> bounds(chunk_num + 1, text + size);
+    bounds[0] = text;
+    for (size_t i = 1; i < chunk_num; i++)
+    {
+        const char * split = std::max(bounds[i - 1], text + size / chunk_num * i);
+        const char * line_end = static_cast<const char *>(memchr(split, '\n', text + size - split));
+        bounds[i] = line_end ? line_end + 1 : text + size;
+    }
+    std::vector<ObjChunk> chunks(chunk_num);
+    ParallelFor(0, chunk_num, [&](size_t i)
+    {
+        ParseObjChunk(bounds[i], bounds[i + 1], chunks[i]);
+    }, thread_num);
+
+    // offsets of the attributes of each chunk
+    std::vector<size_t> vertex_base(chunk_num + 1, 0), normal_base(chunk_num + 1, 0), texcoord_base(chunk_num + 1, 0);
+    for (size_t i = 0; i < chunk_num; i++)
+    {
+        if (!chunks[i].error.empty())
+        {
+            data.error = chunks[i].error;
+            return false;
+        }
+        vertex_base[i + 1] = vertex_base[i] + chunks[i].vertices.size();
+        normal_base[i + 1] = normal_base[i] + chunks[i].normals.size();
+        texcoord_base[i + 1] = texcoord_base[i] + chunks[i].texcoords.size();
+    }
+    data.attrib.vertices.resize(vertex_base[chunk_num]);
+    data.attrib.normals.resize(normal_base[chunk_num]);
+    data.attrib.texcoords.resize(texcoord_base[chunk_num]);
+    const long long vertex_num = static_cast<long long>(vertex_base[chunk_num] / 3);
+    const long long normal_num = static_cast<long long>(normal_base[chunk_num] / 3);
+    const long long texcoord_num = static_cast<long long>(texcoord_base[chunk_num] / 2);
+    ParallelFor(0, chunk_num, [&](size_t i)
+    {
+        ObjChunk &chunk = chunks[i];
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), data.attrib.vertices.begin() + vertex_base[i]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), data.attrib.normals.begin() + normal_base[i]);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), data.attrib.texcoords.begin() + texcoord_base[i]);
+        for (const std::pair<size_t, int> &relative : chunk.relative_indices)
+        {
+            tinyobj::index_t &index = chunk.indices[relative.first];
+            int &value = relative.second == 0 ? index.vertex_index : relative.second == 1 ? index.normal_index : index.texcoord_index;
+            long long base = static_cast<long long>(relative.second == 0 ? vertex_base[i] / 3 :
+                relative.second == 1 ? normal_base[i] / 3 : texcoord_base[i] / 2);
+            if (value + base < 0)
+            {
+                chunk.error = "Failed parse `f' line(relative face index before the first attribute.)\n";
+                return;
+            }
+            value = static_cast<int>(value + base);
+        }
+        for (const tinyobj::index_t &index : chunk.indices)
+        {
+            if (index.vertex_index >= vertex_num || index.normal_index >= normal_num || index.texcoord_index >= texcoord_num)
+            {
+                chunk.error = "Failed parse `f' line(face index out of range.)\n";
+                return;
+            }
+        }
+    }, thread_num);
+    for (const ObjChunk &chunk : chunks)
+    {
+        if (!chunk.error.empty())
+        {
+            data.error = chunk.error;
+            return false;
+        }
+    }
+
+    // replay the commands in file order, the same shape splitting as tinyobj
+    size_t dir_end = obj_path.find_last_of("/\\");
+    std::string mtl_dir = dir_end == std::string::npos ? "" : obj_path.substr(0, dir_end + 1);
+    tinyobj::MaterialFileReader material_reader(mtl_dir);
+    std::map<std::string, int> material_map;
+    tinyobj::shape_t shape;
+    std::string name;
+    int material = -1;
+    unsigned int smoothing = 0;
+    auto append = [&](const ObjChunk &chunk, size_t first, size_t last)
+    {
+        if (first >= last)
+        {
+            return;
+        }
+        shape.name = name;
+        shape.mesh.indices.insert(shape.mesh.indices.end(), chunk.indices.begin() + first * 3, chunk.indices.begin() + last * 3);
+        shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), last - first, 3);
+        shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), last - first, material);
+        shape.mesh.smoothing_group_ids.insert(shape.mesh.smoothing_group_ids.end(), last - first, smoothing);
+    };
+    for (const ObjChunk &chunk : chunks)
+    {
+        size_t cursor = 0;
+        for (const ObjCommand &command : chunk.commands)
+        {
+            append(chunk, cursor, command.triangle_begin);
+            cursor = command.triangle_begin;
+            if (command.type == ObjCommand::kObject || command.type == ObjCommand::kGroup)
+            {
+                if (!shape.mesh.indices.empty())
+                {
+                    data.shapes.push_back(std::move(shape));
+                }
+                shape = tinyobj::shape_t();
+                name = command.value;
+            }
+            else if (command.type == ObjCommand::kMaterial)
+            {
+                std::map<std::string, int>::const_iterator it = material_map.find(command.value);
+                if (it == material_map.end())
+                {
+                    data.warning += "material [ '" + command.value + "' ] not found in .mtl\n";
+                }
+                material = it == material_map.end() ? -1 : it->second;
+            }
+            else if (command.type == ObjCommand::kSmoothing)
+            {
+                smoothing = command.smoothing;
+            }
+            else
+            {
+                bool found = false;
+                size_t pos = 0;
+                while (!found && pos < command.value.size())
+                {
+                    size_t name_begin = command.value.find_first_not_of(" \t", pos);
+                    if (name_begin == std::string::npos)
+                    {
+                        break;
+                    }
+                    size_t name_end = command.value.find_first_of(" \t", name_begin);
+                    name_end = name_end == std::string::npos ? command.value.size() : name_end;
+                    std::string mtl_warn, mtl_err;
+                    std::string mtl_name = command.value.substr(name_begin, name_end - name_begin);
+                    found = material_reader(mtl_name, &data.materials, &material_map, &mtl_warn, &mtl_err);
+                    if (found)
+                    {
+                        data.material_libs.push_back(mtl_dir + mtl_name);
+                    }
+                    data.warning += mtl_warn;
+                    data.error += mtl_err;
+                    pos = name_end;
+                }
+                if (!found)
+                {
+                    data.warning += "Failed to load material file(s). Use default material.\n";
+                }
+            }
+        }
+        append(chunk, cursor, chunk.indices.size() / 3);
+    }
+    if (!shape.mesh.indices.empty())
+    {
+        data.shapes.push_back(std::move(shape));
+    }
+    return true;
+}
+
+}
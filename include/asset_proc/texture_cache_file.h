@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "../texture.h"
+#include "../mapped_file.h"
+
+namespace mistery_render
+{
+
+/**
+ * @brief Key of a texture cache file: the source file and the settings the texture was prepared with
+ */
+struct TextureCacheKey
+{
+    std::string source;
+    std::uint64_t source_size = 0;
+    std::int64_t source_mtime = 0;
+    TexelFormat format = TexelFormat::kRGBA8;
+    TextureLayout layout = TextureLayout::kLinear;
+};
+
+#pragma pack(push, 1)
+/**
+ * @brief Header of a texture cache file, followed by the source path and the texel data at data_offset
+ */
+struct TextureCacheHeader
+{
+    char magic[8] = {'M', 'R', 'T', 'E', 'X', 'C', 'H', 'E'};
+    std::uint32_t version = 1;
+    std::uint32_t source_length = 0;
+    std::uint64_t source_size = 0;
+    std::int64_t source_mtime = 0;
+    std::uint32_t format = 0;
+    std::uint32_t layout = 0;
+    std::uint32_t wrap_u = 0;
+    std::uint32_t wrap_v = 0;
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::uint32_t level_num = 0;
+    std::uint32_t pad = 0;
+    std::uint64_t data_offset = 0;  // multiple of kBufferAlignment
+    std::uint64_t data_bytes = 0;
+};
+#pragma pack(pop)
+
+/**
+ * @brief Makes the cache key of a source file
+ * @param source Path of the source file
+ * @param format Texel format the texture is prepared with
+ * @param layout Memory layout the texture is prepared with
+ * @param key The key
+ * @return false if the source file does not exist
+ */
+inline bool MakeTextureCacheKey(const std::string &source, TexelFormat format, TextureLayout layout, TextureCacheKey &key)
+{
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(source, error);
+    if (error)
+    {
+        return false;
+    }
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(source, error);
+    if (error)
+    {
+        return false;
+    }
+    key.source = source;
+    key.source_size = size;
+    key.source_mtime = static_cast<std::int64_t>(mtime.time_since_epoch().count());
+    key.format = format;
+    key.layout = layout;
+    return true;
+}
+
+/**
+ * @brief Path of the cache file of a source file: cache_dir/<64-bit FNV-1a hash of source>.<extension>
+ */
+inline std::string CacheFilePath(const std::string &cache_dir, const std::string &source, const char * extension)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : source)
+    {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    char name[48];
+    snprintf(name, sizeof(name), "%016llx.%s", static_cast<unsigned long long>(hash), extension);
+    return (cache_dir.empty() || cache_dir.back() == '/') ? cache_dir + name : cache_dir + "/" + name;
+}
+
+/**
+ * @brief Path of the cache file of a source file: cache_dir/<64-bit FNV-1a hash of source>.mrtex
+ */
+inline std::string TextureCachePath(const std::string &cache_dir, const std::string &source)
+{
+    return CacheFilePath(cache_dir, source, "mrtex");
+}
+
+/**
+ * @brief Temporary path to write a cache file to before renaming it to cache_path, in the same directory so the
+ * rename is atomic; unique per process, thread and call, so concurrent writers of the same cache never share it
+ */
+inline std::string CacheTempPath(const std::string &cache_path)
+{
+    static std::atomic<unsigned long long> counter(0);
+#if defined(__unix__) || defined(__APPLE__)
+    unsigned long long pid = static_cast<unsigned long long>(getpid());
+#else
+    unsigned long long pid = 0;
+#endif
+    char suffix[80];
+    snprintf(suffix, sizeof(suffix), ".%llu.%zx.%llu.tmp", pid, std::hash<std::thread::id>()(std::this_thread::get_id()),
+        counter.fetch_add(1));
+    return cache_path + suffix;
+}
+
+/**
+ * @brief Writes a prepared texture (all levels, final layout and format) to a cache file
+ * @attention The file is written to a temporary file first and renamed, so readers never see a partial file
+ * @param cache_path Path of the cache file
+ * @param key Key of the texture
+ * @param texture The texture, must not be empty
+ * @return false if writing failed
+ */
+inline bool WriteTextureCache(const std::string &cache_path, const TextureCacheKey &key, const Texture2D &texture)
+{
+    if (texture.Empty())
+    {
+        return false;
+    }
+    TextureCacheHeader header;
+    header.source_length = static_cast<std::uint32_t>(key.source.size());
+    header.source_size = key.source_size;
+    header.source_mtime = key.source_mtime;
+    header.format = static_cast<std::uint32_t>(texture.GetFormat());
+    header.layout = static_cast<std::uint32_t>(texture.GetLayout());
+    header.wrap_u = static_cast<std::uint32_t>(texture.GetWrapU());
+    header.wrap_v = static_cast<std::uint32_t>(texture.GetWrapV());
+    header.width = static_cast<std::uint32_t>(texture.GetWidth());
+    header.height = static_cast<std::uint32_t>(texture.GetHeight());
+    header.level_num = static_cast<std::uint32_t>(texture.GetLevelNum());
+    header.data_offset = AlignUp(sizeof(header) + key.source.size(), kBufferAlignment);
+    header.data_bytes = texture.ByteSize();
+
+    std::string tmp_path = CacheTempPath(cache_path);
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        std::vector<char> padding(header.data_offset - sizeof(header) - key.source.size(), 0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(key.source.data(), key.source.size());
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char *>(texture.Data()), header.data_bytes);
+        if (!out.good())
+        {
+            out.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Maps a texture cache file, the texture uses the mapped memory directly without decoding
+ * @param cache_path Path of the cache file
+ * @param key Key of the texture, the source path, size, mtime, format and layout must all match the file
+ * @return The texture, empty if the file is missing, stale or broken
+ */
+inline Texture2D ReadTextureCache(const std::string &cache_path, const TextureCacheKey &key)
+{
+    size_t file_size = 0;
+    std::shared_ptr<std::uint8_t> file = MapFile(cache_path, file_size);
+    if (file == nullptr || file_size < sizeof(TextureCacheHeader))
+    {
+        return Texture2D();
+    }
+    TextureCacheHeader header;
+    const TextureCacheHeader expect;
+    memcpy(&header, file.get(), sizeof(header));
+    if (header.format > static_cast<std::uint32_t>(TexelFormat::kBC3) || header.layout > static_cast<std::uint32_t>(TextureLayout::kMorton))
+    {
+        return Texture2D();
+    }
+    TexelFormat format = static_cast<TexelFormat>(header.format);
+    TextureLayout layout = static_cast<TextureLayout>(header.layout);
+    if (memcmp(header.magic, expect.magic, sizeof(header.magic)) != 0 || header.version != expect.version ||
+        header.source_length != key.source.size() || sizeof(header) + header.source_length > file_size ||
+        memcmp(file.get() + sizeof(header), key.source.data(), key.source.size()) != 0 ||
+        header.source_size != key.source_size || header.source_mtime != key.source_mtime ||
+        format != key.format || (layout != key.layout && !IsBlockCompressed(format)) ||
+        header.data_offset % kBufferAlignment != 0 || header.data_offset + header.data_bytes > file_size ||
+        header.width == 0 || header.height == 0 || header.level_num == 0 || header.level_num > 32)
+    {
+        return Texture2D();
+    }
+
+    // the texture shares ownership of the mapping
+    std::shared_ptr<std::uint8_t> data(file, file.get() + header.data_offset);
+    Texture2D texture(header.width, header.height, header.level_num, format, layout, data);
+    if (texture.ByteSize() != header.data_bytes)
+    {
+        return Texture2D();
+    }
+    texture.SetWrapMode(static_cast<WrapMode>(header.wrap_u), static_cast<WrapMode>(header.wrap_v));
+    return texture;
+}
+
+}
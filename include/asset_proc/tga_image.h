@@ -43,6 +43,7 @@ struct TGAImage {
     inline void set(const int x, const int y, const TGAColor &c);
     inline int width()  const;
     inline int height() const;
+    inline std::uint8_t * buffer();
 private:
     inline bool   load_rle_data(std::ifstream &in);
     inline bool unload_rle_data(std::ofstream &out) const;
@@ -272,4 +273,8 @@ inline int TGAImage::width() const {
 
 inline int TGAImage::height() const {
     return h;
+}
+
+inline std::uint8_t * TGAImage::buffer() {
+    return data.data();
 }
\ No newline at end of file
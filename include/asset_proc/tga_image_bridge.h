@@ -2,13 +2,214 @@
 
 #include <memory>
 #include <array>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "tga_image.h"
 #include "../image.h"
+#include "../image_writer.h"
+#include "../texture.h"
 
 namespace mistery_render
 {
 
+/**
+ * @brief Reads a whole file into memory with one read
+ * @param filename Path of the file
+ * @param bytes The file content
+ * @return false if the file can not be read
+ */
+inline bool ReadFileBytes(const std::string &filename, std::vector<std::uint8_t> &bytes)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    {
+        return false;
+    }
+    std::streamsize size = in.tellg();
+    if (size < 0)
+    {
+        return false;
+    }
+    bytes.resize(static_cast<size_t>(size));
+    in.seekg(0);
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(bytes.data()), size));
+}
+
+/**
+ * @brief Converts TGA pixels (gray, BGR or BGRA) to RGBA8 texels
+ * @param src The TGA pixels
+ * @param dst The RGBA8 texels
+ * @param n Number of pixels
+ * @param bpp Bytes per TGA pixel, 1, 3 or 4; alpha is 255 if bpp != 4
+ */
+inline void ConvertTGAPixels(const std::uint8_t * src, std::uint8_t * dst, size_t n, int bpp)
+{
+    size_t i = 0;
+    if (bpp == 4)
+    {
+#if defined(__SSE2__)
+        // swap bytes 0 and 2 of each 32-bit lane, 4 pixels per step
+        const __m128i mask_ga = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+        const __m128i mask_rb = _mm_set1_epi32(0x00ff00ff);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+            __m128i rb = _mm_and_si128(bgra, mask_rb);
+            rb = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(rb, 16), mask_rb), _mm_srli_epi32(rb, 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), _mm_or_si128(_mm_and_si128(bgra, mask_ga), rb));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i * 4 + 0] = src[i * 4 + 2];
+            dst[i * 4 + 1] = src[i * 4 + 1];
+            dst[i * 4 + 2] = src[i * 4 + 0];
+            dst[i * 4 + 3] = src[i * 4 + 3];
+        }
+    }
+    else if (bpp == 3)
+    {
+        for (; i < n; i++)
+        {
+            dst[i * 4 + 0] = src[i * 3 + 2];
+            dst[i * 4 + 1] = src[i * 3 + 1];
+            dst[i * 4 + 2] = src[i * 3 + 0];
+            dst[i * 4 + 3] = 255;
+        }
+    }
+    else
+    {
+        for (; i < n; i++)
+        {
+            dst[i * 4 + 0] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i];
+            dst[i * 4 + 3] = 255;
+        }
+    }
+}
+
+/**
+ * @brief Decodes a TGA file in memory into an RGBA8 texture, v == 0 is the bottom row of the image
+ * @attention Supports 8-bit gray, 24-bit BGR and 32-bit BGRA images, raw or RLE, without color map;
+ * the vertical flip is folded into decoding, runs of RLE packets are filled without per-pixel branches
+ * @param bytes The file content
+ * @param size Size of the file content
+ * @return The texture, empty if the data is not a supported TGA
+ */
+inline Texture2D DecodeTGA(const std::uint8_t * bytes, size_t size)
+{
+    const size_t kHeaderBytes = 18;
+    if (size < kHeaderBytes)
+    {
+        return Texture2D();
+    }
+    size_t id_length = bytes[0];
+    int color_map_type = bytes[1];
+    int data_type = bytes[2];
+    size_t width = bytes[12] | (bytes[13] << 8);
+    size_t height = bytes[14] | (bytes[15] << 8);
+    int bpp = bytes[16] >> 3;
+    int descriptor = bytes[17];
+    bool rle = (data_type == 10 || data_type == 11);
+    if (color_map_type != 0 || !(data_type == 2 || data_type == 3 || rle) || width == 0 || height == 0 || 
+        !(bpp == 1 || bpp == 3 || bpp == 4))
+    {
+        return Texture2D();
+    }
+
+    Texture2D texture(width, height);
+    const std::uint8_t * src = bytes + kHeaderBytes + id_length;
+    const std::uint8_t * src_end = bytes + size;
+    // file rows are bottom up unless the top-left origin bit is set
+    bool top_down = (descriptor & 0x20) != 0;
+    auto dst_row = [&](size_t file_row)
+    {
+        return texture.Row(top_down ? height - 1 - file_row : file_row);
+    };
+
+    if (!rle)
+    {
+        if (static_cast<size_t>(src_end - src) < width * height * bpp)
+        {
+            return Texture2D();
+        }
+        for (size_t row = 0; row < height; row++)
+        {
+            ConvertTGAPixels(src + row * width * bpp, dst_row(row), width, bpp);
+        }
+    }
+    else
+    {
+        size_t x = 0;
+        size_t row = 0;
+        while (row < height)
+        {
+            if (src >= src_end)
+            {
+                return Texture2D();
+            }
+            std::uint8_t packet = *src++;
+            size_t count = (packet & 0x7f) + 1;
+            bool run = (packet & 0x80) != 0;
+            size_t packet_bytes = run ? bpp : count * bpp;
+            if (static_cast<size_t>(src_end - src) < packet_bytes)
+            {
+                return Texture2D();
+            }
+            std::uint32_t run_texel = 0;
+            if (run)
+            {
+                ConvertTGAPixels(src, reinterpret_cast<std::uint8_t *>(&run_texel), 1, bpp);
+            }
+            // a packet may cross rows
+            while (count > 0 && row < height)
+            {
+                size_t segment = std::min(count, width - x);
+                std::uint8_t * dst = dst_row(row) + x * 4;
+                if (run)
+                {
+                    std::fill_n(reinterpret_cast<std::uint32_t *>(dst), segment, run_texel);
+                }
+                else
+                {
+                    ConvertTGAPixels(src, dst, segment, bpp);
+                    src += segment * bpp;
+                }
+                count -= segment;
+                x += segment;
+                if (x == width)
+                {
+                    x = 0;
+                    row++;
+                }
+            }
+            if (run)
+            {
+                src += bpp;
+            }
+            else if (count > 0)
+            {
+                return Texture2D();   // raw packet runs past the last row
+            }
+        }
+    }
+
+    // right-to-left images are rare, mirror them after decoding
+    if (descriptor & 0x10)
+    {
+        for (size_t y = 0; y < height; y++)
+        {
+            std::uint32_t * row_ptr = reinterpret_cast<std::uint32_t *>(texture.Row(y));
+            std::reverse(row_ptr, row_ptr + width);
+        }
+    }
+    return texture;
+}
+
 template <class Color>
 bool ImageFromTGA(const std::string &tga_filename, Image<Color> &image_target)
 {
@@ -42,5 +243,26 @@ bool ImageFromTGA(const std::string &tga_filename, Image<Color> &image_target)
     }
 }
 
+/**
+ * @brief Saves an image to a 32-bit TGA file (top-left origin), rows are converted to BGRA8 with SIMD
+ * @param img Image to save
+ * @param tga_filename Path of the TGA file
+ * @param rle Run-length encode the pixels
+ * @return false if writing failed
+ */
+template <class Color>
+bool ImageToTGA(const Image<Color> &img, const std::string &tga_filename, bool rle = true)
+{
+    size_t width = img.GetWidth();
+    size_t height = img.GetHeight();
+    TGAImage tga_image(static_cast<int>(width), static_cast<int>(height), TGAImage::RGBA);
+    std::uint8_t * rgba = ImageWriteBuffer(width * 4).data();
+    for (size_t y = 0; y < height; y++)
+    {
+        PixelsToRGBA8(img.Row(y), width, rgba);
+        ConvertTGAPixels(rgba, tga_image.buffer() + y * width * 4, width, 4);   // swapping r and b is symmetric
+    }
+    return tga_image.write_tga_file(tga_filename, false, rle);
+}
 
-}
\ No newline at end of file
+}
@@ -1,74 +1,146 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <array>
+#include <unordered_map>
 
 #include "tiny_obj_loader.h"
+#include "obj_fast_parser.h"
 #include "tga_image_bridge.h"
+#include "texture_cache_file.h"
+#include "mesh_cache_file.h"
+#include "../mesh_optimize.h"
 #include "../base_data_struct.h"
 #include "../test.h"
 
 namespace mistery_render
 {
 
-template <class real_t>
-std::vector<std::vector<std::array<real_t, 4>>> ParseTextureTGA(std::string tex_name)
+/**
+ * @brief Reads a TGA file into a texture, v == 0 is the bottom row of the image
+ * @param tex_name Path of the TGA file
+ * @param format Texel format of the result
+ * @return The texture, empty if reading failed
+ */
+inline Texture2D ParseTextureTGA(const std::string &tex_name, TexelFormat format = TexelFormat::kRGBA8)
 {
-    TGAImage tga;
-    if (!tga.read_tga_file(tex_name))
+    std::vector<std::uint8_t> bytes;
+    Texture2D texture;
+    if (ReadFileBytes(tex_name, bytes))
+    {
+        texture = DecodeTGA(bytes.data(), bytes.size());
+    }
+    if (texture.Empty())
     {
         std::cerr << "Error reading TGA file: " << tex_name << std::endl;
-        return {};
+        return texture;
+    }
+    if (format == TexelFormat::kRGBA8)
+    {
+        return texture;
     }
-    tga.flip_vertically();
 
-    std::vector<std::vector<std::array<real_t, 4>>> texture(tga.height(), std::vector<std::array<real_t, 4>>(tga.width()));
-    for (int y = 0; y < tga.height(); ++y)
+    Texture2D converted(texture.GetWidth(), texture.GetHeight(), format);
+    const float kInv255 = 1.0f / 255.0f;
+    for (size_t y = 0; y < texture.GetHeight(); ++y)
     {
-        for (int x = 0; x < tga.width(); ++x)
+        const std::uint8_t * src = texture.Row(y);
+        std::uint8_t * dst = converted.Row(y);
+        if (format == TexelFormat::kRGBA32F)
         {
-            TGAColor pixel = tga.get(x, y);
-            texture[y][x] = {static_cast<real_t>(pixel[2]) / 255.0f, static_cast<real_t>(pixel[1]) / 255.0f, 
-                            static_cast<real_t>(pixel[0]) / 255.0f, static_cast<real_t>(pixel[3]) / 255.0f};
+            float * dst_f = reinterpret_cast<float *>(dst);
+            for (size_t i = 0; i < texture.GetWidth() * 4; ++i)
+            {
+                dst_f[i] = src[i] * kInv255;
+            }
+        }
+        else
+        {
+            for (size_t x = 0; x < texture.GetWidth(); ++x)
+            {
+                converted.Store<float>(x, y, {src[x * 4] * kInv255, src[x * 4 + 1] * kInv255, 
+                                              src[x * 4 + 2] * kInv255, src[x * 4 + 3] * kInv255});
+            }
         }
     }
-    return texture;
+    return converted;
 }
 
-template <class real_t, size_t tex_n>
-std::vector<std::vector<std::array<real_t, 4>>> * LoadTexture(std::string tex_name, std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+/**
+ * @brief Reads a texture file and prepares it for sampling: mips, memory layout and compression
+ * @param tex_name Path of the texture file, only TGA is supported
+ * @param layout Memory layout of the result
+ * @param format kBC1 / kBC3 compresses the result, else RGBA8
+ * @param cache_dir Directory of texture cache files, a valid cache file of tex_name is mapped instead of decoding,
+ * else the prepared texture is written there; empty == no cache files
+ * @return The texture, empty if reading failed
+ */
+inline Texture2D LoadTextureFile(const std::string &tex_name, TextureLayout layout, TexelFormat format, const std::string &cache_dir = "")
 {
-    // double ts = NowTime(1);
-    if (tex_name.size()==0)
-    {
-        return nullptr;
-    }
-    
     size_t dot_position = tex_name.find_last_of('.');
-    if (!(dot_position != 0 && dot_position != tex_name.length() - 1))
+    if (dot_position == std::string::npos || dot_position == 0 || dot_position == tex_name.length() - 1)
     {
-        return nullptr;
+        return Texture2D();
     }
     std::string file_type = tex_name.substr(dot_position + 1);
+    if (file_type.compare("tga") != 0)
+    {
+        return Texture2D();
+    }
 
-    if (file_type.compare("tga")==0)
+    TextureCacheKey key;
+    bool use_cache = !cache_dir.empty() && MakeTextureCacheKey(tex_name, format, layout, key);
+    std::string cache_path = use_cache ? TextureCachePath(cache_dir, tex_name) : "";
+    if (use_cache)
     {
-        if (texture_pool->GetTexture(tex_name) == nullptr)
+        Texture2D cached = ReadTextureCache(cache_path, key);
+        if (!cached.Empty())
         {
-            auto tex_tmp = ParseTextureTGA<real_t>(tex_name);
-            if (tex_tmp.size() == 0)
-            {
-                // std::cout << "null tex\n";
-                return nullptr;
-            }
-            texture_pool->InsertTexture(tex_name, ParseTextureTGA<real_t>(tex_name));
+            return cached;
         }
-        // std::cout << "load tex " + tex_name + ": using "<<NowTime(1)-ts<<" ms\n";
-        return texture_pool->GetTexture(tex_name);
     }
 
-    return nullptr;
+    Texture2D texture = ParseTextureTGA(tex_name);
+    if (texture.Empty())
+    {
+        return texture;
+    }
+    texture.GenerateMips(DefaultThreadNum());
+    texture.Relayout(layout);
+    if (IsBlockCompressed(format))
+    {
+        texture = texture.Compress(format, DefaultThreadNum());
+    }
+    if (use_cache)
+    {
+        WriteTextureCache(cache_path, key, texture);
+    }
+    return texture;
+}
 
+/**
+ * @brief Gets a texture reference from the pool, the texture is decoded by LoadTextureFile() on the first sample
+ * @param tex_name Path of the texture file, also the name in the pool
+ * @param texture_pool The pool, its loader is set to LoadTextureFile() if it has none
+ * @return Reference to the texture, empty if tex_name is empty; it acquires nullptr if decoding fails
+ */
+template <class real_t, size_t tex_n>
+TextureRef LoadTexture(std::string tex_name, std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    if (tex_name.size()==0)
+    {
+        return TextureRef();
+    }
+    if (!texture_pool->HasLoader())
+    {
+        TextureCache * cache = texture_pool.get();
+        texture_pool->SetLoader([cache](const std::string &source)
+        {
+            return LoadTextureFile(source, cache->texture_layout, cache->texture_format, cache->texture_cache_dir);
+        });
+    }
+    return TextureRef(texture_pool, texture_pool->Register(tex_name, tex_name));
 }
 
 template <class real_t, size_t tex_n>
@@ -90,15 +162,19 @@ inline Material<real_t> MatObjToMaterial(const tinyobj::material_t &srcMat, std:
     dstMat.illum = srcMat.illum;
     dstMat.dummy = srcMat.dummy;
 
-    // Copy texture names
-    dstMat.ambient_tex = LoadTexture<real_t>(path + srcMat.ambient_texname, texture_pool);
-    dstMat.diffuse_tex = LoadTexture<real_t>(path + srcMat.diffuse_texname, texture_pool);
-    dstMat.specular_tex = LoadTexture<real_t>(path + srcMat.specular_texname, texture_pool);
-    dstMat.specular_highlight_tex = LoadTexture<real_t>(path + srcMat.specular_highlight_texname, texture_pool);
-    dstMat.bump_tex = LoadTexture<real_t>(path + srcMat.bump_texname, texture_pool);
-    dstMat.displacement_tex = LoadTexture<real_t>(path + srcMat.displacement_texname, texture_pool);
-    dstMat.alpha_tex = LoadTexture<real_t>(path + srcMat.alpha_texname, texture_pool);
-    dstMat.reflection_tex = LoadTexture<real_t>(path + srcMat.reflection_texname, texture_pool);
+    // Reference textures, they are decoded lazily when a shader samples them
+    auto load_texture = [&](const std::string &tex_name)
+    {
+        return LoadTexture<real_t>(tex_name.empty() ? tex_name : path + tex_name, texture_pool);
+    };
+    dstMat.ambient_tex = load_texture(srcMat.ambient_texname);
+    dstMat.diffuse_tex = load_texture(srcMat.diffuse_texname);
+    dstMat.specular_tex = load_texture(srcMat.specular_texname);
+    dstMat.specular_highlight_tex = load_texture(srcMat.specular_highlight_texname);
+    dstMat.bump_tex = load_texture(srcMat.bump_texname);
+    dstMat.displacement_tex = load_texture(srcMat.displacement_texname);
+    dstMat.alpha_tex = load_texture(srcMat.alpha_texname);
+    dstMat.reflection_tex = load_texture(srcMat.reflection_texname);
 
     // Copy PBR properties
     dstMat.roughness = srcMat.roughness;
@@ -110,36 +186,149 @@ inline Material<real_t> MatObjToMaterial(const tinyobj::material_t &srcMat, std:
     dstMat.anisotropy_rotation = srcMat.anisotropy_rotation;
     dstMat.pad0 = srcMat.pad0;
 
-    dstMat.roughness_tex = LoadTexture<real_t>(path + srcMat.roughness_texname, texture_pool);
-    dstMat.metallic_tex = LoadTexture<real_t>(path + srcMat.metallic_texname, texture_pool);
-    dstMat.sheen_tex = LoadTexture<real_t>(path + srcMat.sheen_texname, texture_pool);
-    dstMat.emissive_tex = LoadTexture<real_t>(path + srcMat.emissive_texname, texture_pool);
-    dstMat.normal_tex = LoadTexture<real_t>(path + srcMat.normal_texname, texture_pool);
+    dstMat.roughness_tex = load_texture(srcMat.roughness_texname);
+    dstMat.metallic_tex = load_texture(srcMat.metallic_texname);
+    dstMat.sheen_tex = load_texture(srcMat.sheen_texname);
+    dstMat.emissive_tex = load_texture(srcMat.emissive_texname);
+    dstMat.normal_tex = load_texture(srcMat.normal_texname);
 
     return dstMat;
 }
 
 
+/**
+ * @brief Converts a tinyobj shape to an indexed mesh, corners with the same vertex/normal/texcoord indices are merged
+ * @param attrib Attributes of the OBJ file
+ * @param shape The shape, triangulated
+ * @param mesh Output mesh
+ * @return false if a face refers to a vertex, normal or texcoord that is not in attrib
+ */
+inline bool ObjShapeToMeshBuffer(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, MeshBuffer &mesh)
+{
+    size_t vertex_num = attrib.vertices.size() / 3;
+    size_t normal_num = attrib.normals.size() / 3;
+    size_t texcoord_num = attrib.texcoords.size() / 2;
+
+    struct CornerHash
+    {
+        size_t operator()(const std::array<int, 3> &key) const
+        {
+            std::uint64_t hash = static_cast<std::uint32_t>(key[0]);
+            hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint32_t>(key[1]);
+            hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint32_t>(key[2]);
+            return static_cast<size_t>(hash ^ (hash >> 29));
+        }
+    };
+    std::unordered_map<std::array<int, 3>, std::uint32_t, CornerHash> corner_map;
+    corner_map.reserve(shape.mesh.indices.size());
+    std::vector<MeshVertex> vertices;
+    std::vector<std::uint32_t> indices;
+    size_t index_num = shape.mesh.indices.size() / 3 * 3;
+    indices.reserve(index_num);
+    for (size_t i = 0; i < index_num; i++)
+    {
+        const tinyobj::index_t &idx_set = shape.mesh.indices[i];
+        if ((idx_set.vertex_index >= 0 && static_cast<size_t>(idx_set.vertex_index) >= vertex_num) ||
+            (idx_set.normal_index >= 0 && static_cast<size_t>(idx_set.normal_index) >= normal_num) ||
+            (idx_set.texcoord_index >= 0 && static_cast<size_t>(idx_set.texcoord_index) >= texcoord_num))
+        {
+            return false;
+        }
+        std::array<int, 3> key = {idx_set.vertex_index, idx_set.normal_index, idx_set.texcoord_index};
+        auto inserted = corner_map.emplace(key, static_cast<std::uint32_t>(vertices.size()));
+        if (inserted.second)
+        {
+            MeshVertex vertex;
+            if (idx_set.vertex_index >= 0)
+            {
+                const tinyobj::real_t * v = &attrib.vertices[idx_set.vertex_index * 3];
+                vertex.position = {static_cast<float>(v[0]), static_cast<float>(v[1]), static_cast<float>(v[2])};
+            }
+            if (idx_set.normal_index >= 0)
+            {
+                const tinyobj::real_t * n = &attrib.normals[idx_set.normal_index * 3];
+                vertex.normal = {static_cast<float>(n[0]), static_cast<float>(n[1]), static_cast<float>(n[2])};
+            }
+            if (idx_set.texcoord_index >= 0)
+            {
+                const tinyobj::real_t * t = &attrib.texcoords[idx_set.texcoord_index * 2];
+                vertex.texcoord = {static_cast<float>(t[0]), static_cast<float>(t[1])};
+            }
+            vertices.push_back(vertex);
+        }
+        indices.push_back(inserted.first->second);
+    }
+    std::vector<std::int32_t> materials(indices.size() / 3, -1);
+    for (size_t i = 0; i < materials.size() && i < shape.mesh.material_ids.size(); i++)
+    {
+        materials[i] = shape.mesh.material_ids[i];
+    }
+
+    mesh.name = shape.name;
+    mesh.vertices = SharedArray<MeshVertex>(std::move(vertices));
+    mesh.indices = SharedArray<std::uint32_t>(std::move(indices));
+    mesh.materials = SharedArray<std::int32_t>(std::move(materials));
+    return true;
+}
+
+/**
+ * @brief Converts all shapes of an OBJ file to indexed meshes in parallel, see ObjShapeToMeshBuffer()
+ * @param meshes Output meshes, one per shape
+ * @return false if a face of a shape refers to an attribute that is not in attrib
+ */
+inline bool ObjShapesToMeshBuffers(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes,
+                                   std::vector<MeshBuffer> &meshes)
+{
+    meshes.assign(shapes.size(), MeshBuffer());
+    std::vector<char> converted(shapes.size(), 0);
+    ParallelFor(0, meshes.size(), [&](size_t i)
+    {
+        converted[i] = ObjShapeToMeshBuffer(attrib, shapes[i], meshes[i]) ? 1 : 0;
+    });
+    return std::find(converted.begin(), converted.end(), 0) == converted.end();
+}
+
+
 // only support triangle face
 template <class real_t>
 class ModelObj
 {
 private:
-    std::shared_ptr<tinyobj::ObjReader> obj_ = nullptr;
+    std::shared_ptr<const void> obj_ = nullptr;     // owner of attrib_ and shapes_
+    const tinyobj::attrib_t * attrib_ = nullptr;
+    const std::vector<tinyobj::shape_t> * shapes_ = nullptr;
     std::shared_ptr<std::vector<Material<real_t>>> mat_ = nullptr;
+    MeshBuffer mesh_;   // used if obj_ is nullptr
 
     int shape_index_ = 0;
 
+    /**
+     * @brief Material of an id, nullptr (drawn with DefaultMaterial()) for faces without a material (-1) or unknown ids
+     */
+    inline Material<real_t> * GetMaterial(int mat_id) const
+    {
+        return (mat_id >= 0 && static_cast<size_t>(mat_id) < mat_->size()) ? &(mat_->at(mat_id)) : nullptr;
+    }
+
+    inline Vertex<real_t> GetMeshVertex(size_t indices_index) const
+    {
+        MeshVertex vertex = mesh_.GetVertex(mesh_.indices[indices_index]);    // decodes quantized vertices
+        Material<real_t> * mat = GetMaterial(mesh_.materials[indices_index / 3]);
+        return Vertex<real_t>({vertex.position[0], vertex.position[1], vertex.position[2], 1.0},
+                              {vertex.normal[0], vertex.normal[1], vertex.normal[2]},
+                              {vertex.texcoord[0], vertex.texcoord[1]}, mat);
+    }
+
     inline Vertex<real_t> GetVertex(int indices_index) const
     {
 
-        const tinyobj::attrib_t &attrib = obj_->GetAttrib();
-        const tinyobj::shape_t &shape = obj_->GetShapes()[shape_index_];
+        const tinyobj::attrib_t &attrib = *attrib_;
+        const tinyobj::shape_t &shape = (*shapes_)[shape_index_];
 
-        int mat_id = shape.mesh.material_ids[indices_index % 3];
+        int mat_id = shape.mesh.material_ids[indices_index / 3];
         // const tinyobj::material_t &mat = obj_->GetMaterials()[mat_id];
         // std::cout<<"id "<<mat_id<<"\n";
-        Vertex<real_t> res({0, 0, 0, -1.0}, {0, 0, 0}, {0, 0}, &(mat_->at(mat_id)));
+        Vertex<real_t> res({0, 0, 0, -1.0}, {0, 0, 0}, {0, 0}, GetMaterial(mat_id));
 
         // if (indices_index>=shape.mesh.indices.size() || indices_index<0)
         // {
@@ -172,19 +361,53 @@ private:
 
 public:
     ModelObj(){}
-    ModelObj(std::shared_ptr<tinyobj::ObjReader> obj_reader,
+    /**
+     * @brief Constructor
+     * @param obj_source Parsed OBJ file, tinyobj::ObjReader or ObjMeshData, shared by the models of its shapes
+     * @param material Materials of the OBJ file
+     * @param shape_idx Index of the shape of the model
+     */
+    template <class ObjSource>
+    ModelObj(std::shared_ptr<ObjSource> obj_source,
              std::shared_ptr<std::vector<Material<real_t>>> material,
-             int shape_idx) : obj_(obj_reader), mat_(material), shape_index_(shape_idx)
+             int shape_idx) : obj_(obj_source), attrib_(&obj_source->GetAttrib()), shapes_(&obj_source->GetShapes()),
+                              mat_(material), shape_index_(shape_idx)
+    {
+    }
+
+    /**
+     * @brief Constructor of a model in a compact mesh, no parser state is kept
+     * @param mesh The mesh, its material indices index material
+     * @param material Materials of the mesh
+     */
+    ModelObj(const MeshBuffer &mesh, std::shared_ptr<std::vector<Material<real_t>>> material) : mat_(material), mesh_(mesh)
+    {
+    }
+
+    /**
+     * @brief The compact mesh of the model, empty if the model reads parser state
+     */
+    inline const MeshBuffer &GetMesh() const
     {
+        return mesh_;
     }
 
     inline bool PushVertexBuffer(std::vector<Vertex<real_t>> &vertex_buffer) const
     {
-        if (shape_index_ >= (int)(obj_->GetShapes().size()))
+        if (obj_ == nullptr)
+        {
+            vertex_buffer.reserve(vertex_buffer.size() + mesh_.indices.size);
+            for (size_t i = 0; i < mesh_.indices.size; i++)
+            {
+                vertex_buffer.push_back(GetMeshVertex(i));
+            }
+            return true;
+        }
+        if (shape_index_ >= (int)(shapes_->size()))
         {
             return false;
         }
-        int max_idx = obj_->GetShapes()[shape_index_].mesh.indices.size();
+        int max_idx = (*shapes_)[shape_index_].mesh.indices.size();
         for (int i = 0; i < max_idx; i++)
         {
             vertex_buffer.push_back(GetVertex(i));
@@ -193,6 +416,89 @@ public:
     }
 };
 
+/**
+ * @brief Makes the materials of an OBJ file and preloads their textures if the pool wants it
+ * @param mats Materials of the OBJ file
+ * @param obj_path Path of the OBJ file, texture paths are relative to its directory
+ * @param preload false: the textures are not preloaded whatever the pool wants, e.g. when they are loaded later
+ */
+template <class real_t, size_t tex_n>
+inline void BuildObjMaterials(const std::vector<tinyobj::material_t> &mats, const std::string &obj_path,
+                              std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                              std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool,
+                              bool preload = true)
+{
+    size_t last_slash_idx = obj_path.find_last_of('/');
+    std::string mats_path = (last_slash_idx == std::string::npos) ? "" : obj_path.substr(0, last_slash_idx+1);
+    material_list->reserve(mats.size());
+    for (size_t i = 0; i < mats.size(); i++)
+    {
+        // double ts = NowTime(1);
+        material_list->push_back(MatObjToMaterial<double>(mats[i], texture_pool, mats_path));
+        // std::cout << "load tex " + mats[i].name + ": using "<<NowTime(1)-ts<<" ms\n";
+    }
+    if (preload && texture_pool->preload_textures)
+    {
+        // decode the textures the shaders sample on all cores now, instead of one by one on first sample
+        std::vector<TextureHandle> handles;
+        handles.reserve(material_list->size() * 2);
+        for (const Material<real_t> &mat : *material_list)
+        {
+            handles.push_back(mat.diffuse_tex.GetHandle());
+            handles.push_back(mat.specular_tex.GetHandle());
+        }
+        texture_pool->Preload(handles);
+    }
+}
+
+/**
+ * @brief Makes the materials and the models of a parsed OBJ file, the models share the parser state
+ * @param obj_source Parsed OBJ file, tinyobj::ObjReader or ObjMeshData
+ * @param obj_path Path of the OBJ file, texture paths are relative to its directory
+ */
+template <class real_t, size_t tex_n, class ObjSource>
+inline void BuildObjModels(std::shared_ptr<ObjSource> obj_source, const std::string &obj_path,
+                           std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                           std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                           std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    BuildObjMaterials(obj_source->GetMaterials(), obj_path, material_list, texture_pool);
+    for (size_t i = 0; i < obj_source->GetShapes().size(); i++)
+    {
+        model_list->push_back(ModelObj<real_t>(obj_source, material_list, i));
+    }
+}
+
+/**
+ * @brief Makes the materials and the models of a parsed OBJ file, the models own compact meshes converted from it
+ * @param obj_source Parsed OBJ file, tinyobj::ObjReader or ObjMeshData, not needed by the models afterwards
+ * @param obj_path Path of the OBJ file, texture paths are relative to its directory
+ * @return false (nothing is made) if a face refers to an attribute that is not in the file
+ */
+template <class real_t, size_t tex_n, class ObjSource>
+inline bool BuildObjMeshModels(const ObjSource &obj_source, const std::string &obj_path,
+                               std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                               std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                               std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    std::vector<MeshBuffer> meshes;
+    if (!ObjShapesToMeshBuffers(obj_source.GetAttrib(), obj_source.GetShapes(), meshes))
+    {
+        return false;
+    }
+    BuildObjMaterials(obj_source.GetMaterials(), obj_path, material_list, texture_pool);
+    for (const MeshBuffer &mesh : meshes)
+    {
+        model_list->push_back(ModelObj<real_t>(mesh, material_list));
+    }
+    return true;
+}
+
+/**
+ * @brief Loads an OBJ file by tinyobj
+ * @param obj_reader Parser of the file, the models read it
+ * @return Empty if succeeded, else the error message
+ */
 template <class real_t, size_t tex_n>
 inline std::string load_obj(const std::string &obj_path,
                             std::shared_ptr<tinyobj::ObjReader> obj_reader,
@@ -207,20 +513,7 @@ inline std::string load_obj(const std::string &obj_path,
     {
         if (obj_reader->Valid())
         {
-            const std::vector<tinyobj::material_t> mats = obj_reader->GetMaterials();
-            size_t last_slash_idx = obj_path.find_last_of('/');
-            std::string mats_path = (last_slash_idx == std::string::npos) ? "" : obj_path.substr(0, last_slash_idx+1);
-            material_list->reserve(mats.size());
-            for (size_t i = 0; i < mats.size(); i++)
-            {
-                // double ts = NowTime(1);
-                material_list->push_back(MatObjToMaterial<double>(mats[i], texture_pool, mats_path));
-                // std::cout << "load tex " + mats[i].name + ": using "<<NowTime(1)-ts<<" ms\n";
-            }
-            for (size_t i = 0; i < obj_reader->GetShapes().size(); i++)
-            {
-                model_list->push_back(ModelObj(obj_reader, material_list, i));
-            }
+            BuildObjModels(obj_reader, obj_path, material_list, model_list, texture_pool);
             return "";
         }
         else
@@ -235,4 +528,121 @@ inline std::string load_obj(const std::string &obj_path,
     }
 }
 
+/**
+ * @brief Loads an OBJ file by tinyobj like load_obj(), the shapes are converted to compact meshes owned by the models
+ * @attention The parser state is released before returning, so only one copy of each mesh stays resident
+ * @return Empty if succeeded, else the error message
+ */
+template <class real_t, size_t tex_n>
+inline std::string load_obj_compact(const std::string &obj_path,
+                                    std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                                    std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                                    std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    tinyobj::ObjReaderConfig config;
+    config.triangulate = true;
+
+    tinyobj::ObjReader obj_reader;
+    if (!obj_reader.ParseFromFile(obj_path, config))
+    {
+        return "Failed to load: " + obj_path;
+    }
+    if (!obj_reader.Valid())
+    {
+        return "Err: " + obj_reader.Error();
+    }
+    if (!BuildObjMeshModels(obj_reader, obj_path, material_list, model_list, texture_pool))
+    {
+        return "Failed to load: " + obj_path + ": face index out of range";
+    }
+    return "";
+}
+
+/**
+ * @brief Loads an OBJ file like load_obj(), parsed by ParseObjFast() on multiple threads instead of tinyobj
+ * @attention The models own compact meshes, the parser state is released before returning
+ * @return Empty if succeeded, else the error message
+ */
+template <class real_t, size_t tex_n>
+inline std::string load_obj_fast(const std::string &obj_path,
+                                 std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                                 std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                                 std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool)
+{
+    ObjMeshData obj_data;
+    if (!ParseObjFast(obj_path, obj_data))
+    {
+        return "Failed to load: " + obj_path + ": " + obj_data.error;
+    }
+    if (!BuildObjMeshModels(obj_data, obj_path, material_list, model_list, texture_pool))
+    {
+        return "Failed to load: " + obj_path + ": face index out of range";
+    }
+    return "";
+}
+
+/**
+ * @brief Loads an OBJ file through a mesh cache file: a valid cache file is mapped and its meshes are used without
+ * parsing, else the file is parsed by ParseObjFast() and the cache file is written
+ * @attention The cache file is regenerated when the OBJ file or one of its MTL files changes; the models hold the
+ * meshes only, no parser state
+ * @param cache_dir Directory of mesh cache files
+ * @param mesh_flags kMeshCacheOptimized to optimize the meshes by OptimizeMesh(), kMeshCacheQuantized to quantize
+ * them by QuantizeMesh(), before the cache file is written, so the processing runs once per source change; cache
+ * files of other flags do not satisfy each other
+ * @return Empty if succeeded, else the error message
+ */
+template <class real_t, size_t tex_n>
+inline std::string load_obj_cached(const std::string &obj_path, const std::string &cache_dir,
+                                   std::shared_ptr<std::vector<Material<real_t>>> material_list,
+                                   std::shared_ptr<std::vector<ModelObj<real_t>>> model_list,
+                                   std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool,
+                                   std::uint32_t mesh_flags = 0)
+{
+    std::string cache_path = MeshCachePath(cache_dir, obj_path);
+    std::vector<tinyobj::material_t> materials;
+    std::vector<MeshBuffer> meshes;
+    if (!ReadMeshCache(cache_path, obj_path, materials, meshes, mesh_flags))
+    {
+        ObjMeshData data;
+        if (!ParseObjFast(obj_path, data))
+        {
+            return "Failed to load: " + obj_path + ": " + data.error;
+        }
+        if (!ObjShapesToMeshBuffers(data.attrib, data.shapes, meshes))
+        {
+            return "Failed to load: " + obj_path + ": face index out of range";
+        }
+        materials = std::move(data.materials);
+        ParallelFor(0, meshes.size(), [&](size_t i)
+        {
+            if ((mesh_flags & kMeshCacheOptimized) != 0)
+            {
+                meshes[i] = OptimizeMesh(meshes[i]);
+            }
+            if ((mesh_flags & kMeshCacheQuantized) != 0)
+            {
+                meshes[i] = QuantizeMesh(meshes[i]);
+            }
+        });
+
+        std::vector<MeshCacheSource> sources(1 + data.material_libs.size());
+        bool sources_ok = MakeMeshCacheSource(obj_path, sources[0]);
+        for (size_t i = 0; i < data.material_libs.size(); i++)
+        {
+            sources_ok = sources_ok && MakeMeshCacheSource(data.material_libs[i], sources[i + 1]);
+        }
+        if (sources_ok)
+        {
+            WriteMeshCache(cache_path, sources, materials, meshes, mesh_flags);     // the next load parses again if this fails
+        }
+    }
+    BuildObjMaterials(materials, obj_path, material_list, texture_pool);
+    for (const MeshBuffer &mesh : meshes)
+    {
+        model_list->push_back(ModelObj<real_t>(mesh, material_list));
+    }
+    return "";
+}
+
 }
\ No newline at end of file
@@ -1,11 +1,21 @@
 #pragma once
 
 #include <memory>
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "srt.h"
+#include "texture.h"
 
 namespace mistery_render
 {
@@ -20,6 +30,614 @@ inline void PrintContain(Contain cont)
     std::cout<<"\n";
 }
 
+/**
+ * @brief Handle of a texture in TextureCache, stale handles (of deleted textures) are detected by the generation
+ */
+struct TextureHandle
+{
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0;   // 0 == invalid handle
+
+    inline bool Valid() const
+    {
+        return generation != 0;
+    }
+};
+
+/**
+ * @brief Texture cache with hashed lookup, O(1) slot allocation, reference counting and a memory budget
+ * @attention Textures inserted with a source path may be evicted (least recently used first) when the resident
+ * bytes exceed the budget, they are reloaded by the loader on the next Acquire(); textures registered by
+ * Register() are loaded on the first Acquire(); resident textures with the same content (by ContentHash() and
+ * SameContent()) share one storage; all methods are thread-safe
+ */
+class TextureCache
+{
+public:
+    using Loader = std::function<Texture2D(const std::string &source)>;
+
+    TextureLayout texture_layout = TextureLayout::kLinear;  // memory layout of textures loaded by LoadTexture
+    TexelFormat texture_format = TexelFormat::kRGBA8;       // kBC1 / kBC3 compresses textures loaded by LoadTexture
+    bool preload_textures = true;                           // load_obj decodes textures sampled by shaders in parallel
+    std::string texture_cache_dir = "";                     // LoadTexture keeps prepared textures here, empty == no cache files
+
+private:
+    struct Slot
+    {
+        std::string name;
+        std::string source;                         // path to reload from, empty == never evicted
+        std::shared_ptr<const Texture2D> texture;   // nullptr if evicted
+        size_t bytes = 0;                           // bytes of texture when resident
+        std::uint32_t generation = 1;
+        size_t ref_count = 0;
+        bool used = false;
+        bool in_lru = false;
+        bool loading = false;                       // a thread is running the loader for this slot
+        bool load_failed = false;                   // the loader failed, not retried until Insert()
+        bool shared = false;                        // texture is counted in content_map
+        std::uint64_t content_hash = 0;
+        std::list<std::uint32_t>::iterator lru_it;
+    };
+
+    /**
+     * @brief Texel storage shared by resident slots with the same content
+     */
+    struct SharedContent
+    {
+        std::shared_ptr<const Texture2D> texture;
+        size_t user_num = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable load_done;
+    std::vector<Slot> slots;
+    std::vector<std::uint32_t> free_list;
+    std::unordered_map<std::string, std::uint32_t> name_map;
+    std::list<std::uint32_t> lru;   // resident evictable slots, most recently used first
+    size_t resident_bytes = 0;
+    size_t byte_budget = 0;         // 0 == unlimited
+    size_t load_count = 0;
+    std::unordered_map<std::uint64_t, SharedContent> content_map;   // content hash -> shared storage
+    size_t saved_bytes = 0;         // bytes not allocated thanks to shared storage
+    Loader loader;
+
+    inline Slot * GetSlot(TextureHandle handle)
+    {
+        if (!handle.Valid() || handle.index >= slots.size())
+        {
+            return nullptr;
+        }
+        Slot &slot = slots[handle.index];
+        return (slot.used && slot.generation == handle.generation) ? &slot : nullptr;
+    }
+
+    inline void Touch(std::uint32_t index)
+    {
+        Slot &slot = slots[index];
+        if (slot.in_lru)
+        {
+            lru.splice(lru.begin(), lru, slot.lru_it);
+        }
+        else if (!slot.source.empty() && slot.texture != nullptr)
+        {
+            lru.push_front(index);
+            slot.lru_it = lru.begin();
+            slot.in_lru = true;
+        }
+    }
+
+    inline void Unload(std::uint32_t index)
+    {
+        Slot &slot = slots[index];
+        if (slot.in_lru)
+        {
+            lru.erase(slot.lru_it);
+            slot.in_lru = false;
+        }
+        if (slot.texture != nullptr)
+        {
+            auto it = slot.shared ? content_map.find(slot.content_hash) : content_map.end();
+            if (it == content_map.end() || --it->second.user_num == 0)
+            {
+                resident_bytes -= slot.bytes;   // the last user of the storage
+                if (it != content_map.end())
+                {
+                    content_map.erase(it);
+                }
+            }
+            else
+            {
+                saved_bytes -= slot.bytes;
+            }
+        }
+        slot.bytes = 0;
+        slot.shared = false;
+        slot.texture = nullptr;   // samplers still holding it keep the texel data alive
+    }
+
+    /**
+     * @brief Sets the texture of a slot, shares the storage of a resident texture with the same content
+     * @attention Bytes of shared storage are counted once in resident_bytes, so one copy never evicts the others
+     */
+    inline void SetTexture(std::uint32_t index, Texture2D &&texture, std::uint64_t content_hash)
+    {
+        Slot &slot = slots[index];
+        Unload(index);
+        slot.bytes = texture.ByteSize();
+        slot.content_hash = content_hash;
+        auto it = content_map.find(content_hash);
+        if (it == content_map.end())
+        {
+            slot.texture = std::make_shared<const Texture2D>(std::move(texture));
+            slot.shared = true;
+            content_map[content_hash] = {slot.texture, 1};
+            resident_bytes += slot.bytes;
+        }
+        else if (it->second.texture->SameContent(texture))
+        {
+            slot.texture = it->second.texture;
+            slot.shared = true;
+            it->second.user_num++;
+            saved_bytes += slot.bytes;
+        }
+        else
+        {
+            // hash collision of different content, kept unshared
+            slot.texture = std::make_shared<const Texture2D>(std::move(texture));
+            resident_bytes += slot.bytes;
+        }
+        Touch(index);
+    }
+
+    /**
+     * @brief Evicts least recently used textures until the budget is met, keeps keep_index resident
+     */
+    inline void EnforceBudget(std::uint32_t keep_index)
+    {
+        auto it = lru.end();
+        while (byte_budget != 0 && resident_bytes > byte_budget && it != lru.begin())
+        {
+            --it;
+            std::uint32_t index = *it;
+            if (index == keep_index)
+            {
+                continue;
+            }
+            it = std::next(it);     // Unload() erases the element of index from lru
+            Unload(index);
+        }
+    }
+
+    inline void FreeSlot(std::uint32_t index)
+    {
+        Slot &slot = slots[index];
+        Unload(index);
+        name_map.erase(slot.name);
+        slot.name.clear();
+        slot.source.clear();
+        slot.ref_count = 0;
+        slot.used = false;
+        slot.loading = false;
+        slot.load_failed = false;
+        slot.generation = (slot.generation == UINT32_MAX) ? 1 : slot.generation + 1;
+        free_list.push_back(index);
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Max number of textures
+     */
+    explicit TextureCache(size_t capacity) : slots(capacity)
+    {
+        free_list.reserve(capacity);
+        for (size_t i = capacity; i > 0; i--)
+        {
+            free_list.push_back(static_cast<std::uint32_t>(i - 1));
+        }
+        name_map.reserve(capacity);
+    }
+
+    virtual ~TextureCache()
+    {
+    }
+
+    /**
+     * @brief Sets the function to (re)load textures by their source path
+     */
+    inline void SetLoader(Loader loader_init)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loader = loader_init;
+    }
+
+    inline bool HasLoader() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<bool>(loader);
+    }
+
+    /**
+     * @brief Sets the budget of resident texel bytes, evicts textures if needed
+     * @param bytes The budget, 0 == unlimited
+     */
+    inline void SetByteBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        byte_budget = bytes;
+        EnforceBudget(UINT32_MAX);
+    }
+
+    /**
+     * @brief Inserts a texture, or replaces the texture of an existing name (the handle is kept)
+     * @param name Name of the texture
+     * @param texture The texture
+     * @param source Path to reload the texture from after eviction, empty == never evicted
+     * @return Handle of the texture, invalid if the cache is full or the texture is empty
+     */
+    TextureHandle Insert(const std::string &name, Texture2D texture, const std::string &source = "")
+    {
+        if (texture.Empty())
+        {
+            return TextureHandle();
+        }
+        std::uint64_t content_hash = texture.ContentHash();   // hashed without holding the lock
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uint32_t index = 0;
+        auto it = name_map.find(name);
+        if (it != name_map.end())
+        {
+            index = it->second;
+        }
+        else
+        {
+            if (free_list.empty())
+            {
+                return TextureHandle();
+            }
+            index = free_list.back();
+            free_list.pop_back();
+            name_map[name] = index;
+            slots[index].name = name;
+            slots[index].used = true;
+        }
+        Unload(index);
+        slots[index].source = source;
+        slots[index].load_failed = false;
+        SetTexture(index, std::move(texture), content_hash);
+        EnforceBudget(index);
+        return {index, slots[index].generation};
+    }
+
+    /**
+     * @brief Registers a texture without loading it, it is loaded by the loader on the first Acquire()
+     * @param name Name of the texture
+     * @param source Path to load the texture from
+     * @return Handle of the texture (the existing one if the name is registered), invalid if the cache is full
+     */
+    TextureHandle Register(const std::string &name, const std::string &source)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = name_map.find(name);
+        if (it != name_map.end())
+        {
+            return {it->second, slots[it->second].generation};
+        }
+        if (free_list.empty())
+        {
+            return TextureHandle();
+        }
+        std::uint32_t index = free_list.back();
+        free_list.pop_back();
+        name_map[name] = index;
+        slots[index].name = name;
+        slots[index].source = source;
+        slots[index].used = true;
+        return {index, slots[index].generation};
+    }
+
+    /**
+     * @brief Finds a texture by name
+     * @return Handle of the texture, invalid if not found
+     */
+    TextureHandle Find(const std::string &name) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = name_map.find(name);
+        if (it == name_map.end())
+        {
+            return TextureHandle();
+        }
+        return {it->second, slots[it->second].generation};
+    }
+
+    /**
+     * @brief Deletes a texture, its handles become invalid
+     * @return false if the handle is invalid
+     */
+    bool Delete(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (GetSlot(handle) == nullptr)
+        {
+            return false;
+        }
+        FreeSlot(handle.index);
+        return true;
+    }
+
+    /**
+     * @brief Gets a texture for sampling, loads it if not loaded yet or evicted, marks it as most recently used
+     * @attention The loader runs without holding the cache lock, other threads acquiring the same texture wait
+     * for it, so a texture is loaded once however many threads sample it first
+     * @return The texture, it stays valid while the pointer is held even if evicted; nullptr if the handle is
+     * invalid or loading failed
+     * @attention An exception thrown by the loader marks the texture as failed and is rethrown to this caller
+     */
+    std::shared_ptr<const Texture2D> Acquire(TextureHandle handle)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        while (slot != nullptr && slot->texture == nullptr)
+        {
+            if (slot->source.empty() || slot->load_failed || !loader)
+            {
+                return nullptr;
+            }
+            if (slot->loading)
+            {
+                load_done.wait(lock);
+                slot = GetSlot(handle);
+                continue;
+            }
+            slot->loading = true;
+            std::string source = slot->source;
+            Loader load = loader;
+            lock.unlock();
+            Texture2D texture;
+            std::uint64_t content_hash = 0;
+            try
+            {
+                texture = load(source);
+                content_hash = texture.ContentHash();
+            }
+            catch (...)
+            {
+                // waiting threads must not wait for a load that never ends
+                lock.lock();
+                load_count++;
+                slot = GetSlot(handle);
+                if (slot != nullptr)
+                {
+                    slot->loading = false;
+                    slot->load_failed = true;
+                }
+                load_done.notify_all();
+                throw;
+            }
+            lock.lock();
+
+            load_count++;
+            slot = GetSlot(handle);   // the texture may be deleted while loading
+            if (slot != nullptr)
+            {
+                slot->loading = false;
+                slot->load_failed = texture.Empty();
+                if (!slot->load_failed)
+                {
+                    SetTexture(handle.index, std::move(texture), content_hash);
+                    EnforceBudget(handle.index);
+                }
+            }
+            load_done.notify_all();
+        }
+        if (slot == nullptr)
+        {
+            return nullptr;
+        }
+        Touch(handle.index);
+        return slot->texture;
+    }
+
+    /**
+     * @brief Gets a texture for sampling if it is resident, never loads it
+     * @return The texture, nullptr if the handle is invalid or the texture is not loaded yet or evicted
+     */
+    std::shared_ptr<const Texture2D> TryAcquire(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        if (slot == nullptr || slot->texture == nullptr)
+        {
+            return nullptr;
+        }
+        Touch(handle.index);
+        return slot->texture;
+    }
+
+    /**
+     * @brief Loads textures concurrently, each texture is loaded once (duplicates and loaded textures are skipped)
+     * @param handles Handles of the textures, invalid handles are ignored
+     * @param thread_num Number of loading threads
+     */
+    void Preload(std::vector<TextureHandle> handles, size_t thread_num = DefaultThreadNum())
+    {
+        auto less = [](const TextureHandle &lhs, const TextureHandle &rhs)
+        {
+            return lhs.index != rhs.index ? lhs.index < rhs.index : lhs.generation < rhs.generation;
+        };
+        auto equal = [](const TextureHandle &lhs, const TextureHandle &rhs)
+        {
+            return lhs.index == rhs.index && lhs.generation == rhs.generation;
+        };
+        std::sort(handles.begin(), handles.end(), less);
+        handles.erase(std::unique(handles.begin(), handles.end(), equal), handles.end());
+        ParallelFor(0, handles.size(), [&](size_t i)
+        {
+            Acquire(handles[i]);
+        }, thread_num);
+    }
+
+    /**
+     * @brief Adds a reference to a texture
+     */
+    void AddRef(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        if (slot != nullptr)
+        {
+            slot->ref_count++;
+        }
+    }
+
+    /**
+     * @brief Removes a reference to a texture, the texture is deleted when the last reference is removed
+     */
+    void Release(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        if (slot != nullptr && slot->ref_count > 0 && --slot->ref_count == 0)
+        {
+            FreeSlot(handle.index);
+        }
+    }
+
+    /**
+     * @brief Number of references to a texture, 0 if the handle is invalid
+     */
+    size_t RefCount(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        return slot == nullptr ? 0 : slot->ref_count;
+    }
+
+    /**
+     * @brief Whether the texel data of a texture is in memory
+     */
+    bool Resident(TextureHandle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot * slot = GetSlot(handle);
+        return slot != nullptr && slot->texture != nullptr;
+    }
+
+    /**
+     * @brief Number of textures
+     */
+    size_t Size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return name_map.size();
+    }
+
+    /**
+     * @brief Number of textures loaded by the loader
+     */
+    size_t LoadCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return load_count;
+    }
+
+    /**
+     * @brief Size of texel data of all resident textures in bytes, shared storage is counted once
+     */
+    size_t ByteSize() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return resident_bytes;
+    }
+
+    /**
+     * @brief Bytes saved by sharing storage between resident textures with the same content
+     */
+    size_t DedupSavedBytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return saved_bytes;
+    }
+};
+
+/**
+ * @brief Counted reference to a texture in a TextureCache, used by materials
+ */
+class TextureRef
+{
+private:
+    std::shared_ptr<TextureCache> cache = nullptr;
+    TextureHandle handle;
+
+public:
+    TextureRef()
+    {
+    }
+
+    TextureRef(std::shared_ptr<TextureCache> cache_init, TextureHandle handle_init) : cache(cache_init), handle(handle_init)
+    {
+        if (cache != nullptr)
+        {
+            cache->AddRef(handle);
+        }
+    }
+
+    TextureRef(const TextureRef &rhs) : TextureRef(rhs.cache, rhs.handle)
+    {
+    }
+
+    TextureRef(TextureRef &&rhs) : cache(std::move(rhs.cache)), handle(rhs.handle)
+    {
+        rhs.cache = nullptr;
+        rhs.handle = TextureHandle();
+    }
+
+    ~TextureRef()
+    {
+        if (cache != nullptr)
+        {
+            cache->Release(handle);
+        }
+    }
+
+    inline TextureRef &operator=(TextureRef rhs)
+    {
+        std::swap(cache, rhs.cache);
+        std::swap(handle, rhs.handle);
+        return *this;
+    }
+
+    /**
+     * @brief Whether the reference points to no texture
+     */
+    inline bool Empty() const
+    {
+        return cache == nullptr || !handle.Valid();
+    }
+
+    inline TextureHandle GetHandle() const
+    {
+        return handle;
+    }
+
+    /**
+     * @brief Gets the texture for sampling, see TextureCache::Acquire()
+     */
+    inline std::shared_ptr<const Texture2D> Acquire() const
+    {
+        return Empty() ? nullptr : cache->Acquire(handle);
+    }
+
+    /**
+     * @brief Gets the texture for sampling if it is resident, see TextureCache::TryAcquire()
+     */
+    inline std::shared_ptr<const Texture2D> TryAcquire() const
+    {
+        return Empty() ? nullptr : cache->TryAcquire(handle);
+    }
+};
+
 /**
  * @brief Base material, PBR extension
  * @tparam real_t type of real_number in Material
@@ -42,14 +660,14 @@ struct Material
 
     int dummy;  // Suppress padding warning.
     
-    std::vector<std::vector<std::array<real_t, 4>>> * ambient_tex = nullptr;             // map_Ka
-    std::vector<std::vector<std::array<real_t, 4>>> * diffuse_tex = nullptr;             // map_Kd
-    std::vector<std::vector<std::array<real_t, 4>>> * specular_tex = nullptr;            // map_Ks
-    std::vector<std::vector<std::array<real_t, 4>>> * specular_highlight_tex = nullptr;  // map_Ns
-    std::vector<std::vector<std::array<real_t, 4>>> * bump_tex = nullptr;                // map_bump, map_Bump, bump
-    std::vector<std::vector<std::array<real_t, 4>>> * displacement_tex = nullptr;        // disp
-    std::vector<std::vector<std::array<real_t, 4>>> * alpha_tex = nullptr;               // map_d
-    std::vector<std::vector<std::array<real_t, 4>>> * reflection_tex = nullptr;          // refl
+    TextureRef ambient_tex;             // map_Ka
+    TextureRef diffuse_tex;             // map_Kd
+    TextureRef specular_tex;            // map_Ks
+    TextureRef specular_highlight_tex;  // map_Ns
+    TextureRef bump_tex;                // map_bump, map_Bump, bump
+    TextureRef displacement_tex;        // disp
+    TextureRef alpha_tex;               // map_d
+    TextureRef reflection_tex;          // refl
 
     // PBR extension
     real_t roughness;            // [0, 1] default 0
@@ -61,58 +679,73 @@ struct Material
     real_t anisotropy_rotation;  // anisor. [0, 1] default 0
     real_t pad0;
 
-    std::vector<std::vector<std::array<real_t, 4>>> * roughness_tex = nullptr;  // map_Pr
-    std::vector<std::vector<std::array<real_t, 4>>> * metallic_tex = nullptr;   // map_Pm
-    std::vector<std::vector<std::array<real_t, 4>>> * sheen_tex = nullptr;      // map_Ps
-    std::vector<std::vector<std::array<real_t, 4>>> * emissive_tex = nullptr;   // map_Ke
-    std::vector<std::vector<std::array<real_t, 4>>> * normal_tex = nullptr;     // norm. For normal mapping.
+    TextureRef roughness_tex;  // map_Pr
+    TextureRef metallic_tex;   // map_Pm
+    TextureRef sheen_tex;      // map_Ps
+    TextureRef emissive_tex;   // map_Ke
+    TextureRef normal_tex;     // norm. For normal mapping.
+
+    // Render extension
+    int shading_rate = 0;  // shade once per shading_rate * shading_rate pixels, 0 == use the shader's rate
 };
 
+/**
+ * @brief Material of vertices without one (nullptr), e.g. OBJ faces before any usemtl: flat gray, no textures
+ */
+template <class real_t>
+inline const Material<real_t> & DefaultMaterial()
+{
+    static const Material<real_t> material = []()
+    {
+        Material<real_t> mat;
+        mat.name = "default";
+        mat.ambient = {0, 0, 0};
+        mat.diffuse = {0.8, 0.8, 0.8};
+        mat.specular = {0, 0, 0};
+        mat.transmittance = {0, 0, 0};
+        mat.emission = {0, 0, 0};
+        mat.shininess = 1;
+        mat.ior = 1;
+        mat.dissolve = 1;
+        mat.illum = 0;
+        mat.dummy = 0;
+        mat.roughness = 1;
+        mat.metallic = 0;
+        mat.sheen = 0;
+        mat.clearcoat_thickness = 0;
+        mat.clearcoat_roughness = 0;
+        mat.anisotropy = 0;
+        mat.anisotropy_rotation = 0;
+        mat.pad0 = 0;
+        return mat;
+    }();
+    return material;
+}
+
+/**
+ * @brief Texture pool of materials
+ * @tparam size_n Max number of textures
+ */
 template <class real_t, size_t size_n>
-struct TexturePool
+struct TexturePool : public TextureCache
 {
-private:
-    std::map<std::string, size_t> tex_map;
-    std::array<std::vector<std::vector<std::array<real_t, 4>>>, size_n> tex_array;
-public:
-    bool InsertTexture(const std::string &name, const std::vector<std::vector<std::array<real_t, 4>>> &textureData)
+    TexturePool() : TextureCache(size_n)
     {
-        // if (tex_map.find(name) != tex_map.end())
-        // {
-        //     return false;
-        // }
+    }
 
-        for (size_t i = 0; i < tex_array.size(); ++i)
-        {
-            if (tex_array[i].empty())
-            {
-                tex_array[i] = textureData;
-                tex_map[name] = i;
-                return true;
-            }
-        }
-        return false;
+    bool InsertTexture(const std::string &name, Texture2D textureData, const std::string &source = "")
+    {
+        return Insert(name, std::move(textureData), source).Valid();
     }
 
     bool DeleteTexture(const std::string &name)
     {
-        auto it = tex_map.find(name);
-        if (it == tex_map.end())
-        {
-            return false;
-        }
-        tex_array[it->second].resize(0);
-        return true;
+        return Delete(Find(name));
     }
 
-    std::vector<std::vector<std::array<real_t, 4>>> *  GetTexture(const std::string &name)
+    std::shared_ptr<const Texture2D> GetTexture(const std::string &name)
     {
-        auto it = tex_map.find(name);
-        if (it == tex_map.end())
-        {
-            return nullptr;
-        }
-        return &(tex_array[it->second]);
+        return Acquire(Find(name));
     }
 };
 
@@ -177,5 +810,200 @@ struct Vertex
 
 };
 
+/**
+ * @brief Read only array shared by its users, the memory is owned by a vector or a mapped file
+ * @tparam T Type of elements
+ */
+template <class T>
+struct SharedArray
+{
+    std::shared_ptr<const T> data = nullptr;
+    size_t size = 0;
+
+    SharedArray()
+    {
+    }
+
+    SharedArray(std::shared_ptr<const T> data_init, size_t size_init) : data(data_init), size(size_init)
+    {
+    }
+
+    /**
+     * @brief Takes the elements of a vector
+     */
+    explicit SharedArray(std::vector<T> &&values)
+    {
+        std::shared_ptr<std::vector<T>> owner(new std::vector<T>(std::move(values)));
+        data = std::shared_ptr<const T>(owner, owner->data());
+        size = owner->size();
+    }
+
+    inline const T &operator[](size_t i) const
+    {
+        return data.get()[i];
+    }
+
+    inline const T * begin() const
+    {
+        return data.get();
+    }
+
+    inline const T * end() const
+    {
+        return data.get() + size;
+    }
+
+    inline bool Empty() const
+    {
+        return size == 0;
+    }
+};
+
+/**
+ * @brief Vertex of MeshBuffer, 32 bytes, the position w is 1
+ */
+struct MeshVertex
+{
+    std::array<float, 3> position = {0, 0, 0};
+    std::array<float, 3> normal = {0, 0, 0};
+    std::array<float, 2> texcoord = {0, 0};
+};
+
+/**
+ * @brief Quantized vertex of MeshBuffer, 14 bytes: position and texcoord in 16 bit fixed point relative to the bounds
+ * of the mesh, normal octahedral encoded in 2 x 16 bit snorm
+ */
+struct QuantizedMeshVertex
+{
+    std::array<std::uint16_t, 3> position = {0, 0, 0};
+    std::array<std::int16_t, 2> normal = {0, 0};
+    std::array<std::uint16_t, 2> texcoord = {0, 0};
+};
+
+/**
+ * @brief Normal value of QuantizedMeshVertex for a zero normal (the model has no normal), outside the snorm range
+ */
+const std::int16_t kQuantizedZeroNormal = -32768;
+
+/**
+ * @brief Decoding parameters of the quantized vertices of a mesh: value = min + quantized * scale
+ */
+struct MeshQuantization
+{
+    std::array<float, 3> position_min = {0, 0, 0};
+    std::array<float, 3> position_scale = {0, 0, 0};
+    std::array<float, 2> texcoord_min = {0, 0};
+    std::array<float, 2> texcoord_scale = {0, 0};
+};
+
+/**
+ * @brief Encodes a normal to 2 x 16 bit snorm by octahedral mapping, the error is about 0.003 degree
+ * @param normal The normal, need not be normalized; a zero normal is encoded as kQuantizedZeroNormal
+ */
+inline std::array<std::int16_t, 2> EncodeOctahedralNormal(const std::array<float, 3> &normal)
+{
+    float length = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+    if (!(length > 0))
+    {
+        return {kQuantizedZeroNormal, kQuantizedZeroNormal};
+    }
+    float x = normal[0] / length, y = normal[1] / length;
+    if (normal[2] < 0)
+    {
+        float folded_x = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = folded_x;
+    }
+    auto snorm = [](float v)
+    {
+        return static_cast<std::int16_t>(std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f));
+    };
+    return {snorm(x), snorm(y)};
+}
+
+/**
+ * @brief Decodes a normal encoded by EncodeOctahedralNormal()
+ * @return The normalized normal, or zero
+ */
+inline std::array<float, 3> DecodeOctahedralNormal(const std::array<std::int16_t, 2> &encoded)
+{
+    if (encoded[0] == kQuantizedZeroNormal)
+    {
+        return {0, 0, 0};
+    }
+    float x = encoded[0] / 32767.0f, y = encoded[1] / 32767.0f;
+    float z = 1 - std::fabs(x) - std::fabs(y);
+    if (z < 0)
+    {
+        float unfolded_x = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = unfolded_x;
+    }
+    float length = std::sqrt(x * x + y * y + z * z);
+    return {x / length, y / length, z / length};
+}
+
+/**
+ * @brief Indexed triangle mesh of a model in compact buffers, the buffers may be shared with a mesh cache file
+ * @attention The vertices are in vertices, or in quantized_vertices if the mesh is quantized (see QuantizeMesh()),
+ * read them by GetVertex() if both may happen
+ */
+struct MeshBuffer
+{
+    std::string name;
+    SharedArray<MeshVertex> vertices;
+    SharedArray<QuantizedMeshVertex> quantized_vertices;
+    MeshQuantization quantization;              // of quantized_vertices
+    SharedArray<std::uint32_t> indices;         // 3 per triangle
+    SharedArray<std::int32_t> materials;        // material index of each triangle, -1 == none
+
+    inline size_t TriangleNum() const
+    {
+        return indices.size / 3;
+    }
+
+    inline bool IsQuantized() const
+    {
+        return !quantized_vertices.Empty();
+    }
+
+    inline size_t VertexNum() const
+    {
+        return IsQuantized() ? quantized_vertices.size : vertices.size;
+    }
+
+    /**
+     * @brief Gets a vertex, decodes it if the mesh is quantized
+     */
+    inline MeshVertex GetVertex(size_t i) const
+    {
+        if (!IsQuantized())
+        {
+            return vertices[i];
+        }
+        const QuantizedMeshVertex &quantized = quantized_vertices[i];
+        MeshVertex vertex;
+        for (size_t k = 0; k < 3; k++)
+        {
+            vertex.position[k] = quantization.position_min[k] + quantized.position[k] * quantization.position_scale[k];
+        }
+        vertex.normal = DecodeOctahedralNormal(quantized.normal);
+        for (size_t k = 0; k < 2; k++)
+        {
+            vertex.texcoord[k] = quantization.texcoord_min[k] + quantized.texcoord[k] * quantization.texcoord_scale[k];
+        }
+        return vertex;
+    }
+
+    /**
+     * @brief Bytes of the buffers
+     */
+    inline size_t ByteSize() const
+    {
+        return vertices.size * sizeof(MeshVertex) + quantized_vertices.size * sizeof(QuantizedMeshVertex) +
+               indices.size * sizeof(std::uint32_t) + materials.size * sizeof(std::int32_t);
+    }
+};
+
 
 }
\ No newline at end of file
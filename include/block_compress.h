@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+
+namespace mistery_render
+{
+
+/**
+ * @brief Block compression (BC1 / BC3, a.k.a. DXT1 / DXT5) of 4x4 RGBA8 texel blocks
+ * @attention RGBA8 texels are packed as r | g << 8 | b << 16 | a << 24, texels of a block are in row major
+ */
+namespace block_compress
+{
+
+    /**
+     * @brief Bytes of a BC1 block (RGB + 1 bit alpha, 4 bits per texel)
+     */
+    const size_t kBC1BlockBytes = 8;
+
+    /**
+     * @brief Bytes of a BC3 block (RGBA, 8 bits per texel)
+     */
+    const size_t kBC3BlockBytes = 16;
+
+    inline std::uint32_t PackRGBA8(std::uint32_t r, std::uint32_t g, std::uint32_t b, std::uint32_t a)
+    {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    inline std::uint32_t Channel(std::uint32_t texel, int c)
+    {
+        return (texel >> (c * 8)) & 0xff;
+    }
+
+    inline std::uint16_t ToRGB565(std::uint32_t texel)
+    {
+        return static_cast<std::uint16_t>(((Channel(texel, 0) >> 3) << 11) | ((Channel(texel, 1) >> 2) << 5) | (Channel(texel, 2) >> 3));
+    }
+
+    inline std::uint32_t FromRGB565(std::uint16_t color)
+    {
+        std::uint32_t r = (color >> 11) & 31;
+        std::uint32_t g = (color >> 5) & 63;
+        std::uint32_t b = color & 31;
+        return PackRGBA8((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+    }
+
+    /**
+     * @brief Makes the 4 palette colors of a color block
+     * @param c0 The first endpoint in RGB565
+     * @param c1 The second endpoint in RGB565
+     * @param four_color Always use 4 interpolated colors (BC3), else c0 <= c1 selects 3 colors + transparent black (BC1)
+     * @param palette The palette
+     */
+    inline void ColorPalette(std::uint16_t c0, std::uint16_t c1, bool four_color, std::array<std::uint32_t, 4> &palette)
+    {
+        palette[0] = FromRGB565(c0);
+        palette[1] = FromRGB565(c1);
+        std::uint32_t mix2[3];
+        std::uint32_t mix3[3];
+        for (int c = 0; c < 3; c++)
+        {
+            std::uint32_t v0 = Channel(palette[0], c);
+            std::uint32_t v1 = Channel(palette[1], c);
+            if (four_color || c0 > c1)
+            {
+                mix2[c] = (2 * v0 + v1) / 3;
+                mix3[c] = (v0 + 2 * v1) / 3;
+            }
+            else
+            {
+                mix2[c] = (v0 + v1) / 2;
+                mix3[c] = 0;
+            }
+        }
+        palette[2] = PackRGBA8(mix2[0], mix2[1], mix2[2], 255);
+        palette[3] = (four_color || c0 > c1) ? PackRGBA8(mix3[0], mix3[1], mix3[2], 255) : 0;
+    }
+
+    /**
+     * @brief Makes the 8 palette alphas of a BC3 alpha block
+     */
+    inline void AlphaPalette(std::uint32_t a0, std::uint32_t a1, std::array<std::uint32_t, 8> &palette)
+    {
+        palette[0] = a0;
+        palette[1] = a1;
+        if (a0 > a1)
+        {
+            for (std::uint32_t i = 1; i < 7; i++)
+            {
+                palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+            }
+        }
+        else
+        {
+            for (std::uint32_t i = 1; i < 5; i++)
+            {
+                palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    /**
+     * @brief Decodes the color part of a block (the whole BC1 block, or the last 8 bytes of a BC3 block)
+     * @param block The block data
+     * @param four_color See ColorPalette()
+     * @param texels The 16 decoded texels
+     */
+    inline void DecodeColorBlock(const std::uint8_t * block, bool four_color, std::uint32_t * texels)
+    {
+        std::uint16_t c0 = static_cast<std::uint16_t>(block[0] | (block[1] << 8));
+        std::uint16_t c1 = static_cast<std::uint16_t>(block[2] | (block[3] << 8));
+        std::uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<std::uint32_t>(block[7]) << 24);
+        std::array<std::uint32_t, 4> palette;
+        ColorPalette(c0, c1, four_color, palette);
+        for (int i = 0; i < 16; i++)
+        {
+            texels[i] = palette[(indices >> (2 * i)) & 3];
+        }
+    }
+
+    /**
+     * @brief Decodes a BC1 block into 16 RGBA8 texels
+     */
+    inline void DecodeBC1Block(const std::uint8_t * block, std::uint32_t * texels)
+    {
+        DecodeColorBlock(block, false, texels);
+    }
+
+    /**
+     * @brief Decodes a BC3 block into 16 RGBA8 texels
+     */
+    inline void DecodeBC3Block(const std::uint8_t * block, std::uint32_t * texels)
+    {
+        DecodeColorBlock(block + 8, true, texels);
+        std::array<std::uint32_t, 8> palette;
+        AlphaPalette(block[0], block[1], palette);
+        std::uint64_t indices = 0;
+        for (int i = 0; i < 6; i++)
+        {
+            indices |= static_cast<std::uint64_t>(block[2 + i]) << (8 * i);
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            texels[i] = (texels[i] & 0x00ffffff) | (palette[(indices >> (3 * i)) & 7] << 24);
+        }
+    }
+
+    /**
+     * @brief Squared RGB distance of 2 texels
+     */
+    inline std::uint32_t ColorDistance(std::uint32_t lhs, std::uint32_t rhs)
+    {
+        std::uint32_t dist = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            int d = static_cast<int>(Channel(lhs, c)) - static_cast<int>(Channel(rhs, c));
+            dist += d * d;
+        }
+        return dist;
+    }
+
+    /**
+     * @brief Encodes the color part of a block by the bounding box of texel colors
+     * @param texels The 16 texels
+     * @param four_color Encode for BC3 color part, else BC1 (texels with alpha < 128 become transparent)
+     * @param block The output 8 bytes
+     */
+    inline void EncodeColorBlock(const std::uint32_t * texels, bool four_color, std::uint8_t * block)
+    {
+        std::uint32_t min_c[3] = {255, 255, 255};
+        std::uint32_t max_c[3] = {0, 0, 0};
+        bool transparent = false;
+        for (int i = 0; i < 16; i++)
+        {
+            if (!four_color && Channel(texels[i], 3) < 128)
+            {
+                transparent = true;
+                continue;
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                min_c[c] = std::min(min_c[c], Channel(texels[i], c));
+                max_c[c] = std::max(max_c[c], Channel(texels[i], c));
+            }
+        }
+        // pick the diagonal of the box: flip channels that decrease along the channel of the largest range
+        bool all_transparent = min_c[0] > max_c[0];
+        int main_c = 0;
+        for (int c = 1; c < 3; c++)
+        {
+            main_c = (max_c[c] - min_c[c] > max_c[main_c] - min_c[main_c]) ? c : main_c;
+        }
+        if (!all_transparent)
+        {
+            int covariance[3] = {0, 0, 0};
+            for (int i = 0; i < 16; i++)
+            {
+                if (!four_color && Channel(texels[i], 3) < 128)
+                {
+                    continue;
+                }
+                int d_main = 2 * static_cast<int>(Channel(texels[i], main_c)) - static_cast<int>(max_c[main_c] + min_c[main_c]);
+                for (int c = 0; c < 3; c++)
+                {
+                    covariance[c] += d_main * (2 * static_cast<int>(Channel(texels[i], c)) - static_cast<int>(max_c[c] + min_c[c]));
+                }
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                if (covariance[c] < 0)
+                {
+                    std::swap(min_c[c], max_c[c]);
+                }
+            }
+        }
+        std::uint16_t c0 = ToRGB565(PackRGBA8(max_c[0], max_c[1], max_c[2], 255));
+        std::uint16_t c1 = ToRGB565(PackRGBA8(min_c[0], min_c[1], min_c[2], 255));
+        if (all_transparent)
+        {
+            c0 = c1 = 0;
+        }
+        // BC1 selects the mode by the order of endpoints
+        if ((!four_color && transparent && c0 > c1) || ((four_color || !transparent) && c0 < c1))
+        {
+            std::swap(c0, c1);
+        }
+
+        std::array<std::uint32_t, 4> palette;
+        ColorPalette(c0, c1, four_color, palette);
+        bool three_color = !four_color && c0 <= c1;
+        std::uint32_t indices = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            std::uint32_t best = 0;
+            if (three_color && transparent && Channel(texels[i], 3) < 128)
+            {
+                best = 3;
+            }
+            else
+            {
+                std::uint32_t best_dist = ColorDistance(texels[i], palette[0]);
+                for (std::uint32_t k = 1; k < (three_color ? 3u : 4u); k++)
+                {
+                    std::uint32_t dist = ColorDistance(texels[i], palette[k]);
+                    if (dist < best_dist)
+                    {
+                        best = k;
+                        best_dist = dist;
+                    }
+                }
+            }
+            indices |= best << (2 * i);
+        }
+
+        block[0] = c0 & 0xff;
+        block[1] = c0 >> 8;
+        block[2] = c1 & 0xff;
+        block[3] = c1 >> 8;
+        for (int i = 0; i < 4; i++)
+        {
+            block[4 + i] = (indices >> (8 * i)) & 0xff;
+        }
+    }
+
+    /**
+     * @brief Encodes 16 RGBA8 texels into a BC1 block, alpha < 128 is encoded as transparent black
+     */
+    inline void EncodeBC1Block(const std::uint32_t * texels, std::uint8_t * block)
+    {
+        EncodeColorBlock(texels, false, block);
+    }
+
+    /**
+     * @brief Encodes 16 RGBA8 texels into a BC3 block
+     */
+    inline void EncodeBC3Block(const std::uint32_t * texels, std::uint8_t * block)
+    {
+        std::uint32_t a0 = 0;
+        std::uint32_t a1 = 255;
+        for (int i = 0; i < 16; i++)
+        {
+            a0 = std::max(a0, Channel(texels[i], 3));
+            a1 = std::min(a1, Channel(texels[i], 3));
+        }
+        std::array<std::uint32_t, 8> palette;
+        AlphaPalette(a0, a1, palette);
+        std::uint64_t indices = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int alpha = static_cast<int>(Channel(texels[i], 3));
+            std::uint64_t best = 0;
+            int best_dist = 256;
+            for (std::uint64_t k = 0; k < 8; k++)
+            {
+                int dist = std::abs(alpha - static_cast<int>(palette[k]));
+                if (dist < best_dist)
+                {
+                    best = k;
+                    best_dist = dist;
+                }
+            }
+            indices |= best << (3 * i);
+        }
+        block[0] = static_cast<std::uint8_t>(a0);
+        block[1] = static_cast<std::uint8_t>(a1);
+        for (int i = 0; i < 6; i++)
+        {
+            block[2 + i] = (indices >> (8 * i)) & 0xff;
+        }
+        EncodeColorBlock(texels, true, block + 8);
+    }
+
+    /**
+     * @brief Small direct mapped cache of decoded blocks, one per thread
+     */
+    struct DecodedBlockCache
+    {
+        static const size_t kEntryNum = 64;
+
+        struct Entry
+        {
+            std::uint64_t texture_id = 0;   // 0 == empty entry
+            size_t block_offset = 0;
+            std::uint32_t texels[16];
+        };
+        Entry entries[kEntryNum];
+
+        /**
+         * @brief Gets the decoded texels of a block, decodes it on a miss
+         * @param texture_id Unique id of the texture data, must not be 0
+         * @param block_offset Byte offset of the block in the texture data
+         * @param block The block data
+         * @param bc3 BC3 block, else BC1 block
+         * @return The 16 decoded texels
+         */
+        inline const std::uint32_t * Get(std::uint64_t texture_id, size_t block_offset, const std::uint8_t * block, bool bc3)
+        {
+            size_t slot = ((block_offset >> 3) ^ (block_offset >> 11) ^ texture_id) & (kEntryNum - 1);
+            Entry &entry = entries[slot];
+            if (entry.texture_id != texture_id || entry.block_offset != block_offset)
+            {
+                if (bc3)
+                {
+                    DecodeBC3Block(block, entry.texels);
+                }
+                else
+                {
+                    DecodeBC1Block(block, entry.texels);
+                }
+                entry.texture_id = texture_id;
+                entry.block_offset = block_offset;
+            }
+            return entry.texels;
+        }
+    };
+
+    /**
+     * @brief The decoded block cache of the calling thread
+     */
+    inline DecodedBlockCache & ThreadBlockCache()
+    {
+        thread_local DecodedBlockCache cache;
+        return cache;
+    }
+
+}
+
+}
\ No newline at end of file
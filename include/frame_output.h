@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Ring of framebuffers written out by a background thread, so frame N is written while frame N+1 renders
+     * @attention Memory is bounded by the ring size: AcquireFrame() blocks while all frames are queued or being
+     * written (backpressure when writing is slower than rendering); frames are written in submission order
+     */
+    template <class color_t>
+    class AsyncFrameWriter
+    {
+    public:
+        using WriteFunc = std::function<void(const Image<color_t> &frame, size_t frame_index)>;
+
+    private:
+        std::vector<std::unique_ptr<Image<color_t>>> frames;
+        std::vector<Image<color_t> *> free_frames;
+        std::deque<std::pair<Image<color_t> *, size_t>> write_queue;
+        WriteFunc write;
+        std::mutex mutex;
+        std::condition_variable frame_freed;
+        std::condition_variable frame_queued;
+        size_t submit_count = 0;
+        size_t write_count = 0;
+        bool stopping = false;
+        std::thread worker;
+
+        void WriteLoop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                frame_queued.wait(lock, [this]() { return stopping || !write_queue.empty(); });
+                if (write_queue.empty())
+                {
+                    return;     // stopping and everything is written
+                }
+                std::pair<Image<color_t> *, size_t> job = write_queue.front();
+                write_queue.pop_front();
+                lock.unlock();
+                write(*job.first, job.second);
+                lock.lock();
+                write_count++;
+                free_frames.push_back(job.first);
+                frame_freed.notify_all();
+            }
+        }
+
+    public:
+        /**
+         * @brief Constructor, allocates the frames and starts the writer thread
+         * @param width Width of frames
+         * @param height Height of frames
+         * @param frame_num Number of frames in the ring, at least 2 so rendering and writing overlap
+         * @param write_init Writes a frame, called on the writer thread; frame_index counts submitted frames from 0
+         */
+        AsyncFrameWriter(size_t width, size_t height, size_t frame_num, WriteFunc write_init) : write(write_init)
+        {
+            frame_num = std::max<size_t>(frame_num, 1);
+            for (size_t i = 0; i < frame_num; i++)
+            {
+                frames.emplace_back(new Image<color_t>(width, height));
+                free_frames.push_back(frames.back().get());
+            }
+            worker = std::thread(&AsyncFrameWriter::WriteLoop, this);
+        }
+
+        AsyncFrameWriter(const AsyncFrameWriter &) = delete;
+        AsyncFrameWriter & operator=(const AsyncFrameWriter &) = delete;
+
+        /**
+         * @brief Destructor, writes all submitted frames and stops the writer thread
+         */
+        ~AsyncFrameWriter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            frame_queued.notify_all();
+            worker.join();
+        }
+
+        /**
+         * @brief Gets a free frame to render into, blocks until the writer frees one
+         * @attention The content of the frame is the last frame written from it, clear it before rendering
+         */
+        Image<color_t> * AcquireFrame()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_freed.wait(lock, [this]() { return !free_frames.empty(); });
+            Image<color_t> * frame = free_frames.back();
+            free_frames.pop_back();
+            return frame;
+        }
+
+        /**
+         * @brief Queues a frame got by AcquireFrame() for writing, it must not be touched until acquired again
+         * @return Index of the frame, passed to the write function
+         */
+        size_t SubmitFrame(Image<color_t> * frame)
+        {
+            size_t index = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                index = submit_count++;
+                write_queue.emplace_back(frame, index);
+            }
+            frame_queued.notify_one();
+            return index;
+        }
+
+        /**
+         * @brief Waits until all submitted frames are written
+         */
+        void Flush()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_freed.wait(lock, [this]() { return write_count == submit_count; });
+        }
+
+        /**
+         * @brief Number of frames written
+         */
+        size_t WriteCount()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return write_count;
+        }
+
+        size_t FrameNum() const
+        {
+            return frames.size();
+        }
+    };
+
+}
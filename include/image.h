@@ -1,7 +1,9 @@
 #pragma once
 
 #include "math.h"
+#include "aligned_memory.h"
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -85,31 +87,130 @@ namespace mistery_render
         }
     };
 
+    /**
+     * @brief Non-owning view of a rectangle of pixels, e.g. a tile of an Image
+     * @attention The view is invalidated when the image is destroyed or reassigned
+     */
+    template <class Color>
+    class ImageView
+    {
+    private:
+        Color * data = nullptr;
+        size_t width = 0;
+        size_t height = 0;
+        size_t pitch = 0;   // pixels from a row to the next one
+    public:
+        ImageView()
+        {
+        }
+
+        /**
+         * @brief Constructor
+         * @param data_init Pointer to the first pixel
+         * @param width_init Width of the view
+         * @param height_init Height of the view
+         * @param pitch_init Pixels from a row to the next one, >= width_init
+         */
+        ImageView(Color * data_init, size_t width_init, size_t height_init, size_t pitch_init)
+            : data(data_init), width(width_init), height(height_init), pitch(pitch_init)
+        {
+        }
+
+        inline size_t GetWidth() const
+        {
+            return width;
+        }
+
+        inline size_t GetHeight() const
+        {
+            return height;
+        }
+
+        inline size_t GetPitch() const
+        {
+            return pitch;
+        }
+
+        /**
+         * @brief Pointer to the first pixel of row y, GetWidth() pixels are contiguous
+         * @attention Not check y < height
+         */
+        inline Color * Row(size_t y) const
+        {
+            return data + y * pitch;
+        }
+
+        /**
+         * @attention Not check index < (width or height)
+         */
+        inline Color & At(size_t width_idx, size_t height_idx) const
+        {
+            return data[height_idx * pitch + width_idx];
+        }
+
+        /**
+         * @brief Sets all pixels of the view to color
+         */
+        void Fill(const Color &color) const
+        {
+            if (pitch == width)
+            {
+                std::fill_n(data, width * height, color);
+                return;
+            }
+            for (size_t y = 0; y < height; y++)
+            {
+                std::fill_n(Row(y), width, color);
+            }
+        }
+
+        /**
+         * @brief View of a rectangle of this view, clipped to it
+         * @param x Left of the rectangle
+         * @param y Top of the rectangle
+         * @param sub_width Width of the rectangle
+         * @param sub_height Height of the rectangle
+         */
+        ImageView SubView(size_t x, size_t y, size_t sub_width, size_t sub_height) const
+        {
+            x = std::min(x, width);
+            y = std::min(y, height);
+            return ImageView(data + y * pitch + x, std::min(sub_width, width - x), std::min(sub_height, height - y), pitch);
+        }
+    };
+
     /**  
      * @brief Represents an image with a specified color type.  
+     * @attention Pixels are stored in one kBufferAlignment aligned allocation, row by row; 
+     * rows start GetPitch() pixels apart, padded to kBufferAlignment bytes when sizeof(Color) divides it
      */  
     template <class Color>
     class Image
     {
     private: 
-        std::vector<std::vector<Color>> image;
+        std::vector<Color, AlignedAllocator<Color>> pixels;
+        size_t width = 0;
+        size_t height = 0;
+        size_t pitch = 0;
+
+        static inline size_t MakePitch(size_t width)
+        {
+            if (kBufferAlignment % sizeof(Color) == 0)
+            {
+                return AlignUp(width, kBufferAlignment / sizeof(Color));
+            }
+            return width;
+        }
     public: 
         /**  
          * @brief Constructor with image dimensions.  
-         * @param width Width of the image  
-         * @param height Height of the image  
+         * @param width_init Width of the image  
+         * @param height_init Height of the image  
+         * @param color Initial color of pixels
          */  
-        Image(size_t width, size_t height, Color color = Color())
+        Image(size_t width_init, size_t height_init, Color color = Color())
+            : pixels(MakePitch(width_init) * height_init, color), width(width_init), height(height_init), pitch(MakePitch(width_init))
         {
-            image.resize(height);
-            for (size_t i = 0; i < height; i++)
-            {
-                image[i].resize(width);
-                for (size_t j = 0; j < width; j++)
-                {
-                    image[i][j] = color;
-                }
-            }
         }
 
 
@@ -120,9 +221,9 @@ namespace mistery_render
          * @param height_idx Index of height
          * @return color The color which is at the image(width_idx, height_idx)
          */  
-        Color GetColor(size_t width_idx, size_t height_idx)
+        inline const Color & GetColor(size_t width_idx, size_t height_idx) const
         {
-            return image[height_idx][width_idx];
+            return pixels[height_idx * pitch + width_idx];
         }
 
         /**  
@@ -132,9 +233,9 @@ namespace mistery_render
          * @param height_idx Index of height
          * @param color The color which will be at the image(width_idx, height_idx)
          */  
-        void SetColor(size_t width_idx, size_t height_idx, const Color& color)
+        inline void SetColor(size_t width_idx, size_t height_idx, const Color& color)
         {
-            image[height_idx][width_idx] = color;
+            pixels[height_idx * pitch + width_idx] = color;
         }
 
         /**  
@@ -148,19 +249,104 @@ namespace mistery_render
         {
             if(height_idx<GetHeight() && width_idx<GetWidth())
             {
-                image[height_idx][width_idx] = color;
+                SetColor(width_idx, height_idx, color);
                 return true;
             }
             return false;
         }
 
+        /**
+         * @brief Reference to the element in this image
+         * @attention Not check index < (width or height)
+         */
+        inline Color & At(size_t width_idx, size_t height_idx)
+        {
+            return pixels[height_idx * pitch + width_idx];
+        }
+
+        inline const Color & At(size_t width_idx, size_t height_idx) const
+        {
+            return pixels[height_idx * pitch + width_idx];
+        }
+
+        /**
+         * @brief Pointer to the first pixel of row y, GetWidth() pixels are contiguous
+         * @attention Not check y < height
+         */
+        inline Color * Row(size_t y)
+        {
+            return pixels.data() + y * pitch;
+        }
+
+        inline const Color * Row(size_t y) const
+        {
+            return pixels.data() + y * pitch;
+        }
+
+        /**
+         * @brief Pointer to the first pixel, rows are GetPitch() pixels apart
+         */
+        inline Color * Data()
+        {
+            return pixels.data();
+        }
+
+        inline const Color * Data() const
+        {
+            return pixels.data();
+        }
+
+        /**
+         * @brief Pixels from a row to the next one
+         */
+        inline size_t GetPitch() const
+        {
+            return pitch;
+        }
+
+        /**
+         * @brief Sets all pixels to color, the padding of rows included so the buffer is filled in one pass
+         */
+        void Fill(const Color &color)
+        {
+            std::fill(pixels.begin(), pixels.end(), color);
+        }
+
+        /**
+         * @brief Sets all pixels to Color()
+         */
+        void Clear()
+        {
+            Fill(Color());
+        }
+
+        /**
+         * @brief View of the whole image
+         */
+        ImageView<Color> View()
+        {
+            return ImageView<Color>(pixels.data(), width, height, pitch);
+        }
+
+        /**
+         * @brief View of a rectangle of the image, clipped to the image
+         * @param x Left of the rectangle
+         * @param y Top of the rectangle
+         * @param sub_width Width of the rectangle
+         * @param sub_height Height of the rectangle
+         */
+        ImageView<Color> SubView(size_t x, size_t y, size_t sub_width, size_t sub_height)
+        {
+            return View().SubView(x, y, sub_width, sub_height);
+        }
+
         /**  
          * @brief Get the height of the image.  
          * @return Height of the image  
          */  
         inline size_t GetHeight() const
         {
-            return image.size();
+            return height;
         }
 
         /**  
@@ -169,16 +355,8 @@ namespace mistery_render
          */ 
         inline size_t GetWidth() const
         {
-            if (image.size()==0)
-            {
-                return 0;
-            }
-            return image[0].size();
+            return width;
         }
-
-        template <class color_t>
-        friend std::ostream& Save2ppm(Image<color_t> img, std::ostream& target);
-
     };
 
     /**  
@@ -204,14 +382,15 @@ namespace mistery_render
      * @return Reference to the output stream  
      */  
     template <class color_t>
-    inline std::ostream& Save2ppm(Image<color_t> img, std::ostream& target)
+    inline std::ostream& Save2ppm(const Image<color_t> &img, std::ostream& target)
     {
         target << "P3\n" << img.GetWidth() << ' ' << img.GetHeight() << "\n255\n";
-        for (auto row:img.image)
+        for (size_t y = 0; y < img.GetHeight(); y++)
         {
-            for (auto color:row)
+            const color_t * row = img.Row(y);
+            for (size_t x = 0; x < img.GetWidth(); x++)
             {
-                Save2ppm(color, target);
+                Save2ppm(row[x], target);
             }
         }
         return target;
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "image.h"
+#include "pixel_format.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Bytes an image writer converts before writing them out in one call
+     */
+    const size_t kImageWriteChunkBytes = 256 * 1024;
+
+    /**
+     * @brief Byte buffer reused by image writers of the calling thread
+     * @param bytes Min size of the buffer
+     */
+    inline std::vector<std::uint8_t> & ImageWriteBuffer(size_t bytes)
+    {
+        thread_local std::vector<std::uint8_t> buffer;
+        if (buffer.size() < bytes)
+        {
+            buffer.resize(bytes);
+        }
+        return buffer;
+    }
+
+    /**
+     * @brief Quantizes channels in [0, 1] to bytes as int(255.999 * c), out of range values (and NaN) are clamped
+     * @param src The channels
+     * @param count Number of channels
+     * @param dst The bytes, count bytes
+     */
+    inline void QuantizeUnitDoubles(const double * src, size_t count, std::uint8_t * dst)
+    {
+        size_t i = 0;
+#if defined(__SSE2__)
+        // 4 channels per step: clamp, scale, truncate, pack int32 -> int16 -> uint8
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d one = _mm_set1_pd(1.0);
+        const __m128d scale = _mm_set1_pd(255.999);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128d c01 = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(src + i), zero), one);
+            __m128d c23 = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(src + i + 2), zero), one);
+            __m128i q = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_mul_pd(c01, scale)), _mm_cvttpd_epi32(_mm_mul_pd(c23, scale)));
+            q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+            int bytes = _mm_cvtsi128_si32(q);
+            memcpy(dst + i, &bytes, 4);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            double c = src[i] > 0.0 ? (src[i] < 1.0 ? src[i] : 1.0) : 0.0;
+            dst[i] = static_cast<std::uint8_t>(255.999 * c);
+        }
+    }
+
+    /**
+     * @brief Converts pixels to RGBA8 bytes through PixelTraits
+     * @param src The pixels
+     * @param n Number of pixels
+     * @param dst The bytes, 4 * n bytes
+     */
+    template <class Pixel>
+    inline void PixelsToRGBA8(const Pixel * src, size_t n, std::uint8_t * dst)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            m_math::Vector<double, 4> color = PixelTraits<Pixel>::Unpack(src[i]);
+            double channels[4] = {color[0], color[1], color[2], color[3]};
+            QuantizeUnitDoubles(channels, 4, dst + i * 4);
+        }
+    }
+
+    inline void PixelsToRGBA8(const ColorRGBA<double> * src, size_t n, std::uint8_t * dst)
+    {
+        static_assert(sizeof(ColorRGBA<double>) == 4 * sizeof(double), "ColorRGBA<double> must be 4 packed doubles");
+        QuantizeUnitDoubles(reinterpret_cast<const double *>(src), n * 4, dst);
+    }
+
+    inline void PixelsToRGBA8(const ColorRGB<double> * src, size_t n, std::uint8_t * dst)
+    {
+        static_assert(sizeof(ColorRGB<double>) == 3 * sizeof(double), "ColorRGB<double> must be 3 packed doubles");
+        // quantize into the tail of dst, then spread forward: writing pixel i ends at 4 * i + 3, before n + 3 * (i + 1)
+        // where the bytes of the next pixel start
+        std::uint8_t * rgb = dst + n;
+        QuantizeUnitDoubles(reinterpret_cast<const double *>(src), n * 3, rgb);
+        for (size_t i = 0; i < n; i++)
+        {
+            std::uint8_t r = rgb[i * 3 + 0];
+            std::uint8_t g = rgb[i * 3 + 1];
+            std::uint8_t b = rgb[i * 3 + 2];
+            dst[i * 4 + 0] = r;
+            dst[i * 4 + 1] = g;
+            dst[i * 4 + 2] = b;
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    inline void PixelsToRGBA8(const PixelRGBA8 * src, size_t n, std::uint8_t * dst)
+    {
+        memcpy(dst, src, n * 4);
+    }
+
+    /**
+     * @brief Converts an image row by row to bytes and writes them in chunks of about kImageWriteChunkBytes
+     * @param img The image
+     * @param bytes_per_pixel Bytes per pixel of the output
+     * @param convert_row Converts RGBA8 bytes of a row to the output bytes, (rgba, width, dst)
+     * @param target Output stream to write to
+     */
+    template <class Color, class RowFunc>
+    inline std::ostream& WriteImageRows(const Image<Color> &img, size_t bytes_per_pixel, RowFunc convert_row, std::ostream& target)
+    {
+        size_t width = img.GetWidth();
+        size_t row_bytes = width * bytes_per_pixel;
+        if (row_bytes == 0)
+        {
+            return target;
+        }
+        size_t chunk_rows = std::max<size_t>(1, kImageWriteChunkBytes / row_bytes);
+        // [chunk of output rows][one RGBA8 row]
+        std::vector<std::uint8_t> &buffer = ImageWriteBuffer(chunk_rows * row_bytes + width * 4);
+        std::uint8_t * rgba = buffer.data() + chunk_rows * row_bytes;
+        for (size_t y = 0; y < img.GetHeight(); y += chunk_rows)
+        {
+            size_t rows = std::min(chunk_rows, img.GetHeight() - y);
+            for (size_t i = 0; i < rows; i++)
+            {
+                PixelsToRGBA8(img.Row(y + i), width, rgba);
+                convert_row(rgba, width, buffer.data() + i * row_bytes);
+            }
+            target.write(reinterpret_cast<const char *>(buffer.data()), rows * row_bytes);
+        }
+        return target;
+    }
+
+    /**
+     * @brief Saves an image to a binary PPM (P6) file, much smaller and faster than Save2ppm
+     * @param img Image to save
+     * @param target Output stream to write to, must be opened in binary mode
+     * @return Reference to the output stream
+     */
+    template <class color_t>
+    inline std::ostream& Save2ppmBinary(const Image<color_t> &img, std::ostream& target)
+    {
+        target << "P6\n" << img.GetWidth() << ' ' << img.GetHeight() << "\n255\n";
+        return WriteImageRows(img, 3, [](const std::uint8_t * rgba, size_t n, std::uint8_t * dst)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                dst[i * 3 + 0] = rgba[i * 4 + 0];
+                dst[i * 3 + 1] = rgba[i * 4 + 1];
+                dst[i * 3 + 2] = rgba[i * 4 + 2];
+            }
+        }, target);
+    }
+
+    /**
+     * @brief Saves an image as raw RGBA8 bytes, row by row from the top, without any header
+     * @param img Image to save
+     * @param target Output stream to write to, must be opened in binary mode
+     * @return Reference to the output stream
+     */
+    template <class color_t>
+    inline std::ostream& Save2raw(const Image<color_t> &img, std::ostream& target)
+    {
+        return WriteImageRows(img, 4, [](const std::uint8_t * rgba, size_t n, std::uint8_t * dst)
+        {
+            memcpy(dst, rgba, n * 4);
+        }, target);
+    }
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "aligned_memory.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Maps a whole file into memory, pages are loaded on first access; copy on write, so writes never reach the file
+     * @attention Without mmap (non POSIX systems) the file is read into a kBufferAlignment aligned buffer
+     * @param filename Path of the file
+     * @param size Output size of the file
+     * @return Pointer to the file content, at least kBufferAlignment aligned; nullptr if the file can not be read or is empty
+     */
+    inline std::shared_ptr<std::uint8_t> MapFile(const std::string &filename, size_t &size)
+    {
+        size = 0;
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        size_t file_size = static_cast<size_t>(file_stat.st_size);
+        void * ptr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);  // the mapping keeps the file open
+        if (ptr == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        size = file_size;
+        return std::shared_ptr<std::uint8_t>(static_cast<std::uint8_t *>(ptr), [file_size](std::uint8_t * p)
+        {
+            munmap(p, file_size);
+        });
+#else
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in.is_open())
+        {
+            return nullptr;
+        }
+        std::streamsize file_size = in.tellg();
+        if (file_size <= 0)
+        {
+            return nullptr;
+        }
+        std::shared_ptr<std::uint8_t> bytes = MakeAlignedBytes(static_cast<size_t>(file_size));
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char *>(bytes.get()), file_size))
+        {
+            return nullptr;
+        }
+        size = static_cast<size_t>(file_size);
+        return bytes;
+#endif
+    }
+
+}
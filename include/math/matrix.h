@@ -71,7 +71,7 @@ namespace m_math
         /**
          * @brief matrix overload operator==; if T is double, equal will use tolerance of kDoubleAsZero
          */
-        inline bool operator==(const Matrix<T, row, col> &rhs)
+        inline bool operator==(const Matrix<T, row, col> &rhs) const
         {
             for (size_t i = 0; i < row; ++i)
             {
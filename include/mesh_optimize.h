@@ -0,0 +1,509 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "base_data_struct.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Size of the FIFO vertex cache the triangle order is optimized for
+     */
+    const size_t kVertexCacheSize = 16;
+
+    /**
+     * @brief Average number of vertices transformed per triangle (ACMR) with a FIFO cache of cache_size vertices,
+     * 3 without reuse, about 0.5 - 0.7 for well ordered meshes
+     * @param mesh The mesh
+     * @param cache_size Size of the cache
+     */
+    inline double AverageCacheMissRatio(const MeshBuffer &mesh, size_t cache_size = kVertexCacheSize)
+    {
+        if (mesh.TriangleNum() == 0)
+        {
+            return 0.0;
+        }
+        // a vertex is in the cache if it was loaded less than cache_size misses ago
+        std::vector<size_t> load_time(mesh.VertexNum(), 0);
+        size_t misses = 0;
+        for (std::uint32_t index : mesh.indices)
+        {
+            if (load_time[index] == 0 || misses + 1 - load_time[index] >= cache_size)
+            {
+                misses++;
+                load_time[index] = misses;
+            }
+        }
+        return static_cast<double>(misses) / mesh.TriangleNum();
+    }
+
+    /**
+     * @brief Merges vertices with identical attributes, the triangles are kept
+     * @param mesh The mesh, must not be quantized
+     * @return The welded mesh
+     */
+    inline MeshBuffer WeldMeshVertices(const MeshBuffer &mesh)
+    {
+        assert(!mesh.IsQuantized());
+        struct VertexHash
+        {
+            size_t operator()(const MeshVertex &vertex) const
+            {
+                std::uint32_t words[8];
+                memcpy(words, &vertex, sizeof(words));
+                std::uint64_t hash = 14695981039346656037ull;
+                for (std::uint32_t word : words)
+                {
+                    hash = (hash ^ word) * 1099511628211ull;
+                }
+                return static_cast<size_t>(hash ^ (hash >> 32));
+            }
+        };
+        struct VertexEqual
+        {
+            bool operator()(const MeshVertex &a, const MeshVertex &b) const
+            {
+                return memcmp(&a, &b, sizeof(MeshVertex)) == 0;
+            }
+        };
+        static_assert(sizeof(MeshVertex) == 32, "MeshVertex must be 8 packed floats");
+
+        std::unordered_map<MeshVertex, std::uint32_t, VertexHash, VertexEqual> vertex_map;
+        vertex_map.reserve(mesh.vertices.size);
+        std::vector<MeshVertex> vertices;
+        std::vector<std::uint32_t> remap(mesh.vertices.size);
+        for (size_t i = 0; i < mesh.vertices.size; i++)
+        {
+            auto inserted = vertex_map.emplace(mesh.vertices[i], static_cast<std::uint32_t>(vertices.size()));
+            if (inserted.second)
+            {
+                vertices.push_back(mesh.vertices[i]);
+            }
+            remap[i] = inserted.first->second;
+        }
+        std::vector<std::uint32_t> indices(mesh.indices.size);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            indices[i] = remap[mesh.indices[i]];
+        }
+
+        MeshBuffer welded;
+        welded.name = mesh.name;
+        welded.vertices = SharedArray<MeshVertex>(std::move(vertices));
+        welded.indices = SharedArray<std::uint32_t>(std::move(indices));
+        welded.materials = mesh.materials;
+        return welded;
+    }
+
+    /**
+     * @brief Drops triangles that cover no pixels: two corners share a vertex, or the positions are collinear
+     * @param mesh The mesh
+     * @return The mesh without degenerate triangles, the vertices are kept
+     * @attention The mesh must not be quantized
+     */
+    inline MeshBuffer RemoveDegenerateTriangles(const MeshBuffer &mesh)
+    {
+        assert(!mesh.IsQuantized());
+        std::vector<std::uint32_t> indices;
+        std::vector<std::int32_t> materials;
+        indices.reserve(mesh.indices.size);
+        materials.reserve(mesh.TriangleNum());
+        for (size_t t = 0; t < mesh.TriangleNum(); t++)
+        {
+            std::uint32_t i0 = mesh.indices[t * 3], i1 = mesh.indices[t * 3 + 1], i2 = mesh.indices[t * 3 + 2];
+            if (i0 == i1 || i1 == i2 || i0 == i2)
+            {
+                continue;
+            }
+            const std::array<float, 3> &p0 = mesh.vertices[i0].position;
+            const std::array<float, 3> &p1 = mesh.vertices[i1].position;
+            const std::array<float, 3> &p2 = mesh.vertices[i2].position;
+            double e0[3] = {double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2]};
+            double e1[3] = {double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2]};
+            if (e0[1] * e1[2] - e0[2] * e1[1] == 0.0 && e0[2] * e1[0] - e0[0] * e1[2] == 0.0 && e0[0] * e1[1] - e0[1] * e1[0] == 0.0)
+            {
+                continue;
+            }
+            indices.insert(indices.end(), {i0, i1, i2});
+            materials.push_back(mesh.materials[t]);
+        }
+
+        MeshBuffer result;
+        result.name = mesh.name;
+        result.vertices = mesh.vertices;
+        result.indices = SharedArray<std::uint32_t>(std::move(indices));
+        result.materials = SharedArray<std::int32_t>(std::move(materials));
+        return result;
+    }
+
+    /**
+     * @brief Orders triangles for a FIFO vertex cache by Tipsify (Sander et al. 2007): fans around the current vertex,
+     * then moves to the neighbour that stays longest in the cache
+     * @param indices Indices of the triangles to order
+     * @param triangles Triangles to order (indices of triangles of indices)
+     * @param vertex_num Number of vertices
+     * @param cache_size Size of the cache
+     * @param order Output, the triangles appended in the new order
+     * @param clusters Output, positions in order where Tipsify had to restart at a vertex not in the cache
+     */
+    inline void TipsifyTriangles(const SharedArray<std::uint32_t> &indices, const std::vector<std::uint32_t> &triangles,
+                                 size_t vertex_num, size_t cache_size, std::vector<std::uint32_t> &order, std::vector<size_t> &clusters)
+    {
+        // triangles of each vertex (CSR)
+        std::vector<std::uint32_t> live(vertex_num, 0);
+        for (std::uint32_t t : triangles)
+        {
+            live[indices[t * 3]]++;
+            live[indices[t * 3 + 1]]++;
+            live[indices[t * 3 + 2]]++;
+        }
+        std::vector<std::uint32_t> adjacency_begin(vertex_num + 1, 0);
+        for (size_t v = 0; v < vertex_num; v++)
+        {
+            adjacency_begin[v + 1] = adjacency_begin[v] + live[v];
+        }
+        std::vector<std::uint32_t> adjacency(adjacency_begin[vertex_num]);
+        std::vector<std::uint32_t> fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+        for (std::uint32_t t : triangles)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+            }
+        }
+
+        std::vector<char> emitted(indices.size / 3, 0);
+        std::vector<size_t> cache_time(vertex_num, 0);
+        std::vector<std::uint32_t> dead_end;
+        std::vector<std::uint32_t> candidates;
+        size_t time = cache_size + 1;
+        size_t cursor = 0;
+        clusters.push_back(order.size());
+
+        // first vertex with triangles
+        while (cursor < vertex_num && live[cursor] == 0)
+        {
+            cursor++;
+        }
+        long fan = cursor < vertex_num ? static_cast<long>(cursor) : -1;
+        while (fan >= 0)
+        {
+            candidates.clear();
+            for (std::uint32_t a = adjacency_begin[fan]; a < adjacency_begin[fan + 1]; a++)
+            {
+                std::uint32_t t = adjacency[a];
+                if (emitted[t] != 0)
+                {
+                    continue;
+                }
+                emitted[t] = 1;
+                order.push_back(t);
+                for (size_t k = 0; k < 3; k++)
+                {
+                    std::uint32_t v = indices[t * 3 + k];
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cache_time[v] > cache_size)
+                    {
+                        cache_time[v] = time;
+                        time++;
+                    }
+                }
+            }
+
+            // the candidate that stays longest in the cache after its remaining triangles are emitted
+            long best = -1;
+            size_t best_priority = 0;
+            for (std::uint32_t v : candidates)
+            {
+                if (live[v] == 0)
+                {
+                    continue;
+                }
+                size_t priority = 0;
+                if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                {
+                    priority = time - cache_time[v];
+                }
+                if (best < 0 || priority > best_priority)
+                {
+                    best = v;
+                    best_priority = priority;
+                }
+            }
+            if (best < 0)
+            {
+                while (!dead_end.empty() && best < 0)
+                {
+                    std::uint32_t v = dead_end.back();
+                    dead_end.pop_back();
+                    best = live[v] > 0 ? static_cast<long>(v) : -1;
+                }
+                while (best < 0 && cursor < vertex_num)
+                {
+                    best = live[cursor] > 0 ? static_cast<long>(cursor) : -1;
+                    cursor++;
+                }
+                if (best >= 0)
+                {
+                    clusters.push_back(order.size());
+                }
+            }
+            fan = best;
+        }
+    }
+
+    /**
+     * @brief Reorders triangles for vertex cache locality (Tipsify) and then for less overdraw: the clusters of Tipsify
+     * are sorted so that the ones facing away from the center of the mesh (likely in front) are drawn first
+     * @attention Triangles of a material stay together, so material switches in the shader do not increase
+     * @param mesh The mesh
+     * @param cache_size Size of the vertex cache
+     * @return The reordered mesh, the vertices are kept
+     * @attention The mesh must not be quantized
+     */
+    inline MeshBuffer OptimizeTriangleOrder(const MeshBuffer &mesh, size_t cache_size = kVertexCacheSize)
+    {
+        assert(!mesh.IsQuantized());
+        size_t triangle_num = mesh.TriangleNum();
+        std::vector<std::uint32_t> by_material(triangle_num);
+        std::iota(by_material.begin(), by_material.end(), 0);
+        std::stable_sort(by_material.begin(), by_material.end(), [&](std::uint32_t a, std::uint32_t b)
+        {
+            return mesh.materials[a] < mesh.materials[b];
+        });
+
+        // area weighted center of the mesh
+        auto triangle_normal = [&](std::uint32_t t, double * center)
+        {
+            const std::array<float, 3> &p0 = mesh.vertices[mesh.indices[t * 3]].position;
+            const std::array<float, 3> &p1 = mesh.vertices[mesh.indices[t * 3 + 1]].position;
+            const std::array<float, 3> &p2 = mesh.vertices[mesh.indices[t * 3 + 2]].position;
+            double e0[3] = {double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2]};
+            double e1[3] = {double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2]};
+            for (size_t k = 0; k < 3; k++)
+            {
+                center[k] = (double(p0[k]) + p1[k] + p2[k]) / 3.0;
+            }
+            return std::array<double, 3>{e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0]};
+        };
+        double mesh_center[3] = {0, 0, 0};
+        double mesh_area = 0;
+        for (size_t t = 0; t < triangle_num; t++)
+        {
+            double center[3];
+            std::array<double, 3> normal = triangle_normal(static_cast<std::uint32_t>(t), center);
+            double area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for (size_t k = 0; k < 3; k++)
+            {
+                mesh_center[k] += center[k] * area;
+            }
+            mesh_area += area;
+        }
+        for (size_t k = 0; k < 3 && mesh_area > 0; k++)
+        {
+            mesh_center[k] /= mesh_area;
+        }
+
+        std::vector<std::uint32_t> order;
+        order.reserve(triangle_num);
+        for (size_t begin = 0; begin < triangle_num;)
+        {
+            size_t end = begin;
+            while (end < triangle_num && mesh.materials[by_material[end]] == mesh.materials[by_material[begin]])
+            {
+                end++;
+            }
+            std::vector<std::uint32_t> group(by_material.begin() + begin, by_material.begin() + end);
+            std::vector<std::uint32_t> group_order;
+            std::vector<size_t> clusters;
+            group_order.reserve(group.size());
+            TipsifyTriangles(mesh.indices, group, mesh.vertices.size, cache_size, group_order, clusters);
+            clusters.push_back(group_order.size());
+
+            // sort key of a cluster: its center relative to the mesh center, projected on its normal
+            std::vector<std::pair<double, size_t>> keys;
+            for (size_t c = 0; c + 1 < clusters.size(); c++)
+            {
+                double cluster_center[3] = {0, 0, 0};
+                double cluster_normal[3] = {0, 0, 0};
+                double cluster_area = 0;
+                for (size_t i = clusters[c]; i < clusters[c + 1]; i++)
+                {
+                    double center[3];
+                    std::array<double, 3> normal = triangle_normal(group_order[i], center);
+                    double area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                    for (size_t k = 0; k < 3; k++)
+                    {
+                        cluster_center[k] += center[k] * area;
+                        cluster_normal[k] += normal[k];
+                    }
+                    cluster_area += area;
+                }
+                double normal_length = std::sqrt(cluster_normal[0] * cluster_normal[0] + cluster_normal[1] * cluster_normal[1] +
+                                                 cluster_normal[2] * cluster_normal[2]);
+                double key = 0;
+                for (size_t k = 0; k < 3 && cluster_area > 0 && normal_length > 0; k++)
+                {
+                    key += (cluster_center[k] / cluster_area - mesh_center[k]) * cluster_normal[k] / normal_length;
+                }
+                keys.emplace_back(key, c);
+            }
+            std::stable_sort(keys.begin(), keys.end(), [](const std::pair<double, size_t> &a, const std::pair<double, size_t> &b)
+            {
+                return a.first > b.first;
+            });
+            for (const std::pair<double, size_t> &key : keys)
+            {
+                order.insert(order.end(), group_order.begin() + clusters[key.second], group_order.begin() + clusters[key.second + 1]);
+            }
+            begin = end;
+        }
+
+        std::vector<std::uint32_t> indices(triangle_num * 3);
+        std::vector<std::int32_t> materials(triangle_num);
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                indices[i * 3 + k] = mesh.indices[order[i] * 3 + k];
+            }
+            materials[i] = mesh.materials[order[i]];
+        }
+        MeshBuffer result;
+        result.name = mesh.name;
+        result.vertices = mesh.vertices;
+        result.indices = SharedArray<std::uint32_t>(std::move(indices));
+        result.materials = SharedArray<std::int32_t>(std::move(materials));
+        return result;
+    }
+
+    /**
+     * @brief Reorders vertices by their first use in the triangles, so vertex reads are sequential; unused vertices are dropped
+     * @param mesh The mesh
+     * @return The mesh with reordered vertices, the triangles are kept
+     * @attention The mesh must not be quantized
+     */
+    inline MeshBuffer OptimizeVertexFetch(const MeshBuffer &mesh)
+    {
+        assert(!mesh.IsQuantized());
+        const std::uint32_t kUnused = 0xffffffffu;
+        std::vector<std::uint32_t> remap(mesh.vertices.size, kUnused);
+        std::vector<MeshVertex> vertices;
+        std::vector<std::uint32_t> indices(mesh.indices.size);
+        for (size_t i = 0; i < mesh.indices.size; i++)
+        {
+            std::uint32_t &new_index = remap[mesh.indices[i]];
+            if (new_index == kUnused)
+            {
+                new_index = static_cast<std::uint32_t>(vertices.size());
+                vertices.push_back(mesh.vertices[mesh.indices[i]]);
+            }
+            indices[i] = new_index;
+        }
+        MeshBuffer result;
+        result.name = mesh.name;
+        result.vertices = SharedArray<MeshVertex>(std::move(vertices));
+        result.indices = SharedArray<std::uint32_t>(std::move(indices));
+        result.materials = mesh.materials;
+        return result;
+    }
+
+    /**
+     * @brief Runs all mesh optimizations once at load or bake time: welding, removing degenerate triangles, triangle
+     * order for the vertex cache and overdraw, vertex order for fetching
+     * @param mesh The mesh
+     * @param cache_size Size of the vertex cache
+     * @attention A quantized mesh is returned unchanged, optimize before QuantizeMesh()
+     * @return The optimized mesh, it draws the same surface
+     */
+    inline MeshBuffer OptimizeMesh(const MeshBuffer &mesh, size_t cache_size = kVertexCacheSize)
+    {
+        if (mesh.IsQuantized())
+        {
+            return mesh;    // the passes read unquantized vertices
+        }
+        MeshBuffer result = WeldMeshVertices(mesh);
+        result = RemoveDegenerateTriangles(result);
+        result = OptimizeTriangleOrder(result, cache_size);
+        return OptimizeVertexFetch(result);
+    }
+
+    /**
+     * @brief Quantizes the vertices of a mesh: positions and texcoords to 16 bit relative to their bounds in the mesh,
+     * normals octahedral encoded in 2 x 16 bit; the position error is at most 1 / 131070 of the mesh extent
+     * @attention Run after the other optimizations, they read unquantized vertices
+     * @param mesh The mesh, returned as is if already quantized
+     * @return The quantized mesh, the triangles are kept
+     */
+    inline MeshBuffer QuantizeMesh(const MeshBuffer &mesh)
+    {
+        if (mesh.IsQuantized() || mesh.vertices.Empty())
+        {
+            return mesh;
+        }
+        MeshQuantization quantization;
+        std::array<float, 3> position_max = mesh.vertices[0].position;
+        std::array<float, 2> texcoord_max = mesh.vertices[0].texcoord;
+        quantization.position_min = mesh.vertices[0].position;
+        quantization.texcoord_min = mesh.vertices[0].texcoord;
+        for (const MeshVertex &vertex : mesh.vertices)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                quantization.position_min[k] = std::min(quantization.position_min[k], vertex.position[k]);
+                position_max[k] = std::max(position_max[k], vertex.position[k]);
+            }
+            for (size_t k = 0; k < 2; k++)
+            {
+                quantization.texcoord_min[k] = std::min(quantization.texcoord_min[k], vertex.texcoord[k]);
+                texcoord_max[k] = std::max(texcoord_max[k], vertex.texcoord[k]);
+            }
+        }
+        for (size_t k = 0; k < 3; k++)
+        {
+            quantization.position_scale[k] = (position_max[k] - quantization.position_min[k]) / 65535.0f;
+        }
+        for (size_t k = 0; k < 2; k++)
+        {
+            quantization.texcoord_scale[k] = (texcoord_max[k] - quantization.texcoord_min[k]) / 65535.0f;
+        }
+        auto quantize = [](float value, float min, float scale)
+        {
+            float q = scale > 0 ? std::round((value - min) / scale) : 0.0f;
+            return static_cast<std::uint16_t>(std::min(std::max(q, 0.0f), 65535.0f));
+        };
+
+        std::vector<QuantizedMeshVertex> vertices(mesh.vertices.size);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const MeshVertex &vertex = mesh.vertices[i];
+            for (size_t k = 0; k < 3; k++)
+            {
+                vertices[i].position[k] = quantize(vertex.position[k], quantization.position_min[k], quantization.position_scale[k]);
+            }
+            vertices[i].normal = EncodeOctahedralNormal(vertex.normal);
+            for (size_t k = 0; k < 2; k++)
+            {
+                vertices[i].texcoord[k] = quantize(vertex.texcoord[k], quantization.texcoord_min[k], quantization.texcoord_scale[k]);
+            }
+        }
+        MeshBuffer result;
+        result.name = mesh.name;
+        result.quantized_vertices = SharedArray<QuantizedMeshVertex>(std::move(vertices));
+        result.quantization = quantization;
+        result.indices = mesh.indices;
+        result.materials = mesh.materials;
+        return result;
+    }
+
+}
@@ -4,11 +4,17 @@
 #include "math.h"
 #include "srt.h"
 #include "image.h"
+#include "pixel_format.h"
+#include "image_writer.h"
 #include "draw.h"
 #include "base_data_struct.h"
+#include "mesh_optimize.h"
 #include "asset_proc/tiny_obj_bridge.h"
+#include "asset_proc/gltf_bridge.h"
+#include "frame_output.h"
 #include "shader.h"
 #include "scene.h"
+#include "progressive_loader.h"
 #include "test.h"
 
 namespace mistery_render
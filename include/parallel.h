@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Number of threads used by parallel algorithms by default
+     * @return Number of hardware threads, at least 1
+     */
+    inline size_t DefaultThreadNum()
+    {
+        size_t thread_num = std::thread::hardware_concurrency();
+        return thread_num == 0 ? 1 : thread_num;
+    }
+
+    /**
+     * @brief Whether the calling thread runs inside ParallelFor, nested ParallelFor calls run serially
+     */
+    inline bool & InParallelRegion()
+    {
+        thread_local bool in_region = false;
+        return in_region;
+    }
+
+    /**
+     * @brief Calls func(i) for each i in [begin, end) on a group of threads, and blocks until all calls return
+     * @tparam Func The functor type, func(size_t i) must be thread-safe for different i
+     * @param begin The first index
+     * @param end The index after the last one
+     * @param func The functor to call
+     * @param thread_num Number of threads (including the calling thread), runs serially if thread_num <= 1 or 
+     * if called inside another ParallelFor, so nested loops do not oversubscribe the cores
+     */
+    template <class Func>
+    inline void ParallelFor(size_t begin, size_t end, Func func, size_t thread_num = DefaultThreadNum())
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+        size_t count = end - begin;
+        thread_num = std::min(thread_num, count);
+        if (thread_num <= 1 || InParallelRegion())
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                func(i);
+            }
+            return;
+        }
+
+        // workers grab chunks of indices, small chunks keep the load balanced
+        size_t chunk = std::max<size_t>(1, count / (thread_num * 8));
+        std::atomic<size_t> next(begin);
+        auto worker = [&]()
+        {
+            bool outer_region = InParallelRegion();
+            InParallelRegion() = true;
+            for (size_t chunk_begin = next.fetch_add(chunk); chunk_begin < end; chunk_begin = next.fetch_add(chunk))
+            {
+                size_t chunk_end = std::min(end, chunk_begin + chunk);
+                for (size_t i = chunk_begin; i < chunk_end; i++)
+                {
+                    func(i);
+                }
+            }
+            InParallelRegion() = outer_region;
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(thread_num - 1);
+        for (size_t i = 0; i + 1 < thread_num; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+}
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include "math.h"
+#include "image.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief 4 x uint8 color, 4 bytes per pixel
+     */
+    struct PixelRGBA8
+    {
+        std::uint8_t r = 0;
+        std::uint8_t g = 0;
+        std::uint8_t b = 0;
+        std::uint8_t a = 0;
+    };
+
+    /**
+     * @brief 5-6-5 bits color (red in the high bits), 2 bytes per pixel, alpha is always 1
+     */
+    struct PixelRGB565
+    {
+        std::uint16_t value = 0;
+    };
+
+    /**
+     * @brief Depth in the high 16 bits of an order preserving float encoding, about 3 significant digits
+     */
+    struct Depth16
+    {
+        std::uint16_t value = 0;
+    };
+
+    /**
+     * @brief Depth in the high 24 bits of an order preserving float encoding, about 5 significant digits
+     */
+    struct Depth24
+    {
+        std::uint32_t value = 0;    // low 24 bits
+    };
+
+    /**
+     * @brief Converts colors of shaders (rgba in [0, 1]) from and to a pixel format of Image
+     * @attention Specialized for ColorRGB, ColorRGBA, PixelRGBA8 and PixelRGB565
+     * @tparam Pixel The pixel format
+     */
+    template <class Pixel>
+    struct PixelTraits;
+
+    template <class T>
+    struct PixelTraits<ColorRGBA<T>>
+    {
+        template <class real_t>
+        static inline ColorRGBA<T> Pack(const m_math::Vector<real_t, 4> &color)
+        {
+            return ColorRGBA<T>(color[0], color[1], color[2], color[3]);
+        }
+
+        static inline m_math::Vector<double, 4> Unpack(const ColorRGBA<T> &pixel)
+        {
+            return m_math::Vector<double, 4>({pixel[0], pixel[1], pixel[2], pixel[3]});
+        }
+    };
+
+    template <class T>
+    struct PixelTraits<ColorRGB<T>>
+    {
+        template <class real_t>
+        static inline ColorRGB<T> Pack(const m_math::Vector<real_t, 4> &color)
+        {
+            return ColorRGB<T>(color[0], color[1], color[2]);
+        }
+
+        static inline m_math::Vector<double, 4> Unpack(const ColorRGB<T> &pixel)
+        {
+            return m_math::Vector<double, 4>({pixel[0], pixel[1], pixel[2], 1.0});
+        }
+    };
+
+    /**
+     * @brief Quantizes a channel in [0, 1] to [0, max_value] with rounding, out of range values are clamped
+     */
+    inline std::uint32_t QuantizeChannel(double value, std::uint32_t max_value)
+    {
+        return static_cast<std::uint32_t>(std::min(std::max(value, 0.0), 1.0) * max_value + 0.5);
+    }
+
+    template <>
+    struct PixelTraits<PixelRGBA8>
+    {
+        template <class real_t>
+        static inline PixelRGBA8 Pack(const m_math::Vector<real_t, 4> &color)
+        {
+            PixelRGBA8 pixel;
+            pixel.r = static_cast<std::uint8_t>(QuantizeChannel(color[0], 255));
+            pixel.g = static_cast<std::uint8_t>(QuantizeChannel(color[1], 255));
+            pixel.b = static_cast<std::uint8_t>(QuantizeChannel(color[2], 255));
+            pixel.a = static_cast<std::uint8_t>(QuantizeChannel(color[3], 255));
+            return pixel;
+        }
+
+        static inline m_math::Vector<double, 4> Unpack(const PixelRGBA8 &pixel)
+        {
+            return m_math::Vector<double, 4>({pixel.r / 255.0, pixel.g / 255.0, pixel.b / 255.0, pixel.a / 255.0});
+        }
+    };
+
+    template <>
+    struct PixelTraits<PixelRGB565>
+    {
+        template <class real_t>
+        static inline PixelRGB565 Pack(const m_math::Vector<real_t, 4> &color)
+        {
+            PixelRGB565 pixel;
+            pixel.value = static_cast<std::uint16_t>((QuantizeChannel(color[0], 31) << 11) |
+                                                     (QuantizeChannel(color[1], 63) << 5) | QuantizeChannel(color[2], 31));
+            return pixel;
+        }
+
+        static inline m_math::Vector<double, 4> Unpack(const PixelRGB565 &pixel)
+        {
+            return m_math::Vector<double, 4>({(pixel.value >> 11) / 31.0, ((pixel.value >> 5) & 63) / 63.0, (pixel.value & 31) / 31.0, 1.0});
+        }
+    };
+
+    /**
+     * @brief Blends a color over a pixel by the alpha of the color (src * a + dst * (1 - a)), alpha of the result is
+     * src_a + dst_a * (1 - src_a)
+     * @param pixel The pixel to blend into
+     * @param color The color, rgba in [0, 1]
+     */
+    template <class Pixel, class real_t>
+    inline void BlendPixel(Pixel &pixel, const m_math::Vector<real_t, 4> &color)
+    {
+        m_math::Vector<double, 4> dst = PixelTraits<Pixel>::Unpack(pixel);
+        double alpha = color[3];
+        m_math::Vector<double, 4> out({color[0] * alpha + dst[0] * (1.0 - alpha),
+                                       color[1] * alpha + dst[1] * (1.0 - alpha),
+                                       color[2] * alpha + dst[2] * (1.0 - alpha),
+                                       alpha + dst[3] * (1.0 - alpha)});
+        pixel = PixelTraits<Pixel>::Pack(out);
+    }
+
+    /**
+     * @brief Converts depth (larger is nearer) from and to a depth format of ZBuffer
+     * @attention Encode() never increases the depth, so a quantized depth test only passes ties of one quantum
+     * @tparam Depth The depth format, double, float, Depth16 or Depth24
+     */
+    template <class Depth>
+    struct DepthTraits
+    {
+        static inline Depth Encode(double depth)
+        {
+            return static_cast<Depth>(depth);
+        }
+
+        static inline double Decode(Depth depth)
+        {
+            return static_cast<double>(depth);
+        }
+    };
+
+    /**
+     * @brief Maps a float to a uint32 with the same order (negative floats are inverted, positive ones get the sign bit)
+     */
+    inline std::uint32_t OrderedFloatBits(double depth)
+    {
+        float value = static_cast<float>(std::min(std::max(depth, -static_cast<double>(FLT_MAX)), static_cast<double>(FLT_MAX)));
+        std::uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+
+    /**
+     * @brief Inverse of OrderedFloatBits()
+     */
+    inline double FromOrderedFloatBits(std::uint32_t bits)
+    {
+        bits = (bits & 0x80000000u) ? (bits & 0x7fffffffu) : ~bits;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    template <>
+    struct DepthTraits<Depth16>
+    {
+        static inline Depth16 Encode(double depth)
+        {
+            Depth16 encoded;
+            encoded.value = static_cast<std::uint16_t>(OrderedFloatBits(depth) >> 16);
+            return encoded;
+        }
+
+        static inline double Decode(Depth16 depth)
+        {
+            return FromOrderedFloatBits(static_cast<std::uint32_t>(depth.value) << 16);
+        }
+    };
+
+    template <>
+    struct DepthTraits<Depth24>
+    {
+        static inline Depth24 Encode(double depth)
+        {
+            Depth24 encoded;
+            encoded.value = OrderedFloatBits(depth) >> 8;
+            return encoded;
+        }
+
+        static inline double Decode(Depth24 depth)
+        {
+            return FromOrderedFloatBits(depth.value << 8);
+        }
+    };
+
+    /**
+     * @brief Saves a single RGBA8 pixel to a PPM file, alpha is dropped
+     */
+    inline std::ostream& Save2ppm(const PixelRGBA8 &pixel, std::ostream& target)
+    {
+        target << int(pixel.r) << ' ' << int(pixel.g) << ' ' << int(pixel.b) << '\n';
+        return target;
+    }
+
+    /**
+     * @brief Saves a single RGB565 pixel to a PPM file
+     */
+    inline std::ostream& Save2ppm(const PixelRGB565 &pixel, std::ostream& target)
+    {
+        return Save2ppm(PixelTraits<PixelRGB565>::Unpack(pixel), target);
+    }
+
+    using Image_RGBA8 = Image<PixelRGBA8>;
+    using Image_RGB565 = Image<PixelRGB565>;
+}
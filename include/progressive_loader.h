@@ -0,0 +1,276 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base_data_struct.h"
+#include "asset_proc/tiny_obj_bridge.h"
+#include "asset_proc/gltf_bridge.h"
+#include "scene.h"
+#include "shader.h"
+
+namespace mistery_render
+{
+
+    /**
+     * @brief Loads a model (OBJ, or GLB by the .glb extension) on a background thread and publishes its shapes into
+     * a Scene one by one, then loads the textures of its materials, so rendering starts before everything is loaded
+     * @attention Published meshes reference vertex buffers and materials owned by the loader, it must outlive the
+     * scene using them; render with Shader::wait_textures == false, so materials whose textures are not resident
+     * yet render with their flat color instead of loading them on the render thread
+     */
+    template <class real_t, size_t tex_n>
+    class ProgressiveLoader
+    {
+    private:
+        std::string path;
+        std::shared_ptr<std::vector<Material<real_t>>> material_list;
+        std::shared_ptr<TexturePool<real_t, tex_n>> texture_pool;
+        std::vector<std::unique_ptr<std::vector<Vertex<real_t>>>> shapes;   // vertex buffers of loaded shapes
+        size_t published_num = 0;
+        size_t version = 0;                 // bumped when a shape or a texture is loaded, or loading ended
+        bool done = false;
+        std::string error;
+        std::atomic<bool> stopping;
+        mutable std::mutex mutex;
+        std::condition_variable updated;
+        std::thread worker;
+
+        inline void Update(std::function<void()> change)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                change();
+                version++;
+            }
+            updated.notify_all();
+        }
+
+        inline void AddShape(const MeshBuffer &mesh)
+        {
+            std::unique_ptr<std::vector<Vertex<real_t>>> vertices(new std::vector<Vertex<real_t>>());
+            ModelObj<real_t>(mesh, material_list).PushVertexBuffer(*vertices);
+            Update([&]()
+            {
+                shapes.push_back(std::move(vertices));
+            });
+        }
+
+        /**
+         * @brief Loads the materials and publishes the shapes, returns the error message
+         */
+        std::string LoadShapes()
+        {
+            bool glb = path.size() >= 4 && path.compare(path.size() - 4, 4, ".glb") == 0;
+            if (glb)
+            {
+                GlbFile file;
+                if (!ReadGlb(path, file))
+                {
+                    return "Failed to load: " + path + ": " + file.error;
+                }
+                BuildObjMaterials(GltfMaterials(file), path, material_list, texture_pool, false);
+                for (const MeshBuffer &mesh : GltfMeshBuffers(file))
+                {
+                    if (stopping)
+                    {
+                        break;
+                    }
+                    AddShape(mesh);
+                }
+                return "";
+            }
+            ObjMeshData data;
+            if (!ParseObjFast(path, data))
+            {
+                return "Failed to load: " + path + ": " + data.error;
+            }
+            BuildObjMaterials(data.materials, path, material_list, texture_pool, false);
+            for (size_t i = 0; i < data.shapes.size() && !stopping; i++)
+            {
+                MeshBuffer mesh;
+                if (!ObjShapeToMeshBuffer(data.attrib, data.shapes[i], mesh))
+                {
+                    return "Failed to load: " + path + ": face index out of range";
+                }
+                AddShape(mesh);
+            }
+            return "";
+        }
+
+        void LoadLoop()
+        {
+            // an exception must not escape the worker thread, it would terminate the process
+            std::string load_error;
+            try
+            {
+                load_error = LoadShapes();
+            }
+            catch (const std::exception &e)
+            {
+                load_error = "Failed to load: " + path + ": " + e.what();
+            }
+
+            // textures are loaded after all shapes, so the first frames are not held back by texture decoding
+            std::vector<TextureHandle> handles;
+            for (const Material<real_t> &mat : *material_list)
+            {
+                handles.push_back(mat.diffuse_tex.GetHandle());
+                handles.push_back(mat.specular_tex.GetHandle());
+            }
+            ParallelFor(0, handles.size(), [&](size_t i)
+            {
+                if (!stopping && handles[i].Valid() && !texture_pool->Resident(handles[i]))
+                {
+                    try
+                    {
+                        texture_pool->Acquire(handles[i]);
+                    }
+                    catch (const std::exception &)
+                    {
+                        // the texture is marked as failed, its material keeps the flat color
+                    }
+                    Update([]() {});
+                }
+            });
+            Update([&]()
+            {
+                error = load_error;
+                done = true;
+            });
+        }
+
+    public:
+        /**
+         * @brief Constructor, starts loading
+         * @param path_init Path of the OBJ or GLB file
+         * @param pool The texture pool of the materials
+         */
+        ProgressiveLoader(const std::string &path_init, std::shared_ptr<TexturePool<real_t, tex_n>> pool)
+            : path(path_init), material_list(new std::vector<Material<real_t>>()), texture_pool(pool), stopping(false)
+        {
+            worker = std::thread(&ProgressiveLoader::LoadLoop, this);
+        }
+
+        ProgressiveLoader(const ProgressiveLoader &) = delete;
+        ProgressiveLoader & operator=(const ProgressiveLoader &) = delete;
+
+        /**
+         * @brief Destructor, stops loading after the current shape or texture
+         */
+        ~ProgressiveLoader()
+        {
+            stopping = true;
+            worker.join();
+        }
+
+        /**
+         * @brief Adds the shapes loaded since the last call to the scene, call it on the thread using the scene
+         * @param scene The scene, it owns the new Mesh objects
+         * @param transform Transform of the new meshes
+         * @return Number of meshes added
+         */
+        size_t Publish(Scene &scene, const Transform &transform = Transform())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t added = shapes.size() - published_num;
+            for (; published_num < shapes.size(); published_num++)
+            {
+                scene.meshes.emplace_back(new Mesh(*shapes[published_num]));
+                scene.meshes.back()->transform_origin = transform;
+            }
+            return added;
+        }
+
+        /**
+         * @brief Waits until something is loaded after seen_version, or loading is done
+         * @param seen_version Version returned by the last call, 0 at first
+         * @return The current version
+         */
+        size_t WaitForUpdate(size_t seen_version)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            updated.wait(lock, [&]() { return done || version > seen_version; });
+            return version;
+        }
+
+        /**
+         * @brief Whether all shapes and textures are loaded (or loading failed)
+         */
+        bool Done() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return done;
+        }
+
+        /**
+         * @brief Waits until loading is done
+         * @return Empty if succeeded, else the error message
+         */
+        std::string Wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            updated.wait(lock, [&]() { return done; });
+            return error;
+        }
+
+        /**
+         * @brief Number of shapes loaded so far
+         */
+        size_t ShapeNum() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return shapes.size();
+        }
+
+        /**
+         * @brief Materials of the model, complete once the first shape is loaded
+         */
+        std::shared_ptr<const std::vector<Material<real_t>>> GetMaterials() const
+        {
+            return material_list;
+        }
+    };
+
+    /**
+     * @brief Renders a scene while a ProgressiveLoader fills it: renders once as soon as something is loaded, then
+     * again whenever more shapes or textures arrive (updates during a frame are coalesced), until loading is done
+     * @attention The shader of camera_render should have wait_textures == false, see ProgressiveLoader
+     * @param loader The loader
+     * @param scene The scene the loader publishes to
+     * @param camera_render Renders the scene into its image
+     * @param on_frame Called after each frame on this thread, e.g. to write the image; last is true for the final frame
+     * @param transform Transform of the published meshes
+     * @param clear_color Background of the frames
+     * @return Number of frames rendered
+     */
+    template <class real_t, size_t tex_n, class color_t, class depth_t>
+    size_t RenderProgressive(ProgressiveLoader<real_t, tex_n> &loader, Scene &scene, CameraRender<color_t, depth_t> &camera_render,
+                             std::function<void(size_t frame_index, bool last)> on_frame,
+                             const Transform &transform = Transform(), const color_t &clear_color = color_t())
+    {
+        size_t version = 0;
+        size_t frame_num = 0;
+        bool last = false;
+        while (!last)
+        {
+            version = loader.WaitForUpdate(version);
+            last = loader.Done();
+            loader.Publish(scene, transform);
+            camera_render.ClearVertexBuffer();
+            camera_render.UpdateFromScene(scene);
+            camera_render.Clear(clear_color);
+            camera_render.Render();
+            on_frame(frame_num++, last);
+        }
+        return frame_num;
+    }
+
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "image.h"
+#include "pixel_format.h"
 #include "texture.h"
 #include "scene.h"
+#include "frame_output.h"
 #include <random>
 
 namespace mistery_render
@@ -13,14 +15,176 @@ namespace mistery_render
     /**
      * @brief Creates a Z-buffer of the given image
      * @param Color The type of color data used in the image
+     * @param depth_t The depth format, see DepthTraits
      * @param img The reference image from which to obtain the width and height for the Z-buffer
      * @param depth The initialized depth of zbuffer,default depth is std::numeric_limits<double>::max()
      * @return Z-buffer
      */
-    template <class Color>
-    inline ZBuffer MakeZBuffer(const Image<Color>& img, double depth = -std::numeric_limits<double>::max())
+    template <class Color, class depth_t = double>
+    inline Image<depth_t> MakeZBuffer(const Image<Color>& img, double depth = -std::numeric_limits<double>::max())
+    {
+        return Image<depth_t>(img.GetWidth(), img.GetHeight(), DepthTraits<depth_t>::Encode(depth));
+    }
+
+    /**
+     * @brief Images smaller than it are cleared on the calling thread only
+     */
+    const size_t kParallelClearPixels = 64 * 1024;
+
+    /**
+     * @brief Sets all pixels of an image without reallocating, bands of 16 rows are filled on several threads
+     * @param img The image
+     * @param value The value of pixels
+     * @param thread_num Number of threads
+     */
+    template <class T>
+    inline void ClearImage(Image<T> &img, const T &value, size_t thread_num = DefaultThreadNum())
+    {
+        const size_t band_rows = 16;
+        if (img.GetWidth() * img.GetHeight() < kParallelClearPixels)
+        {
+            img.Fill(value);
+            return;
+        }
+        ParallelFor(0, (img.GetHeight() + band_rows - 1) / band_rows, [&](size_t band)
+        {
+            img.SubView(0, band * band_rows, img.GetWidth(), band_rows).Fill(value);
+        }, thread_num);
+    }
+
+    /**
+     * @brief Z-buffer cleared in O(1) by a generation counter: a depth is valid only if it was stored in the 
+     * current generation, others read as the clear depth
+     * @attention Costs 4 more bytes per pixel and a generation check per depth test, pays off when clears are frequent 
+     * and triangles cover a small part of the screen
+     * @tparam depth_t The depth format, see DepthTraits
+     */
+    template <class depth_t = double>
+    class GenerationZBuffer
+    {
+    private:
+        Image<depth_t> depth;
+        Image<std::uint32_t> generation;
+        std::uint32_t current = 1;
+        double clear_depth = 0;
+    public:
+        GenerationZBuffer(size_t width, size_t height, double clear_depth_init = -std::numeric_limits<double>::max()) 
+            : depth(width, height), generation(width, height, 0), clear_depth(clear_depth_init)
+        {
+        }
+
+        inline size_t GetWidth() const
+        {
+            return depth.GetWidth();
+        }
+
+        inline size_t GetHeight() const
+        {
+            return depth.GetHeight();
+        }
+
+        /**
+         * @attention Not check index < (width or height)
+         */
+        inline double Load(size_t width_idx, size_t height_idx) const
+        {
+            if (generation.At(width_idx, height_idx) != current)
+            {
+                return clear_depth;
+            }
+            return DepthTraits<depth_t>::Decode(depth.At(width_idx, height_idx));
+        }
+
+        inline void Store(size_t width_idx, size_t height_idx, double z)
+        {
+            depth.At(width_idx, height_idx) = DepthTraits<depth_t>::Encode(z);
+            generation.At(width_idx, height_idx) = current;
+        }
+
+        /**
+         * @brief Clears all depths to clear_depth_init without touching the buffers, except once per 2^32 - 1 clears
+         */
+        void Clear(double clear_depth_init = -std::numeric_limits<double>::max())
+        {
+            clear_depth = clear_depth_init;
+            if (++current == 0)
+            {
+                ClearImage(generation, std::uint32_t(0));
+                current = 1;
+            }
+        }
+    };
+
+    /**
+     * @brief Tag of depth_t of Shader, selects a GenerationZBuffer<depth_t> instead of an Image<depth_t>
+     */
+    template <class depth_t>
+    struct GenerationDepth
+    {
+    };
+
+    /**
+     * @brief Type of the z-buffer of Shader by its depth_t
+     */
+    template <class depth_t>
+    struct ZBufferType
+    {
+        using type = Image<depth_t>;
+    };
+
+    template <class depth_t>
+    struct ZBufferType<GenerationDepth<depth_t>>
+    {
+        using type = GenerationZBuffer<depth_t>;
+    };
+
+    template <class depth_t>
+    inline double LoadDepth(const Image<depth_t> &zbuffer, size_t width_idx, size_t height_idx)
+    {
+        return DepthTraits<depth_t>::Decode(zbuffer.At(width_idx, height_idx));
+    }
+
+    template <class depth_t>
+    inline void StoreDepth(Image<depth_t> &zbuffer, size_t width_idx, size_t height_idx, double z)
+    {
+        zbuffer.At(width_idx, height_idx) = DepthTraits<depth_t>::Encode(z);
+    }
+
+    template <class depth_t>
+    inline double LoadDepth(const GenerationZBuffer<depth_t> &zbuffer, size_t width_idx, size_t height_idx)
+    {
+        return zbuffer.Load(width_idx, height_idx);
+    }
+
+    template <class depth_t>
+    inline void StoreDepth(GenerationZBuffer<depth_t> &zbuffer, size_t width_idx, size_t height_idx, double z)
+    {
+        zbuffer.Store(width_idx, height_idx, z);
+    }
+
+    /**
+     * @brief Clears a z-buffer to depth, reallocates it only if its size is not (width, height)
+     */
+    template <class depth_t>
+    inline void ResetZBuffer(Image<depth_t> &zbuffer, size_t width, size_t height, double depth)
+    {
+        if (zbuffer.GetWidth() != width || zbuffer.GetHeight() != height)
+        {
+            zbuffer = Image<depth_t>(width, height, DepthTraits<depth_t>::Encode(depth));
+            return;
+        }
+        ClearImage(zbuffer, DepthTraits<depth_t>::Encode(depth));
+    }
+
+    template <class depth_t>
+    inline void ResetZBuffer(GenerationZBuffer<depth_t> &zbuffer, size_t width, size_t height, double depth)
     {
-        return ZBuffer(img.GetWidth(), img.GetHeight(), depth);
+        if (zbuffer.GetWidth() != width || zbuffer.GetHeight() != height)
+        {
+            zbuffer = GenerationZBuffer<depth_t>(width, height, depth);
+            return;
+        }
+        zbuffer.Clear(depth);
     }
 
     /**
@@ -57,12 +221,13 @@ namespace mistery_render
      * @tparam PointsContainer The container of 3 points, size of container must >=3, and size of vector must >=3
      * @tparam real_t The type of real number in vector
      * @tparam Color The type of color in image
+     * @tparam ZBufferT Type of zbuffer, Image<depth_t> (see DepthTraits) or GenerationZBuffer<depth_t>
      * @param points The points (x,y,z) of the triangle
      * @param img A reference to the image on which the line will be drawn
      * @param color The color that will be used to draw the line
      */
-    template <class PointsContainer, class Color, class real_t = double>
-    inline void TriangleDraw(const PointsContainer& points, ZBuffer &zbuffer, Image<Color> &img, Color color)
+    template <class PointsContainer, class Color, class real_t = double, class ZBufferT = ZBuffer>
+    inline void TriangleDraw(const PointsContainer& points, ZBufferT &zbuffer, Image<Color> &img, Color color)
     {
         m_math::Vector<real_t, 2> img_size({(real_t)img.GetWidth() - 1, (real_t)img.GetHeight() - 1});
         m_math::Vector<real_t, 2> bbox_min({ std::numeric_limits<real_t>::max(),  std::numeric_limits<real_t>::max()});
@@ -85,10 +250,10 @@ namespace mistery_render
                 if (bc[0] >= 0 && bc[1] >= 0 && bc[2] >= 0) 
                 {
                     real_t z = points[0][2] * bc[0] + points[1][2] * bc[1] + points[2][2] * bc[2];
-                    if (zbuffer.GetColor(static_cast<int>(x), static_cast<int>(y)) < (z + m_math::kDoubleAsZero)) 
+                    if (LoadDepth(zbuffer, static_cast<size_t>(x), static_cast<size_t>(y)) < (z + m_math::kDoubleAsZero)) 
                     {
-                        zbuffer.SetColor(static_cast<int>(x), static_cast<int>(y), z);
-                        img.SetColor(static_cast<int>(x), static_cast<int>(y), color);
+                        StoreDepth(zbuffer, static_cast<size_t>(x), static_cast<size_t>(y), z);
+                        img.At(static_cast<size_t>(x), static_cast<size_t>(y)) = color;
                     }
                 }
             }
@@ -96,9 +261,152 @@ namespace mistery_render
     }
 
 
-    template <class Color, typename FShader, class real_t = double>
+    /**
+     * @brief Calculates the screen space derivatives of texture coordinates on a triangle
+     * @tparam real_t The type of real number in vertex
+     * @param vertex0 The first vertex of the triangle (position in screen space)
+     * @param vertex1 The second vertex of the triangle (position in screen space)
+     * @param vertex2 The third vertex of the triangle (position in screen space)
+     * @param sample_size Size of a shading sample in pixels, e.g. 1/cut_n for supersampling
+     * @return {du/dx, dv/dx, du/dy, dv/dy}, zeros if the triangle is degenerate
+     * @attention Attributes are interpolated linearly in screen space, so the derivatives are constant on the triangle
+     */
+    template <class real_t>
+    inline std::array<double, 4> TriangleUVDerivative(const Vertex<real_t>& vertex0, const Vertex<real_t>& vertex1, 
+                                                    const Vertex<real_t>& vertex2, double sample_size = 1.0)
+    {
+        double e1_x = vertex1.position[0] - vertex0.position[0];
+        double e1_y = vertex1.position[1] - vertex0.position[1];
+        double e2_x = vertex2.position[0] - vertex0.position[0];
+        double e2_y = vertex2.position[1] - vertex0.position[1];
+        double det = e1_x * e2_y - e2_x * e1_y;
+        if (std::abs(det) < m_math::kDoubleAsZero)
+        {
+            return {0, 0, 0, 0};
+        }
+        double du1 = vertex1.texcoord[0] - vertex0.texcoord[0];
+        double du2 = vertex2.texcoord[0] - vertex0.texcoord[0];
+        double dv1 = vertex1.texcoord[1] - vertex0.texcoord[1];
+        double dv2 = vertex2.texcoord[1] - vertex0.texcoord[1];
+        double scale = sample_size / det;
+        return {(du1 * e2_y - du2 * e1_y) * scale, (dv1 * e2_y - dv2 * e1_y) * scale, 
+                (du2 * e1_x - du1 * e2_x) * scale, (dv2 * e1_x - dv1 * e2_x) * scale};
+    }
+
+    /**
+     * @brief Anti-aliasing mode of TriangleDrawFrame, only works when cut_n > 1
+     */
+    enum class AntiAliasMode
+    {
+        kSSAA,          // every pixel takes cut_n * cut_n samples
+        kEdgeAdaptive,  // only pixels crossed by an edge or a depth discontinuity take cut_n * cut_n samples
+    };
+
+    /**
+     * @brief Max shading rate, coarse shading blocks are aligned to kMaxShadingRate pixels on screen
+     */
+    const int kMaxShadingRate = 4;
+
+    /**
+     * @brief Screen space tiles of shading rate, rate n means shading once per n * n pixels
+     */
+    struct ShadingRateMap
+    {
+        size_t tile_size = 16;  // must be a multiple of kMaxShadingRate
+        size_t tiles_x = 0;
+        size_t tiles_y = 0;
+        std::vector<int> rates = {};
+
+        inline bool Empty() const
+        {
+            return rates.empty();
+        }
+
+        /**
+         * @brief Get the shading rate of a pixel
+         * @param x_idx Index of width
+         * @param y_idx Index of height
+         * @return Shading rate of the tile containing the pixel, kMaxShadingRate if out of the map
+         */
+        inline int GetRate(size_t x_idx, size_t y_idx) const
+        {
+            size_t tile_x = x_idx / tile_size;
+            size_t tile_y = y_idx / tile_size;
+            if (tile_x >= tiles_x || tile_y >= tiles_y)
+            {
+                return kMaxShadingRate;
+            }
+            return rates[tile_y * tiles_x + tile_x];
+        }
+    };
+
+    /**
+     * @brief Creates a shading rate map by the luminance contrast of each tile of a rendered image (usually the previous frame)
+     * @param Color The type of color data used in the image
+     * @param img The rendered image
+     * @param tile_size Size of tiles, must be a multiple of kMaxShadingRate
+     * @param contrast_fine Tiles whose luminance range is larger than it are shaded per pixel
+     * @param contrast_coarse Tiles whose luminance range is smaller than it are shaded once per kMaxShadingRate^2 pixels, others per 2 * 2 pixels
+     * @return shading rate map
+     */
+    template <class Color>
+    inline ShadingRateMap MakeShadingRateMap(Image<Color>& img, size_t tile_size = 16, double contrast_fine = 0.1, double contrast_coarse = 0.02)
+    {
+        ShadingRateMap rate_map;
+        rate_map.tile_size = std::max<size_t>(kMaxShadingRate, tile_size / kMaxShadingRate * kMaxShadingRate);
+        rate_map.tiles_x = (img.GetWidth() + rate_map.tile_size - 1) / rate_map.tile_size;
+        rate_map.tiles_y = (img.GetHeight() + rate_map.tile_size - 1) / rate_map.tile_size;
+        rate_map.rates.resize(rate_map.tiles_x * rate_map.tiles_y);
+
+        for (size_t tile_y = 0; tile_y < rate_map.tiles_y; tile_y++)
+        {
+            for (size_t tile_x = 0; tile_x < rate_map.tiles_x; tile_x++)
+            {
+                double lum_min = std::numeric_limits<double>::max();
+                double lum_max = -std::numeric_limits<double>::max();
+                size_t x_end = std::min(img.GetWidth(), (tile_x + 1) * rate_map.tile_size);
+                size_t y_end = std::min(img.GetHeight(), (tile_y + 1) * rate_map.tile_size);
+                for (size_t y = tile_y * rate_map.tile_size; y < y_end; y++)
+                {
+                    const Color * row = img.Row(y);
+                    for (size_t x = tile_x * rate_map.tile_size; x < x_end; x++)
+                    {
+                        m_math::Vector<double, 4> color = PixelTraits<Color>::Unpack(row[x]);
+                        double lum = 0.299 * color[0] + 0.587 * color[1] + 0.114 * color[2];
+                        lum_min = std::min(lum_min, lum);
+                        lum_max = std::max(lum_max, lum);
+                    }
+                }
+                double contrast = lum_max - lum_min;
+                int rate = (contrast > contrast_fine) ? 1 : ((contrast > contrast_coarse) ? 2 : kMaxShadingRate);
+                rate_map.rates[tile_y * rate_map.tiles_x + tile_x] = rate;
+            }
+        }
+        return rate_map;
+    }
+
+    /**
+     * @brief Draw a triangle on zbuffer_image, the color of each sample is given by light_functor
+     * @tparam Color The type of color in image
+     * @tparam FShader The functor type, must provide GetColor(vertex0, vertex1, vertex2, barycentric)
+     * @tparam real_t The type of real number in vector
+     * @tparam ZBufferT Type of zbuffer, Image<depth_t> (see DepthTraits) or GenerationZBuffer<depth_t>
+     * @param vertex0 The first vertex of the triangle (position in screen space)
+     * @param vertex1 The second vertex of the triangle (position in screen space)
+     * @param vertex2 The third vertex of the triangle (position in screen space)
+     * @param zbuffer The z-buffer of img
+     * @param img A reference to the image on which the triangle will be drawn
+     * @param light_functor The functor which gives the color of samples
+     * @param cut_n Each pixel is cut into cut_n * cut_n samples
+     * @param aa_mode Anti-aliasing mode, kEdgeAdaptive shades fully covered pixels only once
+     * @param shading_rate Shade once per shading_rate * shading_rate pixels (1, 2 or kMaxShadingRate), 
+     *        coverage and depth are still resolved per pixel
+     * @param rate_map Optional screen space rate map, the finer one of shading_rate and the map is used
+     */
+    template <class Color, typename FShader, class real_t = double, class ZBufferT = ZBuffer>
     inline void TriangleDrawFrame(const Vertex<real_t>& vertex0, const Vertex<real_t>& vertex1, const Vertex<real_t>& vertex2, 
-                    ZBuffer &zbuffer, Image<Color> &img, const FShader &light_functor, int cut_n = 1)
+                    ZBufferT &zbuffer, Image<Color> &img, const FShader &light_functor, int cut_n = 1, 
+                    AntiAliasMode aa_mode = AntiAliasMode::kSSAA, int shading_rate = 1, const ShadingRateMap * rate_map = nullptr)
     {
         auto v0 = vertex0.position;
         auto v1 = vertex1.position;
@@ -117,46 +425,150 @@ namespace mistery_render
                 bbox_max[j] = std::min(img_size[j], std::max(bbox_max[j], points[i][j]));
             }
         }
+        if (bbox_min[0] > bbox_max[0] || bbox_min[1] > bbox_max[1])
+        {
+            return;
+        }
+
+        // pixel (x_idx, y_idx) takes samples from (bbox_min + idx - idx_begin) to (bbox_min + idx - idx_begin + corner_step)
+        int x_begin = static_cast<int>(bbox_min[0]);
+        int y_begin = static_cast<int>(bbox_min[1]);
+        int x_end = x_begin + static_cast<int>(bbox_max[0] - bbox_min[0]);
+        int y_end = y_begin + static_cast<int>(bbox_max[1] - bbox_min[1]);
 
         double cut_step = 1.0/cut_n;
-        for (real_t x_pixel = bbox_min[0]; x_pixel <= bbox_max[0]; ++ x_pixel) 
+        double corner_step = (cut_n - 1) * cut_step;
+        bool adaptive = (aa_mode == AntiAliasMode::kEdgeAdaptive) && (cut_n > 1);
+
+        // draw a pixel, shade_func gives the color of a covered sample by its barycentric
+        auto draw_pixel = [&](int x_idx, int y_idx, auto &&shade_func)
         {
-            for (real_t y_pixel = bbox_min[1]; y_pixel <= bbox_max[1]; ++ y_pixel) 
+            real_t x_pixel = bbox_min[0] + (x_idx - x_begin);
+            real_t y_pixel = bbox_min[1] + (y_idx - y_begin);
+            real_t depth = LoadDepth(zbuffer, x_idx, y_idx);
+
+            if (adaptive)
             {
-                real_t depth = zbuffer.GetColor(static_cast<int>(x_pixel), static_cast<int>(y_pixel));
-                int sample_num = 0;
-                m_math::Vector<real_t, 4> color_sample_sum = m_math::Vector<real_t, 4>();
-                real_t depth_sample_max = depth;
+                // barycentric and z are linear in screen space and the triangle is convex,
+                // so if the 4 corner samples are covered and pass the depth test, all inner samples do too
+                m_math::Vector<real_t, 3> bc_sum = m_math::Vector<real_t, 3>();
+                real_t depth_corner_max = depth;
+                bool interior = true;
+                for (int i_c = 0; i_c < 4 && interior; i_c++)
+                {
+                    real_t x = x_pixel + (i_c & 1) * corner_step;
+                    real_t y = y_pixel + (i_c >> 1) * corner_step;
+                    m_math::Vector<real_t, 3> bc = Barycentric(points, m_math::Vector<real_t, 3>({x, y, 0}));
+                    real_t z = points[0][2] * bc[0] + points[1][2] * bc[1] + points[2][2] * bc[2];
+                    interior = bc[0] >= 0 && bc[1] >= 0 && bc[2] >= 0 && depth < z;
+                    bc_sum += bc;
+                    depth_corner_max = std::max(z, depth_corner_max);
+                }
+
+                if (interior)
+                {
+                    // the barycentric of the sample grid center is the mean of its corners
+                    m_math::Vector<real_t, 4> color_uv = shade_func(m_math::Vector<real_t, 3>(bc_sum / 4.0));
+                    StoreDepth(zbuffer, x_idx, y_idx, depth_corner_max);
+                    img.At(x_idx, y_idx) = PixelTraits<Color>::Pack(color_uv);
+                    return;
+                }
+            }
+
+            int sample_num = 0;
+            m_math::Vector<real_t, 4> color_sample_sum = m_math::Vector<real_t, 4>();
+            real_t depth_sample_max = depth;
 
-                for (int i_x = 0; i_x < cut_n; i_x++)
+            for (int i_x = 0; i_x < cut_n; i_x++)
+            {
+                real_t x = x_pixel + i_x * cut_step;
+                
+                for (int i_y = 0; i_y < cut_n; i_y++)
                 {
-                    real_t x = x_pixel + i_x * cut_step;
-                    
-                    for (int i_y = 0; i_y < cut_n; i_y++)
+                    real_t y = y_pixel + i_y * cut_step;
                     {
-                        real_t y = y_pixel + i_y * cut_step;
+                        m_math::Vector<real_t, 3> bc = Barycentric(points, m_math::Vector<real_t, 3>({x, y, 0}));
+                        if (bc[0] >= 0 && bc[1] >= 0 && bc[2] >= 0) 
                         {
-                            m_math::Vector<real_t, 3> bc = Barycentric(points, m_math::Vector<real_t, 3>({x, y, 0}));
-                            if (bc[0] >= 0 && bc[1] >= 0 && bc[2] >= 0) 
+                            real_t z = points[0][2] * bc[0] + points[1][2] * bc[1] + points[2][2] * bc[2];
+                            if (depth < z) 
                             {
-                                real_t z = points[0][2] * bc[0] + points[1][2] * bc[1] + points[2][2] * bc[2];
-                                if (depth < z) 
-                                {
-                                    m_math::Vector<real_t, 4> color_uv = light_functor.GetColor(vertex0, vertex1, vertex2, bc);
-
-                                    color_sample_sum += color_uv;
-                                    depth_sample_max = std::max(z, depth_sample_max);
-                                    sample_num++;
-                                }
+                                m_math::Vector<real_t, 4> color_uv = shade_func(bc);
+
+                                color_sample_sum += color_uv;
+                                depth_sample_max = std::max(z, depth_sample_max);
+                                sample_num++;
                             }
                         }
                     }
                 }
-                
-                if (sample_num>0)
+            }
+            
+            if (sample_num>0)
+            {
+                StoreDepth(zbuffer, x_idx, y_idx, depth_sample_max);
+                img.At(x_idx, y_idx) = PixelTraits<Color>::Pack(m_math::Vector<real_t, 4>(color_sample_sum / sample_num));
+            }
+        };
+
+        if (shading_rate <= 1)
+        {
+            auto shade_sample = [&](const m_math::Vector<real_t, 3> &bc)
+            {
+                return light_functor.GetColor(vertex0, vertex1, vertex2, bc);
+            };
+            // row by row, pixels of a row are contiguous in img and zbuffer
+            for (int y_idx = y_begin; y_idx <= y_end; y_idx++) 
+            {
+                for (int x_idx = x_begin; x_idx <= x_end; x_idx++) 
+                {
+                    draw_pixel(x_idx, y_idx, shade_sample);
+                }
+            }
+            return;
+        }
+
+        // coarse shading: walk screen aligned blocks of kMaxShadingRate pixels, 
+        // and shade once per (rate * rate) sub block, at its center if covered, else at its first covered sample
+        for (int block_x = x_begin / kMaxShadingRate * kMaxShadingRate; block_x <= x_end; block_x += kMaxShadingRate) 
+        {
+            for (int block_y = y_begin / kMaxShadingRate * kMaxShadingRate; block_y <= y_end; block_y += kMaxShadingRate) 
+            {
+                int rate = std::min(shading_rate, kMaxShadingRate);
+                if (rate_map != nullptr && !rate_map->Empty())
+                {
+                    rate = std::min(rate, rate_map->GetRate(block_x, block_y));
+                }
+                rate = std::max(rate, 1);
+
+                for (int sub_x = block_x; sub_x < block_x + kMaxShadingRate; sub_x += rate)
                 {
-                    zbuffer.SetColor(static_cast<int>(x_pixel), static_cast<int>(y_pixel), depth_sample_max);
-                    img.SetColor(static_cast<int>(x_pixel), static_cast<int>(y_pixel), Color(color_sample_sum / sample_num));
+                    for (int sub_y = block_y; sub_y < block_y + kMaxShadingRate; sub_y += rate)
+                    {
+                        bool shaded = false;
+                        m_math::Vector<real_t, 4> sub_color = m_math::Vector<real_t, 4>();
+                        auto shade_sub_block = [&](const m_math::Vector<real_t, 3> &bc)
+                        {
+                            if (!shaded)
+                            {
+                                real_t x_center = bbox_min[0] + (sub_x - x_begin) + 0.5 * (rate - 1 + corner_step);
+                                real_t y_center = bbox_min[1] + (sub_y - y_begin) + 0.5 * (rate - 1 + corner_step);
+                                m_math::Vector<real_t, 3> bc_center = Barycentric(points, m_math::Vector<real_t, 3>({x_center, y_center, 0}));
+                                bool center_in = bc_center[0] >= 0 && bc_center[1] >= 0 && bc_center[2] >= 0;
+                                sub_color = light_functor.GetColor(vertex0, vertex1, vertex2, center_in ? bc_center : bc);
+                                shaded = true;
+                            }
+                            return sub_color;
+                        };
+
+                        for (int x_idx = std::max(sub_x, x_begin); x_idx < std::min(sub_x + rate, x_end + 1); x_idx++)
+                        {
+                            for (int y_idx = std::max(sub_y, y_begin); y_idx < std::min(sub_y + rate, y_end + 1); y_idx++)
+                            {
+                                draw_pixel(x_idx, y_idx, shade_sub_block);
+                            }
+                        }
+                    }
                 }
             }
         }
@@ -165,16 +577,45 @@ namespace mistery_render
     template <class real_t>
     struct GetTextureColor
     {
+        std::array<double, 4> uv_derivative = {0, 0, 0, 0};     // see TriangleUVDerivative
+        MipFilter mip_filter = MipFilter::kLinear;
+        bool wait_textures = true;      // see Shader::wait_textures
+        const Material<real_t> * material = nullptr;
+        std::shared_ptr<const Texture2D> diffuse_tex = nullptr;
+
+        /**
+         * @brief Acquires the textures of a material from its pool, does nothing if the material is not changed
+         * @param material_init The material, nullptr == DefaultMaterial()
+         */
+        inline void SetMaterial(const Material<real_t> * material_init)
+        {
+            if (material_init == nullptr)
+            {
+                material_init = &DefaultMaterial<real_t>();
+            }
+            if (material_init != material)
+            {
+                material = material_init;
+                diffuse_tex = wait_textures ? material->diffuse_tex.Acquire() : material->diffuse_tex.TryAcquire();
+            }
+        }
+
         m_math::Vector<real_t, 4> GetColor(const Vertex<real_t> &vertex0, const Vertex<real_t> &vertex1, const Vertex<real_t> &vertex2,
                                             const m_math::Vector<real_t, 3> &bc) const
         {
             double u_tmp = vertex0.texcoord[0] * bc[0] + vertex1.texcoord[0] * bc[1] + vertex2.texcoord[0] * bc[2];
             double v_tmp = vertex0.texcoord[1] * bc[0] + vertex1.texcoord[1] * bc[1] + vertex2.texcoord[1] * bc[2];
-            if(vertex0.material->diffuse_tex == nullptr)
+            if(diffuse_tex == nullptr)
             {
+                if (!wait_textures && !material->diffuse_tex.Empty())
+                {
+                    // flat fallback until the texture is resident
+                    return m_math::Vector<real_t, 4>({material->diffuse[0], material->diffuse[1], material->diffuse[2], 1});
+                }
                 return m_math::Vector<real_t, 4>();
             }
-            return texture::Lerp2(vertex0.material->diffuse_tex, u_tmp, v_tmp);
+            texture::Sampler sampler(diffuse_tex.get(), mip_filter);
+            return sampler.Sample<real_t>(u_tmp, v_tmp, sampler.Lod(uv_derivative));
         }
     };
 
@@ -182,26 +623,52 @@ namespace mistery_render
     struct GetPhongColor
     {
         std::vector<Light *> lights;
+        std::array<double, 4> uv_derivative = {0, 0, 0, 0};     // see TriangleUVDerivative
+        MipFilter mip_filter = MipFilter::kLinear;
+        bool wait_textures = true;      // see Shader::wait_textures
+        const Material<real_t> * material = nullptr;
+        std::shared_ptr<const Texture2D> diffuse_tex = nullptr;
+        std::shared_ptr<const Texture2D> specular_tex = nullptr;
         m_math::Vector<real_t, 3> pos_v0;
         m_math::Vector<real_t, 3> pos_v1;
         m_math::Vector<real_t, 3> pos_v2;
 
+        /**
+         * @brief Acquires the textures of a material from its pool, does nothing if the material is not changed
+         * @param material_init The material, nullptr == DefaultMaterial()
+         */
+        inline void SetMaterial(const Material<real_t> * material_init)
+        {
+            if (material_init == nullptr)
+            {
+                material_init = &DefaultMaterial<real_t>();
+            }
+            if (material_init != material)
+            {
+                material = material_init;
+                diffuse_tex = wait_textures ? material->diffuse_tex.Acquire() : material->diffuse_tex.TryAcquire();
+                specular_tex = wait_textures ? material->specular_tex.Acquire() : material->specular_tex.TryAcquire();
+            }
+        }
+
         m_math::Vector<real_t, 4> GetColor(const Vertex<real_t> &vertex0, const Vertex<real_t> &vertex1, const Vertex<real_t> &vertex2,
                                             const m_math::Vector<real_t, 3> &bc) const
         {
             double u_tmp = vertex0.texcoord[0] * bc[0] + vertex1.texcoord[0] * bc[1] + vertex2.texcoord[0] * bc[2];
             double v_tmp = vertex0.texcoord[1] * bc[0] + vertex1.texcoord[1] * bc[1] + vertex2.texcoord[1] * bc[2];
 
-            m_math::Vector<real_t, 3> diffuse_color = m_math::Vector<real_t, 3>(vertex0.material->diffuse);
-            m_math::Vector<real_t, 3> specular_color = m_math::Vector<real_t, 3>(vertex0.material->specular);
-            if (vertex0.material->diffuse_tex != nullptr)
+            m_math::Vector<real_t, 3> diffuse_color = m_math::Vector<real_t, 3>(material->diffuse);
+            m_math::Vector<real_t, 3> specular_color = m_math::Vector<real_t, 3>(material->specular);
+            if (diffuse_tex != nullptr)
             {
-                m_math::Vector<real_t, 4> col_tmp = texture::Lerp2(vertex0.material->diffuse_tex, u_tmp, v_tmp);
+                texture::Sampler sampler(diffuse_tex.get(), mip_filter);
+                m_math::Vector<real_t, 4> col_tmp = sampler.Sample<real_t>(u_tmp, v_tmp, sampler.Lod(uv_derivative));
                 diffuse_color = m_math::Vector<real_t, 3>({col_tmp[0], col_tmp[1], col_tmp[2]});
             }
-            if (vertex0.material->specular_tex != nullptr)
+            if (specular_tex != nullptr)
             {
-                m_math::Vector<real_t, 4> col_tmp = texture::Lerp2(vertex0.material->specular_tex, u_tmp, v_tmp);
+                texture::Sampler sampler(specular_tex.get(), mip_filter);
+                m_math::Vector<real_t, 4> col_tmp = sampler.Sample<real_t>(u_tmp, v_tmp, sampler.Lod(uv_derivative));
                 specular_color = m_math::Vector<real_t, 3>({col_tmp[0], col_tmp[1], col_tmp[2]});
             }
 
@@ -224,7 +691,7 @@ namespace mistery_render
                 m_math::Vector<real_t, 3> half_way_dir = m_math::Vector<real_t, 3>(light_dir + view_dir).Normalize();
 
                 double diff = std::max(light_dir * normal, 0.0);
-                double spec = std::pow(std::max(normal * half_way_dir, 0.0), vertex0.material->shininess);
+                double spec = std::pow(std::max(normal * half_way_dir, 0.0), material->shininess);
 
                 m_math::Vector<real_t, 3> ambient =  diffuse_color.HadamardProduct(light_i->ambient);
                 m_math::Vector<real_t, 3> diffuse =  diff * diffuse_color.HadamardProduct(light_i->diffuse);
@@ -240,7 +707,7 @@ namespace mistery_render
 
 
 
-    template <class real_t, class color_t>
+    template <class real_t, class color_t, class depth_t = double>
     class Shader
     {
     protected:
@@ -249,15 +716,71 @@ namespace mistery_render
         std::vector<Vertex<real_t>> shader_vertex_buffer = {};
         std::vector<Light *> shader_light_buffer = {};
 
-        ZBuffer zbuffer = ZBuffer(1,1);
+        typename ZBufferType<depth_t>::type zbuffer = typename ZBufferType<depth_t>::type(1,1);
 
     public:
+        MipFilter mip_filter = MipFilter::kLinear;
+        int shading_rate = 1;                   // default shading rate of materials, see TriangleDrawFrame
+        ShadingRateMap shading_rate_map = {};   // optional screen space rate map, empty by default
+        bool wait_textures = true;              // false: textures not resident are not loaded while rendering, their
+                                                // materials render with the flat material color (progressive loading)
+
         virtual ~Shader() {};
 
+        /**
+         * @brief Sets the render target, the z-buffer is cleared and only reallocated if the size changes
+         */
         virtual void SetImgPtr(Image<color_t> * img_ptr)
         {
             img = img_ptr;
-            zbuffer = MakeZBuffer(* (this->img));
+            ResetZBuffer(zbuffer, img->GetWidth(), img->GetHeight(), -std::numeric_limits<double>::max());
+        }
+
+        inline Image<color_t> * GetImgPtr() const
+        {
+            return img;
+        }
+
+        /**
+         * @brief Clears the render target and the z-buffer for a new frame, reusing their memory
+         * @param color The clear color
+         * @param depth The clear depth, nothing is drawn behind it
+         */
+        void Clear(const color_t &color = color_t(), double depth = -std::numeric_limits<double>::max())
+        {
+            if (img != nullptr)
+            {
+                ClearImage(*img, color);
+                ResetZBuffer(zbuffer, img->GetWidth(), img->GetHeight(), depth);
+            }
+        }
+
+        /**
+         * @brief Updates shading_rate_map by the contrast of the image rendered last time, the next Render() will use it
+         * @param tile_size Size of tiles, must be a multiple of kMaxShadingRate
+         * @param contrast_fine Tiles whose luminance range is larger than it are shaded per pixel
+         * @param contrast_coarse Tiles whose luminance range is smaller than it are shaded coarsest
+         */
+        void UpdateShadingRateMap(size_t tile_size = 16, double contrast_fine = 0.1, double contrast_coarse = 0.02)
+        {
+            if (img != nullptr)
+            {
+                shading_rate_map = MakeShadingRateMap(*img, tile_size, contrast_fine, contrast_coarse);
+            }
+        }
+
+        /**
+         * @brief Gets the shading rate of a material, material->shading_rate overrides shading_rate if it is set
+         * @param material The material of the triangle
+         * @return shading rate
+         */
+        inline int GetShadingRate(const Material<real_t> * material) const
+        {
+            if (material != nullptr && material->shading_rate > 0)
+            {
+                return material->shading_rate;
+            }
+            return shading_rate;
         }
 
         void UpdateCameraTransform(const Transform & trans)
@@ -327,8 +850,8 @@ namespace mistery_render
 
     };
 
-    template <class real_t, class color_t>
-    class PrintShader : public Shader<real_t, color_t>
+    template <class real_t, class color_t, class depth_t = double>
+    class PrintShader : public Shader<real_t, color_t, depth_t>
     {
     public:
         PrintShader(){}
@@ -355,8 +878,8 @@ namespace mistery_render
         }
     };
 
-    template <class real_t, class color_t>
-    class FlatShader : public Shader<real_t, color_t>
+    template <class real_t, class color_t, class depth_t = double>
+    class FlatShader : public Shader<real_t, color_t, depth_t>
     {
 
     public:
@@ -396,13 +919,13 @@ namespace mistery_render
         }
     };
 
-    template <class real_t, class color_t>
-    class RandomFlatShader : public FlatShader<real_t, color_t>
+    template <class real_t, class color_t, class depth_t = double>
+    class RandomFlatShader : public FlatShader<real_t, color_t, depth_t>
     {
     public:
         std::mt19937 rand_gen;
         std::uniform_real_distribution<double> color_range;
-        RandomFlatShader(color_t color_init) : FlatShader<real_t, color_t>(color_init), rand_gen(std::random_device{}()), color_range(0.0, 1.0)
+        RandomFlatShader(color_t color_init) : FlatShader<real_t, color_t, depth_t>(color_init), rand_gen(std::random_device{}()), color_range(0.0, 1.0)
         {
 
         }
@@ -425,12 +948,13 @@ namespace mistery_render
     };
 
 
-    template <class real_t, class color_t>
-    class TextureShader : public Shader<real_t, color_t>
+    template <class real_t, class color_t, class depth_t = double>
+    class TextureShader : public Shader<real_t, color_t, depth_t>
     {
     public:
         int ssaa_scale = 1;
-        TextureShader(int ssaa_scale_init = 1) : ssaa_scale(ssaa_scale_init)
+        AntiAliasMode aa_mode = AntiAliasMode::kSSAA;
+        TextureShader(int ssaa_scale_init = 1, AntiAliasMode aa_mode_init = AntiAliasMode::kSSAA) : ssaa_scale(ssaa_scale_init), aa_mode(aa_mode_init)
         {
 
         }
@@ -439,7 +963,8 @@ namespace mistery_render
         size_t TextureTriangleFragmentShade(size_t idx, const GetTextureColor<real_t> &light_func)
         {
             TriangleDrawFrame<color_t, GetTextureColor<real_t>, real_t>(this->shader_vertex_buffer[idx], this->shader_vertex_buffer[idx + 1], 
-                                                    this->shader_vertex_buffer[idx + 2], this->zbuffer, *(this->img), light_func, ssaa_scale);
+                                                    this->shader_vertex_buffer[idx + 2], this->zbuffer, *(this->img), light_func, ssaa_scale, aa_mode, 
+                                                    this->GetShadingRate(this->shader_vertex_buffer[idx].material), &(this->shading_rate_map));
             return idx + 3;
         }
 
@@ -452,8 +977,13 @@ namespace mistery_render
         virtual bool FragmentShade() override
         {
             GetTextureColor<real_t> light_functor;
+            light_functor.mip_filter = this->mip_filter;
+            light_functor.wait_textures = this->wait_textures;
             for (size_t i = 0; i < this->shader_vertex_buffer.size(); i += 3) 
             {
+                light_functor.uv_derivative = TriangleUVDerivative(this->shader_vertex_buffer[i], this->shader_vertex_buffer[i+1], 
+                                                                    this->shader_vertex_buffer[i+2], 1.0 / ssaa_scale);
+                light_functor.SetMaterial(this->shader_vertex_buffer[i].material);
                 this->TextureTriangleFragmentShade(i, light_functor);
             }
             return true;
@@ -462,8 +992,8 @@ namespace mistery_render
     };
 
 
-    template <class real_t, class color_t>
-    class BlinnPhongShader : public Shader<real_t, color_t>
+    template <class real_t, class color_t, class depth_t = double>
+    class BlinnPhongShader : public Shader<real_t, color_t, depth_t>
     {
     protected:
         std::vector<m_math::Vector<real_t, 3>> shader_vertex_buffer_pos = {};
@@ -489,7 +1019,8 @@ namespace mistery_render
 
     public:
         int ssaa_scale = 1;
-        BlinnPhongShader(int ssaa_scale_init = 1) : ssaa_scale(ssaa_scale_init)
+        AntiAliasMode aa_mode = AntiAliasMode::kSSAA;
+        BlinnPhongShader(int ssaa_scale_init = 1, AntiAliasMode aa_mode_init = AntiAliasMode::kSSAA) : ssaa_scale(ssaa_scale_init), aa_mode(aa_mode_init)
         {
 
         }
@@ -498,7 +1029,8 @@ namespace mistery_render
         size_t BlinnPhongFragmentShade(size_t idx, const GetPhongColor<real_t> &light_func)
         {
             TriangleDrawFrame<color_t, GetPhongColor<real_t>, real_t>(this->shader_vertex_buffer[idx], this->shader_vertex_buffer[idx + 1], 
-                                                    this->shader_vertex_buffer[idx + 2], this->zbuffer, *(this->img), light_func, ssaa_scale);
+                                                    this->shader_vertex_buffer[idx + 2], this->zbuffer, *(this->img), light_func, ssaa_scale, aa_mode, 
+                                                    this->GetShadingRate(this->shader_vertex_buffer[idx].material), &(this->shading_rate_map));
             return idx + 3;
         }
 
@@ -514,11 +1046,16 @@ namespace mistery_render
         {
             GetPhongColor<real_t> light_functor;
             light_functor.lights = this->shader_light_buffer;
+            light_functor.mip_filter = this->mip_filter;
+            light_functor.wait_textures = this->wait_textures;
             for (size_t i = 0; i < this->shader_vertex_buffer.size(); i += 3) 
             {
+                light_functor.uv_derivative = TriangleUVDerivative(this->shader_vertex_buffer[i], this->shader_vertex_buffer[i+1], 
+                                                                    this->shader_vertex_buffer[i+2], 1.0 / ssaa_scale);
                 light_functor.pos_v0 = shader_vertex_buffer_pos[i];
                 light_functor.pos_v1 = shader_vertex_buffer_pos[i+1];
                 light_functor.pos_v2 = shader_vertex_buffer_pos[i+2];
+                light_functor.SetMaterial(this->shader_vertex_buffer[i].material);
 
                 this->BlinnPhongFragmentShade(i, light_functor);
             }
@@ -529,14 +1066,27 @@ namespace mistery_render
 
 
 
-template <class color_t>
+template <class color_t, class depth_t = double>
 class CameraRender
 {
-    friend Shader<double, color_t>;
+    friend Shader<double, color_t, depth_t>;
 private:
-    std::shared_ptr<Shader<double, color_t>> shader = nullptr;
+    std::shared_ptr<Shader<double, color_t, depth_t>> shader = nullptr;
     std::vector<Vertex<double>> vert_buf;
     std::vector<Light *> light_buf;
+    std::unique_ptr<AsyncFrameWriter<color_t>> frame_writer = nullptr;
+
+    /**
+     * @brief Renders the vertex buffer into the current target of the shader
+     */
+    void RenderTarget()
+    {
+        shader->UpdateCameraTransform(camera->transform_origin);
+        shader->BindVertexBuffer(vert_buf);
+        shader->BindLightBuffer(light_buf);
+        shader->VertexShade();
+        shader->FragmentShade();
+    }
 
 public:
     Image<color_t> * img;
@@ -549,7 +1099,7 @@ public:
         camera = cma;
     }
 
-    void SetShader(std::shared_ptr<Shader<double, color_t>> shader_ptr)
+    void SetShader(std::shared_ptr<Shader<double, color_t, depth_t>> shader_ptr)
     {
         shader = shader_ptr;
         shader->SetImgPtr(img);
@@ -583,18 +1133,75 @@ public:
         light_buf = scene.lights;
     }
 
+    /**
+     * @brief Clears img and the z-buffer for a new frame, reusing their memory
+     */
+    void Clear(const color_t &color = color_t(), double depth = -std::numeric_limits<double>::max())
+    {
+        if (shader->GetImgPtr() != img)
+        {
+            shader->SetImgPtr(img);
+        }
+        shader->Clear(color, depth);
+    }
+
     void Render()
     {
         if (camera == nullptr)
         {
             return;
         }
-        
-        shader->UpdateCameraTransform(camera->transform_origin);
-        shader->BindVertexBuffer(vert_buf);
-        shader->BindLightBuffer(light_buf);
-        shader->VertexShade();
-        shader->FragmentShade();
+        if (shader->GetImgPtr() != img)
+        {
+            shader->SetImgPtr(img);     // back from a frame of RenderAsync()
+        }
+        RenderTarget();
+    }
+
+    /**
+     * @brief Starts writing frames rendered by RenderAsync() on a background thread
+     * @param frame_num Number of framebuffers (of the size of img) in the ring, 2 or 3 is enough to overlap
+     * rendering and writing; RenderAsync() blocks while all of them wait to be written
+     * @param write Writes a frame on the writer thread, e.g. Save2ppmBinary() to a file named by the frame index
+     */
+    void SetFrameOutput(size_t frame_num, typename AsyncFrameWriter<color_t>::WriteFunc write)
+    {
+        frame_writer.reset();   // writes the pending frames of the last output
+        frame_writer.reset(new AsyncFrameWriter<color_t>(img->GetWidth(), img->GetHeight(), frame_num, write));
+    }
+
+    /**
+     * @brief Renders a frame into a free framebuffer of the ring and queues it for writing, returns without waiting
+     * for the write; renders into img as Render() if SetFrameOutput() is not called
+     * @return Index of the frame passed to the write function
+     */
+    size_t RenderAsync()
+    {
+        if (frame_writer == nullptr)
+        {
+            Render();
+            return 0;
+        }
+        if (camera == nullptr)
+        {
+            return 0;
+        }
+        Image<color_t> * frame = frame_writer->AcquireFrame();
+        shader->SetImgPtr(frame);   // clears the z-buffer
+        ClearImage(*frame, color_t());
+        RenderTarget();
+        return frame_writer->SubmitFrame(frame);
+    }
+
+    /**
+     * @brief Waits until all frames rendered by RenderAsync() are written
+     */
+    void FlushFrames()
+    {
+        if (frame_writer != nullptr)
+        {
+            frame_writer->Flush();
+        }
     }
 };
 
@@ -1,7 +1,16 @@
 #pragma once
 
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "math.h"
 #include "image.h"
+#include "aligned_memory.h"
+#include "parallel.h"
+#include "block_compress.h"
 
 namespace mistery_render
 {
@@ -9,8 +18,709 @@ namespace mistery_render
 template <class real_t = double, size_t color_dim = 4>
 using Texture1Dim = std::vector<std::array<real_t, color_dim>>;
 
-template <class real_t = double, size_t color_dim = 4>
-using Texture2Dim = std::vector<std::vector<std::array<real_t, color_dim>>>;
+/**
+ * @brief Texel formats of Texture2D
+ */
+enum class TexelFormat
+{
+    kRGBA8,     // 4 x uint8, 4 bytes per texel
+    kR8,        // 1 x uint8 gray, 1 byte per texel, samples as (r, r, r, 1)
+    kRGBA32F,   // 4 x float, 16 bytes per texel
+    kBC1,       // BC1 (DXT1) 4x4 blocks, 8 bytes per block, RGB + 1 bit alpha
+    kBC3,       // BC3 (DXT5) 4x4 blocks, 16 bytes per block, RGBA
+};
+
+/**
+ * @brief Whether the format stores 4x4 compressed blocks instead of texels
+ */
+inline bool IsBlockCompressed(TexelFormat format)
+{
+    return format == TexelFormat::kBC1 || format == TexelFormat::kBC3;
+}
+
+/**
+ * @brief Size of a 4x4 block of a block compressed format in bytes
+ * @param format The texel format
+ * @return bytes per block, 0 if the format is not block compressed
+ */
+inline size_t BlockBytes(TexelFormat format)
+{
+    switch (format)
+    {
+    case TexelFormat::kBC1:
+        return block_compress::kBC1BlockBytes;
+    case TexelFormat::kBC3:
+        return block_compress::kBC3BlockBytes;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Size of a texel in bytes
+ * @param format The texel format
+ * @return bytes per texel, 0 for block compressed formats
+ */
+inline size_t TexelBytes(TexelFormat format)
+{
+    switch (format)
+    {
+    case TexelFormat::kRGBA8:
+        return 4;
+    case TexelFormat::kR8:
+        return 1;
+    case TexelFormat::kRGBA32F:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Memory layouts of texels in a mip level of Texture2D
+ */
+enum class TextureLayout
+{
+    kLinear,    // row major
+    kTiled,     // 4x4 tiles in row major, texels in a tile in row major
+    kMorton,    // 32x32 tiles in row major, texels in a tile in Morton (Z) order
+};
+
+/**
+ * @brief Tile size of a texture layout, 1 for kLinear
+ */
+inline size_t LayoutTileSize(TextureLayout layout)
+{
+    switch (layout)
+    {
+    case TextureLayout::kTiled:
+        return 4;
+    case TextureLayout::kMorton:
+        return 32;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief Spreads the low 16 bits of n to the even bits
+ */
+inline std::uint32_t MortonSpread(std::uint32_t n)
+{
+    n &= 0x0000ffff;
+    n = (n | (n << 8)) & 0x00ff00ff;
+    n = (n | (n << 4)) & 0x0f0f0f0f;
+    n = (n | (n << 2)) & 0x33333333;
+    n = (n | (n << 1)) & 0x55555555;
+    return n;
+}
+
+/**
+ * @brief Morton (Z order) index of (x, y), x is in the even bits
+ */
+inline std::uint32_t MortonIndex(std::uint32_t x, std::uint32_t y)
+{
+    return MortonSpread(x) | (MortonSpread(y) << 1);
+}
+
+/**
+ * @brief Wrap modes of texture coordinates out of [0, 1]
+ */
+enum class WrapMode
+{
+    kRepeat,
+    kClamp,     // clamp to edge
+    kMirror,    // mirrored repeat
+};
+
+/**
+ * @brief A mip level of Texture2D
+ */
+struct MipLevel
+{
+    size_t width = 0;
+    size_t height = 0;
+    size_t offset = 0;  // bytes from the start of texture data
+    size_t tiles_x = 0; // tiles (blocks for block compressed formats) per row, width for kLinear
+    int mask_x = 0;     // width - 1 if width is a power of 2, else 0
+    int mask_y = 0;     // height - 1 if height is a power of 2, else 0
+};
+
+/**
+ * @brief Unique id of texture data, never 0
+ */
+inline std::uint64_t NextTextureId()
+{
+    static std::atomic<std::uint64_t> next_id(1);
+    return next_id.fetch_add(1);
+}
+
+/**
+ * @brief 2D texture stored in one contiguous aligned allocation, texels are converted to real_t only on sampling
+ * @attention Level 0 is the base image, other levels (if any) are built by GenerateMips() in the same allocation;
+ * block compressed textures are made by Compress() and are read only, their layout is always 4x4 blocks in row major
+ */
+class Texture2D
+{
+private:
+    TexelFormat format = TexelFormat::kRGBA8;
+    TextureLayout layout = TextureLayout::kLinear;
+    WrapMode wrap_u = WrapMode::kRepeat;
+    WrapMode wrap_v = WrapMode::kRepeat;
+    std::vector<MipLevel> levels = {};
+    std::shared_ptr<std::uint8_t> data = nullptr;
+    std::uint64_t data_id = 0;  // key of decoded blocks in block_compress::ThreadBlockCache()
+
+    /**
+     * @brief Makes a level at offset, returns the bytes of it (padded to whole tiles)
+     */
+    inline size_t MakeLevel(size_t width, size_t height, size_t offset, MipLevel &level) const
+    {
+        size_t tile = IsBlockCompressed(format) ? 4 : LayoutTileSize(layout);
+        level.width = width;
+        level.height = height;
+        level.offset = offset;
+        level.tiles_x = (width + tile - 1) / tile;
+        level.mask_x = ((width & (width - 1)) == 0) ? static_cast<int>(width) - 1 : 0;
+        level.mask_y = ((height & (height - 1)) == 0) ? static_cast<int>(height) - 1 : 0;
+        size_t tiles_y = (height + tile - 1) / tile;
+        if (IsBlockCompressed(format))
+        {
+            return level.tiles_x * tiles_y * BlockBytes(format);
+        }
+        return level.tiles_x * tiles_y * tile * tile * TexelBytes(format);
+    }
+
+    /**
+     * @brief Makes the levels of a texture with (width, height) base and level_num levels, returns total bytes
+     */
+    inline size_t MakeLevels(size_t width, size_t height, size_t level_num, std::vector<MipLevel> &level_list) const
+    {
+        level_list.resize(level_num);
+        size_t bytes = 0;
+        for (size_t i = 0; i < level_num; i++)
+        {
+            bytes = AlignUp(bytes, kBufferAlignment);
+            bytes += MakeLevel(width, height, bytes, level_list[i]);
+            width = std::max<size_t>(1, width / 2);
+            height = std::max<size_t>(1, height / 2);
+        }
+        return bytes;
+    }
+
+public:
+    /**
+     * @brief Default constructor, empty texture
+     */
+    Texture2D()
+    {
+    }
+
+    /**
+     * @brief Constructor with texture dimensions, texels are initialized to 0
+     * @param width_init Width of the texture
+     * @param height_init Height of the texture
+     * @param format_init Texel format of the texture
+     * @param layout_init Memory layout of the texture
+     */
+    Texture2D(size_t width_init, size_t height_init, TexelFormat format_init = TexelFormat::kRGBA8, 
+                TextureLayout layout_init = TextureLayout::kLinear) : format(format_init), layout(layout_init)
+    {
+        data = MakeAlignedBytes(MakeLevels(width_init, height_init, 1, levels));
+    }
+
+    /**
+     * @brief Constructor wrapping existing texel data, e.g. a mapped texture file
+     * @attention data_init must be 64-byte aligned and hold ByteSize() bytes laid out like a texture made by the other 
+     * constructor (and GenerateMips() if level_num > 1, Relayout() or Compress())
+     * @param width_init Width of the texture
+     * @param height_init Height of the texture
+     * @param level_num Number of mip levels
+     * @param format_init Texel format of the texture
+     * @param layout_init Memory layout of the texture, ignored for block compressed formats
+     * @param data_init The texel data of all levels
+     */
+    Texture2D(size_t width_init, size_t height_init, size_t level_num, TexelFormat format_init, TextureLayout layout_init, 
+                std::shared_ptr<std::uint8_t> data_init) : format(format_init), layout(layout_init), data(data_init)
+    {
+        if (IsBlockCompressed(format))
+        {
+            layout = TextureLayout::kLinear;
+        }
+        MakeLevels(width_init, height_init, level_num, levels);
+        data_id = NextTextureId();
+    }
+
+    inline bool Empty() const
+    {
+        return data == nullptr;
+    }
+
+    /**
+     * @brief Texel data of all levels, ByteSize() bytes
+     */
+    inline const std::uint8_t * Data() const
+    {
+        return data.get();
+    }
+
+    inline size_t GetWidth(size_t level = 0) const
+    {
+        return levels[level].width;
+    }
+
+    inline size_t GetHeight(size_t level = 0) const
+    {
+        return levels[level].height;
+    }
+
+    inline TexelFormat GetFormat() const
+    {
+        return format;
+    }
+
+    inline TextureLayout GetLayout() const
+    {
+        return layout;
+    }
+
+    inline const MipLevel & GetLevel(size_t level) const
+    {
+        return levels[level];
+    }
+
+    inline WrapMode GetWrapU() const
+    {
+        return wrap_u;
+    }
+
+    inline WrapMode GetWrapV() const
+    {
+        return wrap_v;
+    }
+
+    /**
+     * @brief Sets wrap modes used by texture::Sampler
+     * @param wrap_u_init Wrap mode of u
+     * @param wrap_v_init Wrap mode of v
+     */
+    inline void SetWrapMode(WrapMode wrap_u_init, WrapMode wrap_v_init)
+    {
+        wrap_u = wrap_u_init;
+        wrap_v = wrap_v_init;
+    }
+
+    /**
+     * @brief Number of mip levels, 1 if mips are not generated
+     */
+    inline size_t GetLevelNum() const
+    {
+        return levels.size();
+    }
+
+    /**
+     * @brief Size of texel data of all levels in bytes
+     */
+    inline size_t ByteSize() const
+    {
+        if (levels.empty())
+        {
+            return 0;
+        }
+        MipLevel last;
+        return levels.back().offset + MakeLevel(levels.back().width, levels.back().height, 0, last);
+    }
+
+    /**
+     * @brief Pointer to the first byte of row y in a level
+     * @attention Only for TextureLayout::kLinear, not check y < height, level < level num
+     */
+    inline std::uint8_t * Row(size_t y, size_t level = 0)
+    {
+        return data.get() + levels[level].offset + y * levels[level].width * TexelBytes(format);
+    }
+
+    inline const std::uint8_t * Row(size_t y, size_t level = 0) const
+    {
+        return data.get() + levels[level].offset + y * levels[level].width * TexelBytes(format);
+    }
+
+    /**
+     * @brief Byte offset of a texel from the start of texture data, for all layouts
+     * @attention Not check x < width, y < height, level < level num
+     */
+    inline size_t TexelOffset(size_t x, size_t y, size_t level = 0) const
+    {
+        const MipLevel &lv = levels[level];
+        size_t index = 0;
+        switch (layout)
+        {
+        case TextureLayout::kTiled:
+            index = (((y >> 2) * lv.tiles_x + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3);
+            break;
+        case TextureLayout::kMorton:
+            index = (((y >> 5) * lv.tiles_x + (x >> 5)) << 10) + MortonIndex(x & 31, y & 31);
+            break;
+        default:
+            index = y * lv.width + x;
+            break;
+        }
+        return lv.offset + index * TexelBytes(format);
+    }
+
+    /**
+     * @brief Pointer to a texel, for all layouts
+     * @attention Not check x < width, y < height, level < level num
+     */
+    inline std::uint8_t * TexelPtr(size_t x, size_t y, size_t level = 0)
+    {
+        return data.get() + TexelOffset(x, y, level);
+    }
+
+    inline const std::uint8_t * TexelPtr(size_t x, size_t y, size_t level = 0) const
+    {
+        return data.get() + TexelOffset(x, y, level);
+    }
+
+    /**
+     * @brief Byte offset of the 4x4 block containing a texel, for block compressed formats
+     * @attention Not check x < width, y < height, level < level num
+     */
+    inline size_t BlockOffset(size_t x, size_t y, size_t level = 0) const
+    {
+        const MipLevel &lv = levels[level];
+        return lv.offset + ((y >> 2) * lv.tiles_x + (x >> 2)) * BlockBytes(format);
+    }
+
+    /**
+     * @brief Fetches a texel as RGBA8 packed in r | g << 8 | b << 16 | a << 24, decodes blocks of compressed formats
+     * @attention Not check x < width, y < height, level < level num
+     */
+    inline std::uint32_t FetchRGBA8(size_t x, size_t y, size_t level = 0) const
+    {
+        std::uint32_t texel = 0;
+        switch (format)
+        {
+        case TexelFormat::kRGBA8:
+            memcpy(&texel, TexelPtr(x, y, level), 4);
+            return texel;
+        case TexelFormat::kBC1:
+        case TexelFormat::kBC3:
+        {
+            size_t offset = BlockOffset(x, y, level);
+            const std::uint32_t * block = block_compress::ThreadBlockCache().Get(data_id, offset, data.get() + offset, 
+                                                                                  format == TexelFormat::kBC3);
+            return block[((y & 3) << 2) + (x & 3)];
+        }
+        default:
+        {
+            std::array<float, 4> rgba = Fetch<float>(x, y, level);
+            for (int c = 0; c < 4; c++)
+            {
+                float value = std::min(std::max(rgba[c], 0.0f), 1.0f);
+                texel |= static_cast<std::uint32_t>(value * 255 + 0.5f) << (8 * c);
+            }
+            return texel;
+        }
+        }
+    }
+
+    /**
+     * @brief Fetches a texel and converts it to real_t in [0, 1]
+     * @attention Not check x < width, y < height, level < level num
+     * @param x Index of width
+     * @param y Index of height
+     * @param level Mip level
+     * @return RGBA of the texel
+     */
+    template <class real_t = double>
+    inline std::array<real_t, 4> Fetch(size_t x, size_t y, size_t level = 0) const
+    {
+        const real_t kInv255 = static_cast<real_t>(1.0 / 255.0);
+        const std::uint8_t * p = TexelPtr(x, y, level);
+        switch (format)
+        {
+        case TexelFormat::kRGBA8:
+            return {p[0] * kInv255, p[1] * kInv255, p[2] * kInv255, p[3] * kInv255};
+        case TexelFormat::kR8:
+        {
+            real_t gray = p[0] * kInv255;
+            return {gray, gray, gray, 1};
+        }
+        case TexelFormat::kRGBA32F:
+        {
+            const float * pf = reinterpret_cast<const float *>(p);
+            return {pf[0], pf[1], pf[2], pf[3]};
+        }
+        case TexelFormat::kBC1:
+        case TexelFormat::kBC3:
+        {
+            std::uint32_t texel = FetchRGBA8(x, y, level);
+            return {(texel & 0xff) * kInv255, ((texel >> 8) & 0xff) * kInv255, 
+                    ((texel >> 16) & 0xff) * kInv255, (texel >> 24) * kInv255};
+        }
+        default:
+            return {0, 0, 0, 0};
+        }
+    }
+
+    /**
+     * @brief Stores a texel from real_t in [0, 1], values out of range are clamped for 8-bit formats
+     * @attention Not check x < width, y < height, level < level num; does nothing for block compressed formats
+     * @param x Index of width
+     * @param y Index of height
+     * @param rgba RGBA of the texel
+     * @param level Mip level
+     */
+    template <class real_t = double>
+    inline void Store(size_t x, size_t y, const std::array<real_t, 4> &rgba, size_t level = 0)
+    {
+        auto to_u8 = [](real_t value) -> std::uint8_t
+        {
+            value = std::min<real_t>(std::max<real_t>(value, 0), 1);
+            return static_cast<std::uint8_t>(value * 255 + 0.5);
+        };
+        std::uint8_t * p = TexelPtr(x, y, level);
+        switch (format)
+        {
+        case TexelFormat::kRGBA8:
+            p[0] = to_u8(rgba[0]);
+            p[1] = to_u8(rgba[1]);
+            p[2] = to_u8(rgba[2]);
+            p[3] = to_u8(rgba[3]);
+            break;
+        case TexelFormat::kR8:
+            p[0] = to_u8(rgba[0]);
+            break;
+        case TexelFormat::kRGBA32F:
+        {
+            float * pf = reinterpret_cast<float *>(p);
+            for (size_t i = 0; i < 4; i++)
+            {
+                pf[i] = static_cast<float>(rgba[i]);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @brief Generates the full mip chain down to 1x1 by 2x2 box filtering, replaces old mips if any
+     * @attention Does nothing for block compressed formats, generate mips before Compress()
+     * @param thread_num Number of threads to filter rows of a level, 1 for serial
+     */
+    void GenerateMips(size_t thread_num = 1)
+    {
+        if (Empty() || IsBlockCompressed(format))
+        {
+            return;
+        }
+        size_t level_num = 1;
+        for (size_t w = levels[0].width, h = levels[0].height; w > 1 || h > 1; w = std::max<size_t>(1, w / 2), h = std::max<size_t>(1, h / 2))
+        {
+            level_num++;
+        }
+
+        std::vector<MipLevel> new_levels;
+        std::shared_ptr<std::uint8_t> new_data = MakeAlignedBytes(MakeLevels(levels[0].width, levels[0].height, level_num, new_levels));
+        MipLevel base;
+        memcpy(new_data.get(), data.get(), MakeLevel(levels[0].width, levels[0].height, 0, base));
+        data = new_data;
+        levels = new_levels;
+
+        size_t texel_bytes = TexelBytes(format);
+        for (size_t level = 1; level < levels.size(); level++)
+        {
+            size_t src_w = levels[level - 1].width;
+            size_t src_h = levels[level - 1].height;
+            ParallelFor(0, levels[level].height, [&](size_t y)
+            {
+                // odd sizes: the last row / column of the source is folded into the last texel
+                size_t y0 = std::min(y * 2, src_h - 1);
+                size_t y1 = std::min(y * 2 + 1, src_h - 1);
+                for (size_t x = 0; x < levels[level].width; x++)
+                {
+                    size_t x0 = std::min(x * 2, src_w - 1);
+                    size_t x1 = std::min(x * 2 + 1, src_w - 1);
+                    if (format == TexelFormat::kRGBA8 || format == TexelFormat::kR8)
+                    {
+                        const std::uint8_t * t00 = TexelPtr(x0, y0, level - 1);
+                        const std::uint8_t * t01 = TexelPtr(x1, y0, level - 1);
+                        const std::uint8_t * t10 = TexelPtr(x0, y1, level - 1);
+                        const std::uint8_t * t11 = TexelPtr(x1, y1, level - 1);
+                        std::uint8_t * dst = TexelPtr(x, y, level);
+                        for (size_t c = 0; c < texel_bytes; c++)
+                        {
+                            unsigned sum = t00[c] + t01[c] + t10[c] + t11[c];
+                            dst[c] = static_cast<std::uint8_t>((sum + 2) >> 2);
+                        }
+                    }
+                    else
+                    {
+                        std::array<double, 4> t00 = Fetch(x0, y0, level - 1);
+                        std::array<double, 4> t01 = Fetch(x1, y0, level - 1);
+                        std::array<double, 4> t10 = Fetch(x0, y1, level - 1);
+                        std::array<double, 4> t11 = Fetch(x1, y1, level - 1);
+                        std::array<double, 4> avg;
+                        for (size_t c = 0; c < 4; c++)
+                        {
+                            avg[c] = 0.25 * (t00[c] + t01[c] + t10[c] + t11[c]);
+                        }
+                        Store(x, y, avg, level);
+                    }
+                }
+            }, thread_num);
+        }
+    }
+
+    /**
+     * @brief Converts all levels to another memory layout
+     * @attention Does nothing for block compressed formats
+     * @param new_layout The target layout
+     */
+    void Relayout(TextureLayout new_layout)
+    {
+        if (Empty() || new_layout == layout || IsBlockCompressed(format))
+        {
+            return;
+        }
+        Texture2D dst;
+        dst.format = format;
+        dst.layout = new_layout;
+        dst.wrap_u = wrap_u;
+        dst.wrap_v = wrap_v;
+        dst.data = MakeAlignedBytes(dst.MakeLevels(levels[0].width, levels[0].height, levels.size(), dst.levels));
+
+        size_t texel_bytes = TexelBytes(format);
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            for (size_t y = 0; y < levels[level].height; y++)
+            {
+                for (size_t x = 0; x < levels[level].width; x++)
+                {
+                    memcpy(dst.TexelPtr(x, y, level), TexelPtr(x, y, level), texel_bytes);
+                }
+            }
+        }
+        *this = dst;
+    }
+
+    /**
+     * @brief Encodes all levels into a block compressed format, texels of partial edge blocks are clamped to the edge
+     * @param bc_format The target format, kBC1 or kBC3; kBC1 keeps only 1 bit alpha (alpha < 0.5 becomes transparent black)
+     * @param thread_num Number of threads to encode block rows, 1 for serial
+     * @return The compressed texture, a copy of this texture if it is empty, already compressed or bc_format is not compressed
+     */
+    Texture2D Compress(TexelFormat bc_format, size_t thread_num = 1) const
+    {
+        if (Empty() || IsBlockCompressed(format) || !IsBlockCompressed(bc_format))
+        {
+            return *this;
+        }
+        Texture2D dst;
+        dst.format = bc_format;
+        dst.wrap_u = wrap_u;
+        dst.wrap_v = wrap_v;
+        dst.data = MakeAlignedBytes(dst.MakeLevels(levels[0].width, levels[0].height, levels.size(), dst.levels));
+        dst.data_id = NextTextureId();
+
+        size_t block_bytes = BlockBytes(bc_format);
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            const MipLevel &lv = dst.levels[level];
+            size_t blocks_y = (lv.height + 3) / 4;
+            ParallelFor(0, blocks_y, [&](size_t block_y)
+            {
+                std::uint32_t texels[16];
+                for (size_t block_x = 0; block_x < lv.tiles_x; block_x++)
+                {
+                    for (size_t i = 0; i < 16; i++)
+                    {
+                        size_t x = std::min(block_x * 4 + (i & 3), lv.width - 1);
+                        size_t y = std::min(block_y * 4 + (i >> 2), lv.height - 1);
+                        texels[i] = FetchRGBA8(x, y, level);
+                    }
+                    std::uint8_t * block = dst.data.get() + lv.offset + (block_y * lv.tiles_x + block_x) * block_bytes;
+                    if (bc_format == TexelFormat::kBC1)
+                    {
+                        block_compress::EncodeBC1Block(texels, block);
+                    }
+                    else
+                    {
+                        block_compress::EncodeBC3Block(texels, block);
+                    }
+                }
+            }, thread_num);
+        }
+        return dst;
+    }
+
+    /**
+     * @brief 64-bit hash of the texel data and the settings of the texture, equal for textures with SameContent()
+     * @attention Reads 8 bytes per step, hashing a 2048x2048 RGBA8 texture with mips takes about 3 ms
+     */
+    std::uint64_t ContentHash() const
+    {
+        if (Empty())
+        {
+            return 0;
+        }
+        const std::uint64_t prime = 0x9E3779B97F4A7C15ull;
+        std::uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash, prime](std::uint64_t word)
+        {
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 32;
+        };
+        mix(GetWidth());
+        mix(GetHeight());
+        mix(GetLevelNum());
+        mix((static_cast<std::uint64_t>(format) << 32) | (static_cast<std::uint64_t>(layout) << 16) |
+            (static_cast<std::uint64_t>(wrap_u) << 8) | static_cast<std::uint64_t>(wrap_v));
+        size_t bytes = ByteSize();
+        const std::uint8_t * ptr = data.get();
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8)
+        {
+            std::uint64_t word;
+            memcpy(&word, ptr + i, 8);
+            mix(word);
+        }
+        std::uint64_t tail = 0;
+        memcpy(&tail, ptr + i, bytes - i);
+        mix(tail);
+        return hash;
+    }
+
+    /**
+     * @brief Whether two textures have the same size, levels, format, layout, wrap modes and texel data
+     */
+    bool SameContent(const Texture2D &other) const
+    {
+        if (Empty() || other.Empty())
+        {
+            return Empty() && other.Empty();
+        }
+        if (GetWidth() != other.GetWidth() || GetHeight() != other.GetHeight() || GetLevelNum() != other.GetLevelNum() ||
+            format != other.format || layout != other.layout || wrap_u != other.wrap_u || wrap_v != other.wrap_v)
+        {
+            return false;
+        }
+        return data == other.data || memcmp(data.get(), other.data.get(), ByteSize()) == 0;
+    }
+};
+
+/**
+ * @brief Mip filter of texture sampling
+ */
+enum class MipFilter
+{
+    kNone,      // always samples level 0
+    kNearest,   // bilinear sampling in the nearest level
+    kLinear,    // trilinear, blends bilinear samples of 2 nearest levels
+};
 
 namespace texture
 {
@@ -31,30 +741,258 @@ inline auto Lerp(const Texture1Dim<real_t, 4>* texture1d, double u)
 }
 
 
-template <class real_t = double>
-inline auto Lerp2(const Texture2Dim<real_t, 4>* texture2d, double u, double v)
+/**
+ * @brief Level of detail of a texture by screen space derivatives of texture coordinates
+ * @param texture2d The texture, must not be empty
+ * @param uv_derivative {du/dx, dv/dx, du/dy, dv/dy}, x and y are in pixels
+ * @return LOD, 0 is the base level, negative when magnified
+ */
+inline double Lod(const Texture2D* texture2d, const std::array<double, 4> &uv_derivative)
 {
-    size_t max_x = texture2d->at(0).size();
-    size_t max_y = texture2d->size();
+    double w = static_cast<double>(texture2d->GetWidth());
+    double h = static_cast<double>(texture2d->GetHeight());
+    double dx = std::hypot(uv_derivative[0] * w, uv_derivative[1] * h);
+    double dy = std::hypot(uv_derivative[2] * w, uv_derivative[3] * h);
+    double rho = std::max(dx, dy);
+    if (rho <= 0)
+    {
+        return 0;
+    }
+    return std::log2(rho);
+}
 
-    size_t int_u = static_cast<size_t>(u * (max_x - 1));
-    size_t int_v = static_cast<size_t>(v * (max_y - 1));
+/**
+ * @brief Wraps an integer texel coordinate into [0, size)
+ * @param x The texel coordinate
+ * @param size Size of the level
+ * @param mask size - 1 if size is a power of 2, else 0
+ * @param mode Wrap mode
+ * @return The wrapped coordinate
+ */
+inline int WrapCoord(int x, int size, int mask, WrapMode mode)
+{
+    switch (mode)
+    {
+    case WrapMode::kClamp:
+        return x < 0 ? 0 : (x >= size ? size - 1 : x);
+    case WrapMode::kMirror:
+    {
+        int period = size * 2;
+        int m = x % period;
+        m = m < 0 ? m + period : m;
+        return m < size ? m : period - 1 - m;
+    }
+    default:
+    {
+        if (mask + 1 == size)
+        {
+            return x & mask;
+        }
+        int m = x % size;
+        return m < 0 ? m + size : m;
+    }
+    }
+}
 
-    if (int_u + 1 >= max_x) int_u = (int_u + 1) % max_x;
-    if (int_v + 1 >= max_y) int_v = (int_v + 1) % max_y;
+/**
+ * @brief 8-bit fixed point texel coordinate of a texture coordinate, the integer part is not wrapped yet
+ * @param t Texture coordinate
+ * @param size Size of the level
+ * @param mode Wrap mode
+ * @return (t * size - 0.5) * 256, rounded down
+ * @attention The texel coordinate is reduced into the wrap period (or clamped) in double first, so any t keeps
+ * the conversion to int in range; non-finite t samples texel 0
+ */
+inline int FixedTexelCoord(double t, int size, WrapMode mode)
+{
+    double x = t * size - 0.5;
+    if (!std::isfinite(x))
+    {
+        return 0;
+    }
+    if (mode == WrapMode::kClamp)
+    {
+        x = std::min(std::max(x, -1.0), static_cast<double>(size));
+    }
+    else
+    {
+        double period = mode == WrapMode::kMirror ? 2.0 * size : size;
+        x -= std::floor(x / period) * period;
+    }
+    return static_cast<int>(std::floor(x * 256.0));
+}
 
-    double frac_u = u * (max_x - 1) - int_u;
-    double frac_v = v * (max_y - 1) - int_v;
+/**
+ * @brief Bilinear blending of 4 RGBA8 texels with 8-bit fixed point weights
+ * @param t00 Texel at (x0, y0)
+ * @param t01 Texel at (x1, y0)
+ * @param t10 Texel at (x0, y1)
+ * @param t11 Texel at (x1, y1)
+ * @param w_x Weight of x1 in [0, 256]
+ * @param w_y Weight of y1 in [0, 256]
+ * @return The blended RGBA8 texel
+ */
+inline std::uint32_t BlendRGBA8(std::uint32_t t00, std::uint32_t t01, std::uint32_t t10, std::uint32_t t11, int w_x, int w_y)
+{
+#if defined(__SSE2__)
+    // 16-bit lanes: [t00 rgba, t01 rgba] and [t10 rgba, t11 rgba], weights sum to 256 so products fit in 16 bits
+    const __m128i zero = _mm_setzero_si128();
+    __m128i weight_x = _mm_set_epi16(w_x, w_x, w_x, w_x, 256 - w_x, 256 - w_x, 256 - w_x, 256 - w_x);
+    __m128i top = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set_epi32(0, 0, t01, t00), zero), weight_x);
+    __m128i bottom = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set_epi32(0, 0, t11, t10), zero), weight_x);
+    top = _mm_srli_epi16(_mm_add_epi16(top, _mm_srli_si128(top, 8)), 8);
+    bottom = _mm_srli_epi16(_mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)), 8);
+    __m128i res = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(256 - w_y)), _mm_mullo_epi16(bottom, _mm_set1_epi16(w_y)));
+    res = _mm_srli_epi16(res, 8);
+    return static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(res, zero)));
+#else
+    std::uint32_t res = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        std::uint32_t top = (((t00 >> shift) & 0xff) * (256 - w_x) + ((t01 >> shift) & 0xff) * w_x) >> 8;
+        std::uint32_t bottom = (((t10 >> shift) & 0xff) * (256 - w_x) + ((t11 >> shift) & 0xff) * w_x) >> 8;
+        res |= ((top * (256 - w_y) + bottom * w_y) >> 8) << shift;
+    }
+    return res;
+#endif
+}
 
-    m_math::Vector<real_t, 4> color1 (texture2d->at(int_v)[int_u]);
-    m_math::Vector<real_t, 4> color2 (texture2d->at(int_v)[int_u + 1]);
-    m_math::Vector<real_t, 4> color3 (texture2d->at(int_v + 1)[int_u]);
-    m_math::Vector<real_t, 4> color4 (texture2d->at(int_v + 1)[int_u + 1]);
+/**
+ * @brief Texture sampler with the wrap modes of the texture, fixed point bilinear weights and mip filtering
+ * @attention Texel centers are at ((x + 0.5) / width, (y + 0.5) / height)
+ */
+class Sampler
+{
+private:
+    const Texture2D * texture2d = nullptr;
+    MipFilter mip_filter = MipFilter::kLinear;
 
-    m_math::Vector<real_t, 4> color_top = (1.0 - frac_u) * color1 + frac_u * color2;
-    m_math::Vector<real_t, 4> color_bottom = (1.0 - frac_u) * color3 + frac_u * color4;
-    return (1.0 - frac_v) * color_top + frac_v * color_bottom;
-}
+    /**
+     * @brief Whether texels are blended in fixed point RGBA8 (8-bit and block compressed formats)
+     */
+    inline bool UseRGBA8Path() const
+    {
+        TexelFormat format = texture2d->GetFormat();
+        return format == TexelFormat::kRGBA8 || IsBlockCompressed(format);
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param texture2d_init The texture, must not be empty
+     * @param mip_filter_init Mip filter, mips are ignored if the texture has no mips
+     */
+    Sampler(const Texture2D * texture2d_init, MipFilter mip_filter_init = MipFilter::kLinear) : 
+            texture2d(texture2d_init), mip_filter(mip_filter_init)
+    {
+    }
+
+    /**
+     * @brief Level of detail of the texture by screen space derivatives, see texture::Lod
+     */
+    inline double Lod(const std::array<double, 4> &uv_derivative) const
+    {
+        return texture::Lod(texture2d, uv_derivative);
+    }
+
+    /**
+     * @brief Bilinear sampling of a level
+     * @param u Texture coordinate u
+     * @param v Texture coordinate v
+     * @param level Mip level
+     * @return RGBA of the sample in [0, 1]
+     */
+    inline std::array<float, 4> Bilinear(double u, double v, size_t level = 0) const
+    {
+        const MipLevel &lv = texture2d->GetLevel(level);
+        int size_x = static_cast<int>(lv.width);
+        int size_y = static_cast<int>(lv.height);
+
+        // 8-bit fixed point texel coordinates
+        int fixed_x = FixedTexelCoord(u, size_x, texture2d->GetWrapU());
+        int fixed_y = FixedTexelCoord(v, size_y, texture2d->GetWrapV());
+        int w_x = fixed_x & 0xff;
+        int w_y = fixed_y & 0xff;
+        int x0 = WrapCoord(fixed_x >> 8, size_x, lv.mask_x, texture2d->GetWrapU());
+        int x1 = WrapCoord((fixed_x >> 8) + 1, size_x, lv.mask_x, texture2d->GetWrapU());
+        int y0 = WrapCoord(fixed_y >> 8, size_y, lv.mask_y, texture2d->GetWrapV());
+        int y1 = WrapCoord((fixed_y >> 8) + 1, size_y, lv.mask_y, texture2d->GetWrapV());
+
+        if (UseRGBA8Path())
+        {
+            std::uint32_t t00 = texture2d->FetchRGBA8(x0, y0, level);
+            std::uint32_t t01 = texture2d->FetchRGBA8(x1, y0, level);
+            std::uint32_t t10 = texture2d->FetchRGBA8(x0, y1, level);
+            std::uint32_t t11 = texture2d->FetchRGBA8(x1, y1, level);
+            std::uint32_t texel = BlendRGBA8(t00, t01, t10, t11, w_x, w_y);
+            const float kInv255 = 1.0f / 255.0f;
+            return {(texel & 0xff) * kInv255, ((texel >> 8) & 0xff) * kInv255, 
+                    ((texel >> 16) & 0xff) * kInv255, (texel >> 24) * kInv255};
+        }
+
+        float weight_x = w_x / 256.0f;
+        float weight_y = w_y / 256.0f;
+        std::array<float, 4> t00 = texture2d->Fetch<float>(x0, y0, level);
+        std::array<float, 4> t01 = texture2d->Fetch<float>(x1, y0, level);
+        std::array<float, 4> t10 = texture2d->Fetch<float>(x0, y1, level);
+        std::array<float, 4> t11 = texture2d->Fetch<float>(x1, y1, level);
+        std::array<float, 4> res;
+        for (size_t c = 0; c < 4; c++)
+        {
+            float top = t00[c] + (t01[c] - t00[c]) * weight_x;
+            float bottom = t10[c] + (t11[c] - t10[c]) * weight_x;
+            res[c] = top + (bottom - top) * weight_y;
+        }
+        return res;
+    }
+
+    /**
+     * @brief Filtered sampling
+     * @param u Texture coordinate u
+     * @param v Texture coordinate v
+     * @param lod Level of detail, usually given by Lod()
+     * @return RGBA of the sample in [0, 1]
+     */
+    inline std::array<float, 4> SampleRGBA(double u, double v, double lod = 0) const
+    {
+        size_t max_level = texture2d->GetLevelNum() - 1;
+        if (mip_filter == MipFilter::kNone || max_level == 0 || lod <= 0)
+        {
+            return Bilinear(u, v, 0);
+        }
+        if (lod >= max_level)
+        {
+            return Bilinear(u, v, max_level);
+        }
+        if (mip_filter == MipFilter::kNearest)
+        {
+            return Bilinear(u, v, static_cast<size_t>(lod + 0.5));
+        }
+        size_t level = static_cast<size_t>(lod);
+        float frac = static_cast<float>(lod - level);
+        std::array<float, 4> fine = Bilinear(u, v, level);
+        std::array<float, 4> coarse = Bilinear(u, v, level + 1);
+        for (size_t c = 0; c < 4; c++)
+        {
+            fine[c] += (coarse[c] - fine[c]) * frac;
+        }
+        return fine;
+    }
+
+    /**
+     * @brief Filtered sampling
+     * @param u Texture coordinate u
+     * @param v Texture coordinate v
+     * @param lod Level of detail, usually given by Lod()
+     * @return RGBA of the sample in [0, 1]
+     */
+    template <class real_t = double>
+    inline m_math::Vector<real_t, 4> Sample(double u, double v, double lod = 0) const
+    {
+        std::array<float, 4> rgba = SampleRGBA(u, v, lod);
+        return m_math::Vector<real_t, 4>({rgba[0], rgba[1], rgba[2], rgba[3]});
+    }
+};
 
 
 }
@@ -62,10 +62,97 @@ void DrawCircleTest()
     TestExpect(" ", " ", "Draw Circle Test");
 }
 
+void LayoutTest()
+{
+    Image<double> depth(30, 20, 1.0);
+    TestExpect(depth.GetPitch() % (kBufferAlignment / sizeof(double)), (size_t)0, "Image Pitch Alignment Test");
+    TestExpect(reinterpret_cast<uintptr_t>(depth.Row(3)) % kBufferAlignment, (uintptr_t)0, "Image Row Alignment Test");
+
+    // a sub view writes through to the image, clipped to it
+    ImageView<double> tile = depth.SubView(24, 16, 8, 8);
+    tile.Fill(2.0);
+    TestExpect(tile.GetWidth(), (size_t)6, "Image Sub View Clip Test");
+    TestExpect(tile.GetHeight(), (size_t)4, "Image Sub View Clip Height Test");
+    TestExpect(depth.GetColor(24, 16), 2.0, "Image Sub View Fill Test");
+    TestExpect(depth.GetColor(29, 19), 2.0, "Image Sub View Fill Corner Test");
+    TestExpect(depth.GetColor(23, 16), 1.0, "Image Sub View Outside Test");
+
+    depth.Row(5)[7] = 3.0;
+    TestExpect(depth.At(7, 5), 3.0, "Image Row Access Test");
+    depth.Clear();
+    TestExpect(depth.GetColor(29, 19), 0.0, "Image Clear Test");
+}
+
+void WriterTest()
+{
+    Image_RGBA_d img(800, 900);
+    for (size_t y = 0; y < img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < img.GetWidth(); x++)
+        {
+            img.SetColor(x, y, ColorRGBA_d(x / 799.0, y / 899.0, (x + y) % 7 / 6.0, 1));
+        }
+    }
+
+    // P6 bytes are the P3 values
+    std::stringstream p3;
+    std::stringstream p6;
+    double ts = NowTime(2);
+    Save2ppm(img, p3);
+    double te = NowTime(2);
+    std::cout << "save 800x900 P3 PPM: using " << te - ts << " us\n";
+    ts = NowTime(2);
+    Save2ppmBinary(img, p6);
+    te = NowTime(2);
+    std::cout << "save 800x900 P6 PPM: using " << te - ts << " us\n";
+
+    std::string magic;
+    size_t width = 0, height = 0, max_value = 0;
+    p3 >> magic >> width >> height >> max_value;
+    std::string p6_data = p6.str();
+    std::string p6_header = "P6\n800 900\n255\n";
+    bool same = p6_data.size() == p6_header.size() + width * height * 3 && p6_data.compare(0, p6_header.size(), p6_header) == 0;
+    for (size_t i = 0; same && i < width * height * 3; i++)
+    {
+        int value = 0;
+        p3 >> value;
+        same = value == static_cast<unsigned char>(p6_data[p6_header.size() + i]);
+    }
+    TestExpect(same, true, "Save PPM Binary Test");
+
+    std::stringstream raw;
+    Save2raw(img, raw);
+    std::string raw_data = raw.str();
+    TestExpect(raw_data.size(), (size_t)(800 * 900 * 4), "Save Raw Test");
+    if (raw_data.size() == 800 * 900 * 4)
+    {
+        TestExpect(static_cast<int>(static_cast<unsigned char>(raw_data[4 * 799])), 255, "Save Raw Red Test");
+        TestExpect(static_cast<int>(static_cast<unsigned char>(raw_data[4 * 799 + 3])), 255, "Save Raw Alpha Test");
+    }
+
+    // clamped out of range colors, RGB images
+    Image_RGB_d small(3, 1);
+    small.SetColor(0, 0, ColorRGB_d(-1, 2, 0.5));
+    std::stringstream small_raw;
+    Save2raw(small, small_raw);
+    std::string small_data = small_raw.str();
+    TestExpect(small_data.substr(0, 4) == std::string("\x00\xff\x7f\xff", 4), true, "Save Raw Clamp Test");
+
+    TestExpect(ImageToTGA(img, "output/test/writer_test.tga"), true, "Save TGA Test");
+    Texture2D tga = ParseTextureTGA("output/test/writer_test.tga");
+    std::uint32_t texel = tga.FetchRGBA8(799, 899 - 3);     // row 0 of textures is the bottom
+    std::uint32_t expect = 0;
+    memcpy(&expect, raw_data.data() + (3 * 800 + 799) * 4, 4);
+    TestExpect(tga.GetWidth(), (size_t)800, "Save TGA Width Test");
+    TestExpect(texel, expect, "Save TGA Texel Test");
+}
+
 int main() 
 {
     ppmTest();
     DrawLineTest();
     DrawCircleTest();
+    LayoutTest();
+    WriterTest();
     return 0;
 }
\ No newline at end of file
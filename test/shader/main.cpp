@@ -34,9 +34,331 @@ void TriangleTest()
     TestExpect(" ", " ", "Base Triangle Shader Test");
 }
 
+struct CountColor
+{
+    mutable size_t call_num = 0;
+    m_math::Vector<double, 4> GetColor(const Vertex<double> &vertex0, const Vertex<double> &vertex1, const Vertex<double> &vertex2,
+                                        const m_math::Vector<double, 3> &bc) const
+    {
+        call_num++;
+        return m_math::Vector<double, 4>({1, 0.5, 0.25, 1});
+    }
+};
+
+void AdaptiveAATest()
+{
+    Vertex<double> v0({20, 20, 10, 1}, {0, 0, 1}, {0, 0}, nullptr);
+    Vertex<double> v1({220, 40, 10, 1}, {0, 0, 1}, {1, 0}, nullptr);
+    Vertex<double> v2({90, 200, 10, 1}, {0, 0, 1}, {0, 1}, nullptr);
+
+    Image_RGBA_d ssaa_img(256, 256);
+    ZBuffer ssaa_zb = MakeZBuffer(ssaa_img);
+    CountColor ssaa_func;
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, ssaa_zb, ssaa_img, ssaa_func, 4, AntiAliasMode::kSSAA);
+
+    Image_RGBA_d adaptive_img(256, 256);
+    ZBuffer adaptive_zb = MakeZBuffer(adaptive_img);
+    CountColor adaptive_func;
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, adaptive_zb, adaptive_img, adaptive_func, 4, AntiAliasMode::kEdgeAdaptive);
+
+    bool same = true;
+    for (size_t y = 0; y < ssaa_img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < ssaa_img.GetWidth(); x++)
+        {
+            same = same && (ssaa_img.GetColor(x, y) == adaptive_img.GetColor(x, y));
+            same = same && m_math::IsEqual(ssaa_zb.GetColor(x, y), adaptive_zb.GetColor(x, y));
+        }
+    }
+    TestExpect(same, true, "Adaptive AA Same Result Test");
+    TestExpect(adaptive_func.call_num * 4 < ssaa_func.call_num, true, "Adaptive AA Less Shading Test");
+}
+
+void CoarseShadingTest()
+{
+    Vertex<double> v0({20, 20, 10, 1}, {0, 0, 1}, {0, 0}, nullptr);
+    Vertex<double> v1({220, 40, 10, 1}, {0, 0, 1}, {1, 0}, nullptr);
+    Vertex<double> v2({90, 200, 10, 1}, {0, 0, 1}, {0, 1}, nullptr);
+
+    Image_RGBA_d fine_img(256, 256);
+    ZBuffer fine_zb = MakeZBuffer(fine_img);
+    CountColor fine_func;
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, fine_zb, fine_img, fine_func);
+
+    Image_RGBA_d coarse_img(256, 256);
+    ZBuffer coarse_zb = MakeZBuffer(coarse_img);
+    CountColor coarse_func;
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, coarse_zb, coarse_img, coarse_func, 1, AntiAliasMode::kSSAA, 2);
+
+    bool same = true;
+    for (size_t y = 0; y < fine_img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < fine_img.GetWidth(); x++)
+        {
+            same = same && (fine_img.GetColor(x, y) == coarse_img.GetColor(x, y));
+        }
+    }
+    TestExpect(same, true, "Coarse Shading Same Coverage Test");
+    TestExpect(coarse_func.call_num * 3 < fine_func.call_num, true, "Coarse Shading Less Shading Test");
+
+    ShadingRateMap rate_map = MakeShadingRateMap(fine_img, 16);
+    TestExpect(rate_map.GetRate(0, 0), kMaxShadingRate, "Shading Rate Map Flat Tile Test");
+    TestExpect(rate_map.GetRate(20, 20), 1, "Shading Rate Map Edge Tile Test");
+}
+
+void PixelFormatTest()
+{
+    Vertex<double> v0({20, 20, 10, 1}, {0, 0, 1}, {0, 0}, nullptr);
+    Vertex<double> v1({220, 40, 10, 1}, {0, 0, 1}, {1, 0}, nullptr);
+    Vertex<double> v2({90, 200, 10, 1}, {0, 0, 1}, {0, 1}, nullptr);
+    CountColor color_func;
+
+    Image_RGBA_d ref_img(256, 256);
+    ZBuffer ref_zb = MakeZBuffer(ref_img);
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, ref_zb, ref_img, color_func, 2);
+
+    // shaders write compact formats directly, with the same coverage
+    Image_RGBA8 rgba8_img(256, 256);
+    Image<float> float_zb = MakeZBuffer<PixelRGBA8, float>(rgba8_img);
+    TriangleDrawFrame<PixelRGBA8, CountColor>(v0, v1, v2, float_zb, rgba8_img, color_func, 2);
+
+    Image_RGB565 rgb565_img(256, 256);
+    Image<Depth24> depth24_zb = MakeZBuffer<PixelRGB565, Depth24>(rgb565_img);
+    TriangleDrawFrame<PixelRGB565, CountColor>(v0, v1, v2, depth24_zb, rgb565_img, color_func, 2);
+
+    bool same = true;
+    for (size_t y = 0; y < ref_img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < ref_img.GetWidth(); x++)
+        {
+            PixelRGBA8 expect = PixelTraits<PixelRGBA8>::Pack(PixelTraits<ColorRGBA_d>::Unpack(ref_img.GetColor(x, y)));
+            PixelRGBA8 pixel = rgba8_img.GetColor(x, y);
+            same = same && pixel.r == expect.r && pixel.g == expect.g && pixel.b == expect.b && pixel.a == expect.a;
+            PixelRGB565 expect_565 = PixelTraits<PixelRGB565>::Pack(PixelTraits<ColorRGBA_d>::Unpack(ref_img.GetColor(x, y)));
+            same = same && rgb565_img.GetColor(x, y).value == expect_565.value;
+            same = same && float_zb.GetColor(x, y) == static_cast<float>(ref_zb.GetColor(x, y));
+        }
+    }
+    TestExpect(same, true, "Pixel Format Same Result Test");
+    TestExpect((sizeof(PixelRGBA8) + sizeof(float)) * 4 < sizeof(ColorRGBA_d) + sizeof(double), true, "Pixel Format Memory Test");
+
+    PixelRGB565 white = PixelTraits<PixelRGB565>::Pack(m_math::Vector<double, 4>({1, 1, 1, 1}));
+    TestExpect((int)white.value, 0xffff, "Pixel Format RGB565 Pack Test");
+
+    PixelRGBA8 blend_pixel = PixelTraits<PixelRGBA8>::Pack(m_math::Vector<double, 4>({0, 0, 1, 1}));
+    BlendPixel(blend_pixel, m_math::Vector<double, 4>({1, 0, 0, 0.5}));
+    TestExpect((int)blend_pixel.r, 128, "Pixel Format Blend Test");
+    TestExpect((int)blend_pixel.g, 0, "Pixel Format Blend Green Test");
+    TestExpect((int)blend_pixel.b, 128, "Pixel Format Blend Blue Test");
+    TestExpect((int)blend_pixel.a, 255, "Pixel Format Blend Alpha Test");
+
+    // quantized depth keeps the order and never moves a depth nearer
+    bool ordered = true;
+    double last = -1e30;
+    for (double z = -1000.0; z <= 1000.0; z += 0.37)
+    {
+        double depth16 = DepthTraits<Depth16>::Decode(DepthTraits<Depth16>::Encode(z));
+        double depth24 = DepthTraits<Depth24>::Decode(DepthTraits<Depth24>::Encode(z));
+        ordered = ordered && depth16 <= z && depth24 <= z && depth24 >= depth16 && depth16 >= last;
+        ordered = ordered && std::abs(depth24 - z) <= std::abs(z) * 1e-4 + 1e-30;
+        last = depth16;
+    }
+    TestExpect(ordered, true, "Pixel Format Depth Order Test");
+}
+
+void AsyncOutputTest()
+{
+    std::vector<Vertex<double>> triangle = {Vertex<double>({10, 10, 0, 1}, {0, 0, 1}, {0, 0}, nullptr),
+                                            Vertex<double>({50, 14, 0, 1}, {0, 0, 1}, {1, 0}, nullptr),
+                                            Vertex<double>({20, 50, 0, 1}, {0, 0, 1}, {0, 1}, nullptr)};
+    Scene scene;
+    scene.meshes.emplace_back(new Mesh(triangle));
+    Camera camera;
+    camera.transform_origin.scal = m_math::Vector3d({1, 1, 1});
+
+    Image_RGBA_d img(64, 64);
+    CameraRender<ColorRGBA_d> render(&img, &camera);
+    render.SetShader(std::make_shared<FlatShader<double, ColorRGBA_d>>(ColorRGBA_d(1, 0, 0, 1)));
+    render.UpdateFromScene(scene);
+
+    // frames are written in order on the writer thread, each one from its own camera pose
+    const size_t frame_num = 4;
+    std::vector<size_t> order;
+    std::vector<size_t> coverage(frame_num, 0);
+    std::vector<size_t> left(frame_num, 0);
+    render.SetFrameOutput(2, [&](const Image_RGBA_d &frame, size_t index)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        left[index] = frame.GetWidth();
+        for (size_t y = 0; y < frame.GetHeight(); y++)
+        {
+            for (size_t x = 0; x < frame.GetWidth(); x++)
+            {
+                if (frame.GetColor(x, y)[0] > 0.5)
+                {
+                    coverage[index]++;
+                    left[index] = std::min(left[index], x);
+                }
+            }
+        }
+        order.push_back(index);
+    });
+    for (size_t i = 0; i < frame_num; i++)
+    {
+        camera.transform_origin.trans = m_math::Vector3d({-4.0 * i, 0, 0});
+        render.RenderAsync();
+    }
+    render.FlushFrames();
+    TestExpect(order == std::vector<size_t>({0, 1, 2, 3}), true, "Async Output Order Test");
+    TestExpect(left[0], (size_t)10, "Async Output Frame Test");
+    TestExpect(left[3], (size_t)22, "Async Output Last Frame Test");
+    TestExpect(coverage[3], coverage[0], "Async Output Coverage Test");
+
+    render.Render();
+    size_t img_coverage = 0;
+    for (size_t y = 0; y < img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < img.GetWidth(); x++)
+        {
+            img_coverage += img.GetColor(x, y)[0] > 0.5 ? 1 : 0;
+        }
+    }
+    TestExpect(img_coverage, coverage[3], "Async Output Same As Render Test");
+
+    // writing overlaps rendering: frame 0 is written while frame 1 renders, and at most 2 frames are in flight
+    const size_t overlap_num = 6;
+    std::atomic<int> in_flight(0);
+    std::atomic<int> max_in_flight(0);
+    double render_end = 0;     // of frame 1
+    double write_start = 0;    // of frame 0
+    std::mutex mutex;
+    std::condition_variable started;
+    bool frame1_started = false;
+    bool overlapped = false;
+    AsyncFrameWriter<ColorRGBA_d> * writer = new AsyncFrameWriter<ColorRGBA_d>(8, 8, 2, [&](const Image_RGBA_d &, size_t index)
+    {
+        if (index == 0)
+        {
+            write_start = NowTime(2);
+            // waits with a timeout, so a writer blocking the renderer fails the test instead of hanging it
+            std::unique_lock<std::mutex> lock(mutex);
+            overlapped = started.wait_for(lock, std::chrono::seconds(5), [&]() { return frame1_started; });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        in_flight--;
+    });
+    double ts = NowTime(1);
+    for (size_t i = 0; i < overlap_num; i++)
+    {
+        Image_RGBA_d * frame = writer->AcquireFrame();
+        max_in_flight = std::max(max_in_flight.load(), ++in_flight);
+        if (i == 1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                frame1_started = true;
+            }
+            started.notify_all();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (i == 1)
+        {
+            render_end = NowTime(2);
+        }
+        writer->SubmitFrame(frame);
+    }
+    delete writer;
+    double te = NowTime(1);
+    std::cout << "render 6 x 20 ms and write 6 x 20 ms frames: using " << te - ts << " ms\n";
+    TestExpect(overlapped, true, "Async Output Overlap Test");
+    TestExpect(write_start < render_end, true, "Async Output Write Start Test");
+    TestExpect(max_in_flight.load(), 2, "Async Output In Flight Test");
+}
+
+void ClearTest()
+{
+    Vertex<double> v0({20, 20, 10, 1}, {0, 0, 1}, {0, 0}, nullptr);
+    Vertex<double> v1({220, 40, 10, 1}, {0, 0, 1}, {1, 0}, nullptr);
+    Vertex<double> v2({90, 200, 10, 1}, {0, 0, 1}, {0, 1}, nullptr);
+    Vertex<double> v0_far({20, 20, 5, 1}, {0, 0, 1}, {0, 0}, nullptr);
+    CountColor color_func;
+
+    // the generation z-buffer draws the same as a plain one, and a clear lets farther triangles pass again
+    Image_RGBA_d ref_img(256, 256);
+    ZBuffer ref_zb = MakeZBuffer(ref_img);
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, ref_zb, ref_img, color_func, 2);
+
+    Image_RGBA_d gen_img(256, 256);
+    GenerationZBuffer<float> gen_zb(256, 256);
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0, v1, v2, gen_zb, gen_img, color_func, 2);
+    bool same = true;
+    for (size_t y = 0; y < ref_img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < ref_img.GetWidth(); x++)
+        {
+            same = same && ref_img.GetColor(x, y) == gen_img.GetColor(x, y);
+            same = same && static_cast<float>(ref_zb.GetColor(x, y)) == static_cast<float>(LoadDepth(gen_zb, x, y));
+        }
+    }
+    TestExpect(same, true, "Generation Z-Buffer Same Result Test");
+
+    size_t call_num = color_func.call_num;
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0_far, v1, v2, gen_zb, gen_img, color_func);
+    TestExpect(color_func.call_num, call_num, "Generation Z-Buffer Depth Test");
+    gen_zb.Clear();
+    TriangleDrawFrame<ColorRGBA_d, CountColor>(v0_far, v1, v2, gen_zb, gen_img, color_func);
+    TestExpect(color_func.call_num > call_num, true, "Generation Z-Buffer Clear Test");
+    TestExpect(LoadDepth(gen_zb, 0, 255), -std::numeric_limits<double>::max(), "Generation Z-Buffer Clear Depth Test");
+
+    // clears reuse memory
+    const double * zb_data = ref_zb.Data();
+    ResetZBuffer(ref_zb, 256, 256, -1.0);
+    TestExpect(ref_zb.Data() == zb_data, true, "Z-Buffer Reset Reuse Test");
+    TestExpect(ref_zb.GetColor(100, 100), -1.0, "Z-Buffer Reset Value Test");
+
+    Image_RGBA_d frame(800, 900);
+    double ts = NowTime(2);
+    frame = Image_RGBA_d(800, 900);
+    double te = NowTime(2);
+    std::cout << "clear 800x900 frame by reallocating: using " << te - ts << " us\n";
+    const ColorRGBA_d * frame_data = frame.Data();
+    ts = NowTime(2);
+    ClearImage(frame, ColorRGBA_d(0, 0, 0, 1));
+    te = NowTime(2);
+    std::cout << "clear 800x900 frame by ClearImage: using " << te - ts << " us\n";
+    TestExpect(frame.Data() == frame_data, true, "Clear Image Test");
+    TestExpect(frame.GetColor(799, 899)[3], 1.0, "Clear Image Last Pixel Test");
+    TestExpect(frame.GetColor(0, 450)[3], 1.0, "Clear Image Row Test");
+
+    // camera renders of successive frames do not keep the last frame
+    std::vector<Vertex<double>> triangle = {Vertex<double>({10, 10, 0, 1}, {0, 0, 1}, {0, 0}, nullptr),
+                                            Vertex<double>({50, 14, 0, 1}, {0, 0, 1}, {1, 0}, nullptr),
+                                            Vertex<double>({20, 50, 0, 1}, {0, 0, 1}, {0, 1}, nullptr)};
+    Scene scene;
+    scene.meshes.emplace_back(new Mesh(triangle));
+    Camera camera;
+    camera.transform_origin.scal = m_math::Vector3d({1, 1, 1});
+    Image_RGBA_d img(64, 64);
+    CameraRender<ColorRGBA_d, GenerationDepth<float>> render(&img, &camera);
+    render.SetShader(std::make_shared<FlatShader<double, ColorRGBA_d, GenerationDepth<float>>>(ColorRGBA_d(1, 0, 0, 1)));
+    render.UpdateFromScene(scene);
+    render.Render();
+    const ColorRGBA_d * img_data = img.Data();
+    camera.transform_origin.trans = m_math::Vector3d({-8, 0, 0});
+    render.Clear();
+    render.Render();
+    TestExpect(img.Data() == img_data, true, "Camera Clear Test");
+    TestExpect(img.GetColor(10, 10)[0], 0.0, "Camera Clear Old Frame Test");
+    TestExpect(img.GetColor(18, 10)[0], 1.0, "Camera Clear New Frame Test");
+}
 
 int main() 
 {
     TriangleTest();
+    AdaptiveAATest();
+    CoarseShadingTest();
+    PixelFormatTest();
+    AsyncOutputTest();
+    ClearTest();
     return 0;
 }
\ No newline at end of file
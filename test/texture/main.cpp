@@ -12,8 +12,450 @@ void tgaImageTest(std::string tga_filename)
     file.close();
 }
 
+void parseTextureTest(std::string tga_filename)
+{
+    TGAImage tga;
+    tga.read_tga_file(tga_filename);
+    tga.flip_vertically();
+
+    Texture2D tex = ParseTextureTGA(tga_filename);
+    TestExpect(tex.GetWidth(), (size_t)tga.width(), "Parse Texture Width Test");
+    TestExpect(tex.GetHeight(), (size_t)tga.height(), "Parse Texture Height Test");
+    TestExpect(tex.ByteSize(), (size_t)(tga.width() * tga.height() * 4), "Parse Texture RGBA8 Size Test");
+
+    TGAColor pixel = tga.get(7, 11);
+    std::array<double, 4> texel = tex.Fetch(7, 11);
+    TestExpect(texel[0], pixel[2] / 255.0, "Parse Texture Texel R Test");
+    TestExpect(texel[2], pixel[0] / 255.0, "Parse Texture Texel B Test");
+}
+
+void tgaDecodeTest(std::string tga_filename)
+{
+    // same texels from raw bottom-up and RLE top-down files
+    TGAImage tga;
+    tga.read_tga_file(tga_filename);
+    tga.write_tga_file("output/test/tga_rle_test.tga", false, true);
+    Texture2D raw_tex = ParseTextureTGA(tga_filename);
+    Texture2D rle_tex = ParseTextureTGA("output/test/tga_rle_test.tga");
+    bool same = raw_tex.ByteSize() == rle_tex.ByteSize();
+    for (size_t y = 0; same && y < raw_tex.GetHeight(); y++)
+    {
+        same = memcmp(raw_tex.Row(y), rle_tex.Row(y), raw_tex.GetWidth() * 4) == 0;
+    }
+    TestExpect(same, true, "TGA RLE Decode Test");
+
+    TGAImage rgb_tga(5, 3, TGAImage::RGB);
+    TGAColor color;
+    color.bgra[0] = 10;
+    color.bgra[1] = 20;
+    color.bgra[2] = 30;
+    for (int x = 0; x < 5; x++)
+    {
+        rgb_tga.set(x, 0, color);
+    }
+    rgb_tga.write_tga_file("output/test/tga_rgb_test.tga", true, true);
+    Texture2D rgb_tex = ParseTextureTGA("output/test/tga_rgb_test.tga");
+    TestExpect(rgb_tex.FetchRGBA8(4, 0), 0xff0a141eu, "TGA RGB Decode Test");
+    TestExpect(rgb_tex.FetchRGBA8(4, 1), 0xff000000u, "TGA RGB Alpha Test");
+
+    std::vector<std::uint8_t> bytes;
+    ReadFileBytes("output/test/tga_rgb_test.tga", bytes);
+    TestExpect(DecodeTGA(bytes.data(), 21).Empty(), true, "TGA Truncated Test");
+
+    double ts = NowTime(2);
+    TGAImage old_tga;
+    old_tga.read_tga_file("output/test/tga_rle_test.tga");
+    Texture2D old_tex(old_tga.width(), old_tga.height());
+    for (int y = 0; y < old_tga.height(); y++)
+    {
+        for (int x = 0; x < old_tga.width(); x++)
+        {
+            TGAColor pixel = old_tga.get(x, y);
+            old_tex.Store<double>(x, y, {pixel[2] / 255.0, pixel[1] / 255.0, pixel[0] / 255.0, pixel[3] / 255.0});
+        }
+    }
+    double te = NowTime(2);
+    std::cout << "decode RLE TGA by TGAImage: using " << te - ts << " us\n";
+    ts = NowTime(2);
+    ParseTextureTGA("output/test/tga_rle_test.tga");
+    te = NowTime(2);
+    std::cout << "decode RLE TGA by DecodeTGA: using " << te - ts << " us\n";
+}
+
+void mipmapTest(std::string tga_filename)
+{
+    Texture2D tex = ParseTextureTGA(tga_filename);
+    size_t base_bytes = tex.ByteSize();
+    tex.GenerateMips(4);
+    TestExpect(tex.GetWidth(tex.GetLevelNum() - 1) * tex.GetHeight(tex.GetLevelNum() - 1), (size_t)1, "Mipmap Last Level 1x1 Test");
+    TestExpect(tex.ByteSize() < base_bytes * 4 / 3 + 64 * tex.GetLevelNum(), true, "Mipmap Memory Test");
+
+    Texture2D checker(4, 4);
+    for (size_t y = 0; y < 4; y++)
+    {
+        for (size_t x = 0; x < 4; x++)
+        {
+            double c = (x + y) % 2;
+            checker.Store(x, y, std::array<double, 4>({c, c, c, 1}));
+        }
+    }
+    checker.GenerateMips();
+    TestExpect(checker.GetLevelNum(), (size_t)3, "Mipmap Level Num Test");
+    TestExpect(checker.Fetch(0, 0, 2)[0], 128 / 255.0, "Mipmap Box Filter Test");
+    TestExpect(std::lround(texture::Sampler(&checker).Sample(0.5, 0.5, 2.0)[0] * 255), 128l, "Mipmap Sample Far Test");
+    TestExpect(texture::Lod(&checker, {0.5, 0, 0, 0.5}), 1.0, "Mipmap Lod Test");
+}
+
+void layoutTest(std::string tga_filename)
+{
+    Texture2D linear_tex = ParseTextureTGA(tga_filename);
+    linear_tex.GenerateMips();
+    Texture2D tiled_tex = linear_tex;
+    tiled_tex.Relayout(TextureLayout::kTiled);
+    Texture2D morton_tex = linear_tex;
+    morton_tex.Relayout(TextureLayout::kMorton);
+
+    bool same = true;
+    for (size_t level = 0; level < linear_tex.GetLevelNum(); level++)
+    {
+        for (size_t y = 0; y < linear_tex.GetHeight(level); y += 3)
+        {
+            for (size_t x = 0; x < linear_tex.GetWidth(level); x += 5)
+            {
+                same = same && (linear_tex.Fetch(x, y, level) == tiled_tex.Fetch(x, y, level));
+                same = same && (linear_tex.Fetch(x, y, level) == morton_tex.Fetch(x, y, level));
+            }
+        }
+    }
+    TestExpect(same, true, "Texture Layout Same Texel Test");
+
+    // samples along rotated lines, like a rotated view of a textured model
+    const Texture2D * tex_list[3] = {&linear_tex, &tiled_tex, &morton_tex};
+    const char * name_list[3] = {"linear", "tiled", "morton"};
+    for (size_t i = 0; i < 3; i++)
+    {
+        double ts = NowTime(2);
+        m_math::Vector<double, 4> sum;
+        for (size_t line = 0; line < 512; line++)
+        {
+            for (size_t step = 0; step < 512; step++)
+            {
+                double u = (line * 0.7071 + step * 0.7071) / 1024.0;
+                double v = (step * 0.7071 - line * 0.7071) / 1024.0 + 0.5;
+                sum += texture::Sampler(tex_list[i]).Sample(u, v);
+            }
+        }
+        std::cout << "sample rotated " << name_list[i] << " texture: using " << NowTime(2) - ts << " us, sum " << sum[0] << "\n";
+    }
+}
+
+void samplerTest()
+{
+    Texture2D tex(4, 2);
+    for (size_t y = 0; y < 2; y++)
+    {
+        for (size_t x = 0; x < 4; x++)
+        {
+            tex.Store(x, y, std::array<double, 4>({x / 3.0, y * 1.0, 0, 1}));
+        }
+    }
+    texture::Sampler sampler(&tex, MipFilter::kNone);
+
+    // texel centers are at (x + 0.5) / width
+    auto to_byte = [](double value) { return std::lround(value * 255); };
+    TestExpect(to_byte(sampler.Sample(1.5 / 4, 0.25)[0]), 85l, "Sampler Texel Center Test");
+    TestExpect(to_byte(sampler.Sample(2.0 / 4, 0.25)[0]), 127l, "Sampler Bilinear Test");
+
+    tex.SetWrapMode(WrapMode::kRepeat, WrapMode::kClamp);
+    TestExpect(to_byte(sampler.Sample(-0.5 / 4, 0.25)[0]), 255l, "Sampler Repeat Test");
+    TestExpect(to_byte(sampler.Sample(0.25, 2.0)[1]), 255l, "Sampler Clamp Test");
+    tex.SetWrapMode(WrapMode::kMirror, WrapMode::kClamp);
+    TestExpect(to_byte(sampler.Sample(-0.5 / 4, 0.25)[0]), 0l, "Sampler Mirror Test");
+
+    // far texture coordinates are reduced into the wrap period before the fixed point conversion
+    tex.SetWrapMode(WrapMode::kRepeat, WrapMode::kClamp);
+    TestExpect(to_byte(sampler.Sample(1e9 + 1.5 / 4, 0.25)[0]), 85l, "Sampler Far Repeat Test");
+    TestExpect(to_byte(sampler.Sample(-1e12 + 1.5 / 4, -1e12)[0]), 85l, "Sampler Far Clamp Test");
+}
+
+void compressTest(std::string tga_filename)
+{
+    // endpoints exact in RGB565 decode without error
+    Texture2D two_color(4, 4);
+    for (size_t i = 0; i < 16; i++)
+    {
+        double c = (i % 3 == 0) ? 1.0 : 0.0;
+        two_color.Store(i % 4, i / 4, std::array<double, 4>({c, 0, 1 - c, c}));
+    }
+    Texture2D two_color_bc1 = two_color.Compress(TexelFormat::kBC1);
+    Texture2D two_color_bc3 = two_color.Compress(TexelFormat::kBC3);
+    TestExpect(two_color_bc1.ByteSize(), (size_t)8, "Compress BC1 Block Size Test");
+    TestExpect(two_color_bc1.Fetch(1, 0) == std::array<double, 4>({0, 0, 0, 0}), true, "Compress BC1 Transparent Test");
+    TestExpect(two_color_bc1.Fetch(3, 0) == two_color.Fetch(3, 0), true, "Compress BC1 Endpoint Test");
+    bool same = true;
+    for (size_t i = 0; i < 16; i++)
+    {
+        same = same && (two_color_bc3.Fetch(i % 4, i / 4) == two_color.Fetch(i % 4, i / 4));
+    }
+    TestExpect(same, true, "Compress BC3 Endpoint Test");
+
+    Texture2D tex = ParseTextureTGA(tga_filename);
+    tex.GenerateMips();
+    Texture2D bc1_tex = tex.Compress(TexelFormat::kBC1, 4);
+    Texture2D bc3_tex = tex.Compress(TexelFormat::kBC3, 4);
+    TestExpect(bc1_tex.GetLevelNum(), tex.GetLevelNum(), "Compress Mip Level Num Test");
+    TestExpect(bc1_tex.ByteSize() * 6 < tex.ByteSize(), true, "Compress BC1 Memory Test");
+    TestExpect(bc3_tex.ByteSize() * 3 < tex.ByteSize(), true, "Compress BC3 Memory Test");
+
+    double error = 0;
+    size_t count = 0;
+    for (size_t y = 0; y < tex.GetHeight(); y += 3)
+    {
+        for (size_t x = 0; x < tex.GetWidth(); x += 3)
+        {
+            std::array<double, 4> texel = tex.Fetch(x, y);
+            std::array<double, 4> bc_texel = bc3_tex.Fetch(x, y);
+            for (size_t c = 0; c < 4; c++)
+            {
+                error += std::abs(texel[c] - bc_texel[c]);
+            }
+            count += 4;
+        }
+    }
+    std::cout << "BC3 mean abs error: " << error / count * 255 << " / 255\n";
+    TestExpect(error / count < 8 / 255.0, true, "Compress BC3 Error Test");
+
+    texture::Sampler sampler(&tex);
+    texture::Sampler bc_sampler(&bc3_tex);
+    std::array<float, 4> rgba = sampler.SampleRGBA(0.3, 0.7, 1.5);
+    std::array<float, 4> bc_rgba = bc_sampler.SampleRGBA(0.3, 0.7, 1.5);
+    TestExpect(std::abs(rgba[0] - bc_rgba[0]) < 0.1f, true, "Compress Sample Test");
+}
+
+void cacheFileTest(std::string tga_filename)
+{
+    std::string cache_path = TextureCachePath("output/test", tga_filename);
+    std::remove(cache_path.c_str());
+    double ts = NowTime(2);
+    Texture2D decoded = LoadTextureFile(tga_filename, TextureLayout::kTiled, TexelFormat::kRGBA8, "output/test");
+    double te = NowTime(2);
+    std::cout << "load texture by decoding: using " << te - ts << " us\n";
+    ts = NowTime(2);
+    Texture2D mapped = LoadTextureFile(tga_filename, TextureLayout::kTiled, TexelFormat::kRGBA8, "output/test");
+    te = NowTime(2);
+    std::cout << "load texture from cache file: using " << te - ts << " us\n";
+
+    TestExpect(mapped.GetLevelNum(), decoded.GetLevelNum(), "Cache File Levels Test");
+    TestExpect(mapped.GetLayout() == TextureLayout::kTiled, true, "Cache File Layout Test");
+    TestExpect(mapped.ByteSize(), decoded.ByteSize(), "Cache File Byte Size Test");
+    TestExpect(mapped.ByteSize() == decoded.ByteSize() && memcmp(mapped.Data(), decoded.Data(), mapped.ByteSize()) == 0, true,
+               "Cache File Data Test");
+    TestExpect(mapped.Data() != decoded.Data(), true, "Cache File Mapped Test");
+
+    TextureCacheKey key;
+    MakeTextureCacheKey(tga_filename, TexelFormat::kRGBA8, TextureLayout::kTiled, key);
+    TestExpect(ReadTextureCache(cache_path, key).Empty(), false, "Cache File Key Hit Test");
+    key.source_mtime++;
+    TestExpect(ReadTextureCache(cache_path, key).Empty(), true, "Cache File Stale Test");
+    key.source_mtime--;
+    key.format = TexelFormat::kBC1;
+    TestExpect(ReadTextureCache(cache_path, key).Empty(), true, "Cache File Format Test");
+    key.format = TexelFormat::kRGBA8;
+
+    // concurrent writers of the same cache use their own temporary files
+    std::vector<char> written(4, 0);
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < written.size(); i++)
+    {
+        writers.emplace_back([&, i]()
+        {
+            written[i] = WriteTextureCache(cache_path, key, decoded) ? 1 : 0;
+        });
+    }
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+    TestExpect(std::count(written.begin(), written.end(), 1), (std::ptrdiff_t)written.size(), "Cache File Concurrent Write Test");
+    TestExpect(ReadTextureCache(cache_path, key).Empty(), false, "Cache File Concurrent Read Test");
+    size_t temp_num = 0;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator("output/test"))
+    {
+        std::string name = entry.path().string();
+        temp_num += name.compare(0, cache_path.size(), cache_path) == 0 && name.size() > cache_path.size() ? 1 : 0;
+    }
+    TestExpect(temp_num, (size_t)0, "Cache File Temporary Test");
+}
+
+Texture2D FilledTexture(size_t width, size_t height, std::uint8_t value)
+{
+    Texture2D tex(width, height);
+    for (size_t y = 0; y < height; y++)
+    {
+        memset(tex.Row(y), value, width * 4);
+    }
+    return tex;
+}
+
+void poolTest()
+{
+    std::shared_ptr<TexturePool<double, 4>> pool(new TexturePool<double, 4>());
+    size_t load_count = 0;
+    pool->SetLoader([&load_count](const std::string &source)
+    {
+        load_count++;
+        return FilledTexture(16, 16, source[0]);
+    });
+
+    TextureHandle a = pool->Insert("a", FilledTexture(16, 16, 'a'), "a.tga");
+    TextureHandle b = pool->Insert("b", FilledTexture(16, 16, 'b'), "b.tga");
+    TextureHandle c = pool->Insert("c", FilledTexture(16, 16, 'c'));
+    TestExpect(pool->Find("b").index, b.index, "Pool Find Test");
+    TestExpect(pool->ByteSize(), (size_t)(16 * 16 * 4 * 3), "Pool Byte Size Test");
+
+    // over budget: the least recently used texture with a source is evicted, textures without source are kept
+    pool->Acquire(a);
+    pool->SetByteBudget(16 * 16 * 4 * 2);
+    TestExpect(pool->Resident(a), true, "Pool LRU Keep Test");
+    TestExpect(pool->Resident(b), false, "Pool LRU Evict Test");
+    TestExpect(pool->Resident(c), true, "Pool No Source Keep Test");
+    TestExpect(pool->Acquire(b) != nullptr, true, "Pool Reload Test");
+    TestExpect(load_count, (size_t)1, "Pool Reload Count Test");
+    TestExpect(pool->Resident(a), false, "Pool Reload Evict Test");
+
+    // references delete the texture when the last one is released, stale handles are rejected
+    {
+        TextureRef ref_1(pool, c);
+        TextureRef ref_2 = ref_1;
+        TestExpect(pool->RefCount(c), (size_t)2, "Pool Ref Count Test");
+    }
+    TestExpect(pool->Acquire(c) == nullptr, true, "Pool Release Test");
+    TextureHandle d = pool->Insert("d", Texture2D(1, 1));
+    TestExpect(d.index, c.index, "Pool Slot Reuse Test");
+    TestExpect(d.generation != c.generation, true, "Pool Slot Generation Test");
+    pool->Insert("e", Texture2D(1, 1));
+    TestExpect(pool->Insert("f", Texture2D(1, 1)).Valid(), false, "Pool Capacity Test");
+    TestExpect(pool->DeleteTexture("e"), true, "Pool Delete Test");
+    TestExpect(pool->GetTexture("e") == nullptr, true, "Pool Deleted Get Test");
+    TestExpect(pool->Size(), (size_t)3, "Pool Size Test");
+}
+
+void dedupTest()
+{
+    std::shared_ptr<TexturePool<double, 4>> pool(new TexturePool<double, 4>());
+    pool->SetLoader([](const std::string &source)
+    {
+        return FilledTexture(16, 16, 7);
+    });
+
+    // same content under different names shares one storage, counted once
+    TextureHandle a = pool->Insert("a", FilledTexture(16, 16, 7), "a.tga");
+    TextureHandle b = pool->Insert("b", FilledTexture(16, 16, 7), "b.tga");
+    TextureHandle c = pool->Insert("c", FilledTexture(16, 16, 9));
+    const size_t bytes = 16 * 16 * 4;
+    TestExpect(pool->Acquire(a)->Data() == pool->Acquire(b)->Data(), true, "Dedup Share Test");
+    TestExpect(pool->Acquire(a)->Data() != pool->Acquire(c)->Data(), true, "Dedup Different Test");
+    TestExpect(pool->ByteSize(), bytes * 2, "Dedup Byte Size Test");
+    TestExpect(pool->DedupSavedBytes(), bytes, "Dedup Saved Bytes Test");
+
+    // the storage stays resident while any copy is resident
+    pool->Delete(a);
+    TestExpect(pool->ByteSize(), bytes * 2, "Dedup Delete Test");
+    TestExpect(pool->DedupSavedBytes(), (size_t)0, "Dedup Delete Saved Bytes Test");
+    pool->Delete(b);
+    TestExpect(pool->ByteSize(), bytes, "Dedup Delete Last Test");
+
+    // a reloaded texture shares the storage of a resident copy
+    TextureHandle d = pool->Register("d", "d.tga");
+    TextureHandle e = pool->Register("e", "e.tga");
+    pool->Preload({d, e});
+    TestExpect(pool->Acquire(d) == pool->Acquire(e), true, "Dedup Load Test");
+    TestExpect(pool->DedupSavedBytes(), bytes, "Dedup Load Saved Bytes Test");
+
+    Texture2D mirrored = FilledTexture(16, 16, 7);
+    mirrored.SetWrapMode(WrapMode::kMirror, WrapMode::kMirror);
+    TestExpect(mirrored.SameContent(FilledTexture(16, 16, 7)), false, "Dedup Wrap Mode Test");
+}
+
+void lazyLoadTest()
+{
+    std::shared_ptr<TexturePool<double, 4>> pool(new TexturePool<double, 4>());
+    std::atomic<size_t> load_count(0);
+    pool->SetLoader([&load_count](const std::string &source)
+    {
+        load_count++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (source == "throw.tga")
+        {
+            throw std::runtime_error("decode failed");
+        }
+        return source == "bad.tga" ? Texture2D() : Texture2D(8, 8);
+    });
+
+    TextureRef ref(pool, pool->Register("a", "a.tga"));
+    TextureRef bad_ref(pool, pool->Register("bad", "bad.tga"));
+    TestExpect(load_count.load(), (size_t)0, "Lazy Load Register Test");
+    TestExpect(pool->Resident(ref.GetHandle()), false, "Lazy Load Register Resident Test");
+
+    std::vector<std::shared_ptr<const Texture2D>> results(8);
+    ParallelFor(0, results.size(), [&](size_t i)
+    {
+        results[i] = ref.Acquire();
+    }, results.size());
+    size_t same_num = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        same_num += results[i] != nullptr && results[i] == results[0] ? 1 : 0;
+    }
+    TestExpect(same_num, results.size(), "Lazy Load Same Test");
+    TestExpect(load_count.load(), (size_t)1, "Lazy Load Once Test");
+    TestExpect(bad_ref.Acquire() == nullptr, true, "Lazy Load Failed Test");
+    TestExpect(bad_ref.Acquire() == nullptr, true, "Lazy Load Failed Again Test");
+    TestExpect(load_count.load(), (size_t)2, "Lazy Load Failed Count Test");
+
+    // a throwing loader fails the texture instead of leaving other threads waiting for it
+    TextureHandle throw_handle = pool->Register("throw", "throw.tga");
+    std::atomic<size_t> throw_num(0);
+    std::atomic<size_t> null_num(0);
+    ParallelFor(0, 4, [&](size_t)
+    {
+        try
+        {
+            null_num += pool->Acquire(throw_handle) == nullptr;
+        }
+        catch (const std::runtime_error &)
+        {
+            throw_num++;
+        }
+    }, 4);
+    TestExpect(throw_num.load(), (size_t)1, "Lazy Load Throw Test");
+    TestExpect(null_num.load(), (size_t)3, "Lazy Load Throw Waiter Test");
+    TestExpect(pool->Acquire(throw_handle) == nullptr, true, "Lazy Load Throw Failed Test");
+    TestExpect(load_count.load(), (size_t)3, "Lazy Load Throw Count Test");
+    pool->Delete(throw_handle);
+    TestExpect(pool->Insert("empty", Texture2D()).Valid(), false, "Pool Insert Empty Test");
+
+    // preload decodes each texture once on several threads
+    TextureHandle b = pool->Register("b", "b.tga");
+    TextureHandle c = pool->Register("c", "c.tga");
+    pool->Preload({b, c, b, ref.GetHandle(), c}, 4);
+    TestExpect(load_count.load(), (size_t)5, "Preload Dedup Test");
+    TestExpect(pool->Resident(b), true, "Preload Resident Test");
+    TestExpect(pool->Resident(c), true, "Preload Resident Second Test");
+}
+
 int main()
 {
     tgaImageTest("../model/cubic/keqing.tga");
+    parseTextureTest("../model/cubic/keqing.tga");
+    tgaDecodeTest("../model/cubic/keqing.tga");
+    mipmapTest("../model/cubic/keqing.tga");
+    layoutTest("../model/cubic/keqing.tga");
+    samplerTest();
+    compressTest("../model/cubic/keqing.tga");
+    cacheFileTest("../model/cubic/keqing.tga");
+    poolTest();
+    dedupTest();
+    lazyLoadTest();
     return 0;
 }
\ No newline at end of file
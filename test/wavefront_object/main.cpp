@@ -1,4 +1,5 @@
 
+#include <set>
 #include "../test.h"
 
 using namespace mistery_render;
@@ -33,6 +34,912 @@ void test_obj()
 
 }
 
+/**
+ * @brief Whether the fast parser got the same mesh data as tinyobj
+ */
+bool SameObjData(const tinyobj::ObjReader &reader, const ObjMeshData &data)
+{
+    const tinyobj::attrib_t &a = reader.GetAttrib();
+    if (a.vertices != data.attrib.vertices || a.normals != data.attrib.normals || a.texcoords != data.attrib.texcoords)
+    {
+        return false;
+    }
+    if (reader.GetShapes().size() != data.shapes.size() || reader.GetMaterials().size() != data.materials.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < data.shapes.size(); i++)
+    {
+        const tinyobj::mesh_t &m0 = reader.GetShapes()[i].mesh;
+        const tinyobj::mesh_t &m1 = data.shapes[i].mesh;
+        if (reader.GetShapes()[i].name != data.shapes[i].name || m0.indices.size() != m1.indices.size() ||
+            m0.material_ids != m1.material_ids || m0.smoothing_group_ids != m1.smoothing_group_ids ||
+            m0.num_face_vertices != m1.num_face_vertices)
+        {
+            return false;
+        }
+        for (size_t j = 0; j < m0.indices.size(); j++)
+        {
+            if (m0.indices[j].vertex_index != m1.indices[j].vertex_index ||
+                m0.indices[j].normal_index != m1.indices[j].normal_index ||
+                m0.indices[j].texcoord_index != m1.indices[j].texcoord_index)
+            {
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < data.materials.size(); i++)
+    {
+        if (reader.GetMaterials()[i].name != data.materials[i].name ||
+            reader.GetMaterials()[i].diffuse_texname != data.materials[i].diffuse_texname)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_obj_fast()
+{
+    tinyobj::ObjReaderConfig config;
+    config.triangulate = true;
+
+    // a generated file of several chunks: quads, relative indices, groups, materials and odd floats
+    std::ofstream gen_file("output/test/fast_parser_test.obj");
+    gen_file << "mtllib ../../../model/cubic/cubic.mtl\n";
+    for (int i = 0; i < 40000; i++)
+    {
+        if (i % 5000 == 0)
+        {
+            gen_file << (i % 10000 == 0 ? "o part_" : "g group a ") << i << "\n";
+            gen_file << (i % 15000 == 0 ? "usemtl Material\n" : "usemtl Unknown\n") << "s " << (i % 2) << "\n";
+        }
+        gen_file << "v " << i * 0.001 << " -" << i << ".5e-3 +1.25E2\r\n";
+        gen_file << "v " << i << " 0.000000 " << 1.0 / (i + 1) << "\n";
+        gen_file << "v " << -i * 1e-7 << " 1e30 12345678901234567890\n";
+        gen_file << "v 0 0 " << i << "\nv 1 0 " << i << "\nv 1 1 " << i << "\nv 0 1 " << i << "\n";
+        gen_file << "vt 0." << i << " 1\n\tvn 0 0 1\n";
+        gen_file << "f -4/-1/-1 -3/-1/-1 -2/-1/-1 -1/-1/-1\n";
+        gen_file << "f " << i * 7 + 1 << "//" << i + 1 << " " << i * 7 + 2 << "//" << i + 1 << " " << i * 7 + 3 << "//" << i + 1 << "\n";
+    }
+    gen_file.close();
+
+    const char * paths[] = {"../model/cubic/cubic.obj", "../model/keqing/keqing_from_fbx.obj", "output/test/fast_parser_test.obj"};
+    const char * names[] = {"Fast Obj Parser Cubic Test", "Fast Obj Parser Keqing Test", "Fast Obj Parser Chunks Test"};
+    for (size_t i = 0; i < 3; i++)
+    {
+        double ts = NowTime(1);
+        tinyobj::ObjReader reader;
+        reader.ParseFromFile(paths[i], config);
+        double t_tiny = NowTime(1) - ts;
+
+        ts = NowTime(1);
+        ObjMeshData data;
+        bool ok = ParseObjFast(paths[i], data);
+        double t_fast = NowTime(1) - ts;
+        std::cout << paths[i] << ": tinyobj " << t_tiny << " ms, fast parser " << t_fast << " ms\n";
+        TestExpect(ok, true, std::string(names[i]) + " Result");
+        TestExpect(data.error, std::string(), std::string(names[i]) + " Error");
+        TestExpect(SameObjData(reader, data), true, names[i]);
+    }
+
+    std::shared_ptr <std::vector<Material<double>>> material_pool(new std::vector<Material<double>>());
+    std::shared_ptr <std::vector<ModelObj<double>>> model_pool(new std::vector<ModelObj<double>>());
+    std::shared_ptr <TexturePool<double, 1024>> tex_pool(new TexturePool<double, 1024>());
+    std::string err = load_obj_fast<double>("../model/cubic/cubic.obj", material_pool, model_pool, tex_pool);
+    std::vector<Vertex<double>> vert_buf;
+    for (size_t i = 0; i < model_pool->size(); i++)
+    {
+        model_pool->at(i).PushVertexBuffer(vert_buf);
+    }
+    TestExpect(err, std::string(), "Fast Obj Load Test");
+    TestExpect(material_pool->size(), (size_t)1, "Fast Obj Load Material Num Test");
+    TestExpect(vert_buf.size(), (size_t)36, "Fast Obj Load Vertex Num Test");
+
+    ObjMeshData missing;
+    TestExpect(ParseObjFast("../model/cubic/missing.obj", missing), false, "Fast Obj Missing File Test");
+
+    // an empty file has no shapes, like tinyobj
+    std::ofstream("output/test/empty.obj").close();
+    tinyobj::ObjReader empty_reader;
+    ObjMeshData empty;
+    TestExpect(empty_reader.ParseFromFile("output/test/empty.obj", config), true, "Tinyobj Empty File Test");
+    TestExpect(ParseObjFast("output/test/empty.obj", empty), true, "Fast Obj Empty File Test");
+    TestExpect(empty.error, std::string(), "Fast Obj Empty File Error Test");
+    TestExpect(empty.shapes.size(), (size_t)0, "Fast Obj Empty File Shape Num Test");
+
+    // malformed indices are rejected instead of read out of bounds
+    const char * bad_texts[] = {
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4294967298\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nf 1/1 2/1 3/2\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -1 -2 -4\n"};
+    const char * bad_names[] = {"Fast Obj Huge Index Test", "Fast Obj Vertex Index Range Test",
+        "Fast Obj Texcoord Index Range Test", "Fast Obj Relative Index Range Test"};
+    for (size_t i = 0; i < 4; i++)
+    {
+        std::ofstream("output/test/bad_fast_index.obj") << bad_texts[i];
+        ObjMeshData bad;
+        TestExpect(ParseObjFast("output/test/bad_fast_index.obj", bad), false, bad_names[i]);
+        TestExpect(bad.error.empty(), false, std::string(bad_names[i]) + " Error");
+    }
+}
+
+/**
+ * @brief Whether two vertex buffers have the same vertices and materials (by name)
+ */
+bool SameVertexBuffer(const std::vector<Vertex<double>> &a, const std::vector<Vertex<double>> &b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].position != b[i].position || a[i].normal != b[i].normal || a[i].texcoord != b[i].texcoord ||
+            (a[i].material == nullptr) != (b[i].material == nullptr) ||
+            (a[i].material != nullptr && a[i].material->name != b[i].material->name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Loads a model by load and expands its vertices, the materials of the vertices are kept by load_result.first
+ */
+template <class LoadFunc>
+std::pair<std::shared_ptr<std::vector<Material<double>>>, std::vector<Vertex<double>>> LoadVertexBuffer(LoadFunc load, double &time, std::string &err)
+{
+    std::shared_ptr <std::vector<Material<double>>> material_pool(new std::vector<Material<double>>());
+    std::shared_ptr <std::vector<ModelObj<double>>> model_pool(new std::vector<ModelObj<double>>());
+    std::shared_ptr <TexturePool<double, 1024>> tex_pool(new TexturePool<double, 1024>());
+    tex_pool->preload_textures = false;
+    double ts = NowTime(1);
+    err = load(material_pool, model_pool, tex_pool);
+    time = NowTime(1) - ts;
+    std::vector<Vertex<double>> vert_buf;
+    for (size_t i = 0; i < model_pool->size(); i++)
+    {
+        model_pool->at(i).PushVertexBuffer(vert_buf);
+    }
+    return std::make_pair(material_pool, vert_buf);
+}
+
+void test_obj_cache()
+{
+    const std::string cache_dir = "output/test/mesh_cache";
+    const std::string keqing = "../model/keqing/keqing_from_fbx.obj";
+    std::filesystem::create_directories(cache_dir);
+    std::remove(MeshCachePath(cache_dir, keqing).c_str());
+
+    double t_tiny = 0, t_miss = 0, t_hit = 0;
+    std::string err_tiny, err_miss, err_hit;
+    auto tiny_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj<double>(keqing, std::make_shared<tinyobj::ObjReader>(), mats, models, pool);
+    }, t_tiny, err_tiny);
+    auto miss_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(keqing, cache_dir, mats, models, pool);
+    }, t_miss, err_miss);
+    auto hit_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(keqing, cache_dir, mats, models, pool);
+    }, t_hit, err_hit);
+    std::cout << "keqing load: tinyobj " << t_tiny << " ms, cache miss " << t_miss << " ms, cache hit " << t_hit << " ms\n";
+    TestExpect(err_miss, std::string(), "Mesh Cache Miss Load Test");
+    TestExpect(SameVertexBuffer(tiny_buf.second, miss_buf.second), true, "Mesh Cache Miss Test");
+    TestExpect(err_hit, std::string(), "Mesh Cache Hit Load Test");
+    TestExpect(SameVertexBuffer(tiny_buf.second, hit_buf.second), true, "Mesh Cache Hit Test");
+
+    // the cache is regenerated when the MTL file changes
+    const std::string src_dir = "output/test/mesh_cache_src/";
+    std::filesystem::create_directories(src_dir);
+    std::filesystem::copy_file("../model/cubic/cubic.obj", src_dir + "cubic.obj", std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::copy_file("../model/cubic/cubic.mtl", src_dir + "cubic.mtl", std::filesystem::copy_options::overwrite_existing);
+    std::vector<tinyobj::material_t> mats;
+    std::vector<MeshBuffer> meshes;
+    std::string cubic_cache = MeshCachePath(cache_dir, src_dir + "cubic.obj");
+    std::remove(cubic_cache.c_str());
+    auto cubic_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(src_dir + "cubic.obj", cache_dir, mats, models, pool);
+    }, t_miss, err_miss);
+    TestExpect(ReadMeshCache(cubic_cache, src_dir + "cubic.obj", mats, meshes), true, "Mesh Cache Fresh Test");
+    TestExpect(mats.size(), (size_t)1, "Mesh Cache Material Num Test");
+    TestExpect(meshes.size(), (size_t)1, "Mesh Cache Mesh Num Test");
+    if (meshes.size() == 1)
+    {
+        TestExpect(meshes[0].indices.size, (size_t)36, "Mesh Cache Index Num Test");
+        TestExpect(meshes[0].vertices.size, (size_t)24, "Mesh Cache Vertex Num Test");
+    }
+    TestExpect(cubic_buf.second.size(), (size_t)36, "Mesh Cache Content Test");
+    std::ofstream mtl_file(src_dir + "cubic.mtl", std::ios::app);
+    mtl_file << "Ns 100.0\n";
+    mtl_file.close();
+    TestExpect(ReadMeshCache(cubic_cache, src_dir + "cubic.obj", mats, meshes), false, "Mesh Cache Stale Test");
+    cubic_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(src_dir + "cubic.obj", cache_dir, mats, models, pool);
+    }, t_miss, err_miss);
+    TestExpect(ReadMeshCache(cubic_cache, src_dir + "cubic.obj", mats, meshes), true, "Mesh Cache Regenerate Test");
+    TestExpect(mats.empty() ? 0.0f : mats[0].shininess, 100.0f, "Mesh Cache Regenerated Material Test");
+    TestExpect(cubic_buf.second.size(), (size_t)36, "Mesh Cache Regenerated Content Test");
+    TestExpect(ReadMeshCache(cubic_cache, keqing, mats, meshes), false, "Mesh Cache Other Source Test");
+
+    // concurrent loads of an uncached file each write the cache through their own temporary file
+    std::remove(cubic_cache.c_str());
+    std::vector<std::string> concurrent_errs(4);
+    std::vector<std::thread> loaders;
+    for (size_t i = 0; i < concurrent_errs.size(); i++)
+    {
+        loaders.emplace_back([&, i]()
+        {
+            double time = 0;
+            LoadVertexBuffer([&](auto mats, auto models, auto pool)
+            {
+                return load_obj_cached<double>(src_dir + "cubic.obj", cache_dir, mats, models, pool);
+            }, time, concurrent_errs[i]);
+        });
+    }
+    for (std::thread &loader : loaders)
+    {
+        loader.join();
+    }
+    for (size_t i = 0; i < concurrent_errs.size(); i++)
+    {
+        TestExpect(concurrent_errs[i], std::string(), "Mesh Cache Concurrent Load Test");
+    }
+    TestExpect(ReadMeshCache(cubic_cache, src_dir + "cubic.obj", mats, meshes), true, "Mesh Cache Concurrent Write Test");
+    size_t temp_num = 0;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(cache_dir))
+    {
+        std::string name = entry.path().string();
+        temp_num += name.compare(0, cubic_cache.size(), cubic_cache) == 0 && name.size() > cubic_cache.size() ? 1 : 0;
+    }
+    TestExpect(temp_num, (size_t)0, "Mesh Cache Temporary Test");
+
+    // faces referring to attributes that are not in the file fail the load, nothing is read out of bounds or cached
+    const std::string bad_path = "output/test/bad_index.obj";
+    std::ofstream bad_file(bad_path);
+    bad_file << "v 0 0 0\nv 1 0 0\nf 1 2 3\n";
+    bad_file.close();
+    const std::string bad_texcoord_path = "output/test/bad_texcoord_index.obj";
+    std::ofstream bad_texcoord_file(bad_texcoord_path);
+    bad_texcoord_file << "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nf 1/1 2/1 3/2\n";
+    bad_texcoord_file.close();
+    tinyobj::ObjReaderConfig config;
+    config.triangulate = true;
+    tinyobj::ObjReader bad_reader;
+    bad_reader.ParseFromFile(bad_path, config);
+    std::vector<MeshBuffer> bad_meshes;
+    TestExpect(ObjShapesToMeshBuffers(bad_reader.GetAttrib(), bad_reader.GetShapes(), bad_meshes), false, "Mesh Bad Vertex Index Test");
+    tinyobj::ObjReader bad_texcoord_reader;
+    bad_texcoord_reader.ParseFromFile(bad_texcoord_path, config);
+    TestExpect(ObjShapesToMeshBuffers(bad_texcoord_reader.GetAttrib(), bad_texcoord_reader.GetShapes(), bad_meshes), false,
+               "Mesh Bad Texcoord Index Test");
+    std::string err_bad;
+    auto bad_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_compact<double>(bad_path, mats, models, pool);
+    }, t_miss, err_bad);
+    TestExpect(err_bad.empty(), false, "Mesh Bad Index Compact Load Test");
+    TestExpect(bad_buf.second.size(), (size_t)0, "Mesh Bad Index Compact Vertex Test");
+    bad_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(bad_path, cache_dir, mats, models, pool);
+    }, t_miss, err_bad);
+    TestExpect(err_bad.empty(), false, "Mesh Bad Index Cached Load Test");
+    TestExpect(std::filesystem::exists(MeshCachePath(cache_dir, bad_path)), false, "Mesh Bad Index Not Cached Test");
+    bad_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_fast<double>(bad_path, mats, models, pool);
+    }, t_miss, err_bad);
+    TestExpect(err_bad.empty(), false, "Mesh Bad Index Fast Load Test");
+}
+
+void test_obj_compact()
+{
+    const std::string keqing = "../model/keqing/keqing_from_fbx.obj";
+    std::shared_ptr<tinyobj::ObjReader> reader(new tinyobj::ObjReader());
+    size_t parser_bytes = 0;
+    double t_load = 0;
+    std::string err_state, err_compact;
+    auto state_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        std::string err = load_obj<double>(keqing, reader, mats, models, pool);
+        const tinyobj::attrib_t &attrib = reader->GetAttrib();
+        parser_bytes = (attrib.vertices.size() + attrib.normals.size() + attrib.texcoords.size() + attrib.colors.size()) * sizeof(tinyobj::real_t);
+        for (const tinyobj::shape_t &shape : reader->GetShapes())
+        {
+            parser_bytes += shape.mesh.indices.size() * sizeof(tinyobj::index_t) + shape.mesh.num_face_vertices.size() +
+                            (shape.mesh.material_ids.size() + shape.mesh.smoothing_group_ids.size()) * 4;
+        }
+        return err;
+    }, t_load, err_state);
+
+    size_t mesh_bytes = 0;
+    auto compact_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        std::string err = load_obj_compact<double>(keqing, mats, models, pool);
+        for (const ModelObj<double> &model : *models)
+        {
+            mesh_bytes += model.GetMesh().ByteSize();
+        }
+        return err;
+    }, t_load, err_compact);
+    std::cout << "keqing resident mesh: parser state " << parser_bytes / 1024 << " KB, compact meshes " << mesh_bytes / 1024 << " KB\n";
+    TestExpect(err_state, std::string(), "Compact Mesh State Load Test");
+    TestExpect(err_compact, std::string(), "Compact Mesh Load Test");
+    TestExpect(compact_buf.second.size(), state_buf.second.size(), "Compact Mesh Vertex Num Test");
+    TestExpect(SameVertexBuffer(state_buf.second, compact_buf.second), true, "Compact Mesh Test");
+    TestExpect(reader->GetShapes().empty(), false, "Compact Mesh Reader Kept Test");
+    TestExpect(mesh_bytes < parser_bytes, true, "Compact Mesh Release Test");
+}
+
+/**
+ * @brief Renders triangles in [-1, 1]^2 with a Blinn-Phong shader, returns the number of lit pixels
+ */
+size_t RenderLitPixels(std::vector<Vertex<double>> &vert_buf)
+{
+    Scene scene;
+    scene.meshes.emplace_back(new Mesh(vert_buf));
+    scene.meshes[0]->transform_origin.trans = m_math::Vector3d({32, 32, 0});
+    scene.meshes[0]->transform_origin.scal = m_math::Vector3d({1, 1, 1}) * 24;
+    PointLight * light = new PointLight(m_math::Vector3d({0.65, 0.65, 0.65}), m_math::Vector3d({0.65, 0.65, 0.65}),
+                                        m_math::Vector3d({0.65, 0.65, 0.65}));
+    light->transform_origin.trans = m_math::Vector3d({-200, -200, -200});
+    scene.lights.emplace_back(light);
+
+    Image<ColorRGBA_d> img(64, 64);
+    Camera camera;
+    CameraRender<ColorRGBA_d> camera_render(&img, &camera);
+    camera_render.SetShader(std::make_shared<BlinnPhongShader<double, ColorRGBA_d>>());
+    camera_render.UpdateFromScene(scene);
+    camera_render.Clear();
+    camera_render.Render();
+    size_t lit = 0;
+    for (size_t y = 0; y < img.GetHeight(); y++)
+    {
+        for (size_t x = 0; x < img.GetWidth(); x++)
+        {
+            lit += img.GetColor(x, y)[0] > 0 ? 1 : 0;
+        }
+    }
+    return lit;
+}
+
+void test_obj_default_material()
+{
+    // faces before any usemtl and after an unknown one have no material, they render with DefaultMaterial()
+    const std::string path = "../model/cubic/no_usemtl.obj";
+    double t_load = 0;
+    std::string err_state, err_compact, err_fast;
+    auto state_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj<double>(path, std::make_shared<tinyobj::ObjReader>(), mats, models, pool);
+    }, t_load, err_state);
+    auto compact_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_compact<double>(path, mats, models, pool);
+    }, t_load, err_compact);
+    auto fast_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_fast<double>(path, mats, models, pool);
+    }, t_load, err_fast);
+    TestExpect(err_state, std::string(), "OBJ Missing Material Load Test");
+    TestExpect(err_compact, std::string(), "OBJ Missing Material Compact Load Test");
+    TestExpect(err_fast, std::string(), "OBJ Missing Material Fast Load Test");
+    const char * loader_names[] = {"State", "Compact", "Fast"};
+    const decltype(state_buf) * bufs[] = {&state_buf, &compact_buf, &fast_buf};
+    for (size_t i = 0; i < 3; i++)
+    {
+        const std::vector<Vertex<double>> &vertices = bufs[i]->second;
+        std::string name = std::string("OBJ Missing Material ") + loader_names[i];
+        TestExpect(vertices.size(), (size_t)9, name + " Vertex Num Test");
+        TestExpect(bufs[i]->first->size(), (size_t)1, name + " Material Num Test");
+        if (vertices.size() == 9 && bufs[i]->first->size() == 1)
+        {
+            const Material<double> * no_material = nullptr;
+            TestExpect(static_cast<const Material<double> *>(vertices[0].material), no_material, name + " Before Usemtl Test");
+            TestExpect(static_cast<const Material<double> *>(vertices[3].material),
+                       static_cast<const Material<double> *>(&bufs[i]->first->at(0)), name + " Usemtl Test");
+            TestExpect(static_cast<const Material<double> *>(vertices[6].material), no_material, name + " Unknown Usemtl Test");
+        }
+    }
+    TestExpect(RenderLitPixels(state_buf.second) > 0, true, "OBJ Default Material Render Test");
+    TestExpect(RenderLitPixels(compact_buf.second) > 0, true, "OBJ Default Material Compact Render Test");
+}
+
+/**
+ * @brief Triangles of meshes as sorted byte strings of their corners and material, equal if the meshes draw the same triangles
+ */
+std::vector<std::string> MeshTriangleSet(const std::vector<MeshBuffer> &meshes)
+{
+    std::vector<std::string> triangles;
+    for (const MeshBuffer &mesh : meshes)
+    {
+        for (size_t t = 0; t < mesh.TriangleNum(); t++)
+        {
+            std::string triangle(reinterpret_cast<const char *>(&mesh.materials[t]), sizeof(std::int32_t));
+            for (size_t k = 0; k < 3; k++)
+            {
+                triangle.append(reinterpret_cast<const char *>(&mesh.vertices[mesh.indices[t * 3 + k]]), sizeof(MeshVertex));
+            }
+            triangles.push_back(triangle);
+        }
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+void test_mesh_optimize()
+{
+    // a quad with a duplicated corner and a zero area triangle
+    MeshVertex corners[4] = {};
+    corners[1].position = {1, 0, 0};
+    corners[2].position = {1, 1, 0};
+    corners[3].position = {2, 0, 0};
+    MeshBuffer quad;
+    quad.vertices = SharedArray<MeshVertex>(std::vector<MeshVertex>{corners[0], corners[1], corners[2], corners[0], corners[2], corners[3]});
+    quad.indices = SharedArray<std::uint32_t>(std::vector<std::uint32_t>{0, 1, 2, 3, 4, 1, 0, 1, 5, 2, 2, 1});
+    quad.materials = SharedArray<std::int32_t>(std::vector<std::int32_t>{0, 0, 0, 0});
+    MeshBuffer welded = WeldMeshVertices(quad);
+    TestExpect(welded.vertices.size, (size_t)4, "Mesh Weld Test");
+    TestExpect(welded.indices[3], (std::uint32_t)0, "Mesh Weld Index Test");
+    TestExpect(welded.indices[4], (std::uint32_t)2, "Mesh Weld Shared Index Test");
+    MeshBuffer cleaned = RemoveDegenerateTriangles(welded);
+    TestExpect(cleaned.TriangleNum(), size_t(2), "Mesh Degenerate Triangle Test");
+
+    const std::string keqing = "../model/keqing/keqing_from_fbx.obj";
+    ObjMeshData data;
+    ParseObjFast(keqing, data);
+    std::vector<MeshBuffer> meshes;
+    ObjShapesToMeshBuffers(data.attrib, data.shapes, meshes);
+    std::vector<MeshBuffer> optimized(meshes.size()), cleaned_meshes;
+    double ts = NowTime(1);
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        optimized[i] = OptimizeMesh(meshes[i]);
+    }
+    double te = NowTime(1);
+    double acmr_before = 0, acmr_after = 0;
+    size_t triangle_num = 0;
+    bool materials_grouped = true;
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        acmr_before += AverageCacheMissRatio(meshes[i]) * meshes[i].TriangleNum();
+        acmr_after += AverageCacheMissRatio(optimized[i]) * optimized[i].TriangleNum();
+        triangle_num += meshes[i].TriangleNum();
+        cleaned_meshes.push_back(RemoveDegenerateTriangles(WeldMeshVertices(meshes[i])));
+        std::set<std::int32_t> finished;
+        for (size_t t = 1; t < optimized[i].TriangleNum(); t++)
+        {
+            if (optimized[i].materials[t] != optimized[i].materials[t - 1])
+            {
+                materials_grouped = materials_grouped && finished.insert(optimized[i].materials[t - 1]).second &&
+                                    finished.count(optimized[i].materials[t]) == 0;
+            }
+        }
+    }
+    acmr_before /= std::max<size_t>(triangle_num, 1);
+    acmr_after /= std::max<size_t>(triangle_num, 1);
+    std::cout << "keqing mesh optimize: " << te - ts << " ms, ACMR " << acmr_before << " -> " << acmr_after << "\n";
+    TestExpect(acmr_after < acmr_before, true, "Mesh Vertex Cache Order Test");
+    TestExpect(acmr_after < 1.0, true, "Mesh Vertex Cache Miss Ratio Test");
+    TestExpect(MeshTriangleSet(optimized) == MeshTriangleSet(cleaned_meshes), true, "Mesh Optimize Triangle Set Test");
+    TestExpect(materials_grouped, true, "Mesh Optimize Material Group Test");
+
+    // vertices are in first use order
+    bool first_use = true;
+    for (const MeshBuffer &mesh : optimized)
+    {
+        std::uint32_t next = 0;
+        for (std::uint32_t index : mesh.indices)
+        {
+            first_use = first_use && index <= next;
+            next = std::max(next, index + 1);
+        }
+        first_use = first_use && next == mesh.vertices.size;
+    }
+    TestExpect(first_use, true, "Mesh Vertex Fetch Order Test");
+
+    // optimized meshes are baked into their own cache files
+    const std::string cache_dir = "output/test/mesh_cache";
+    std::filesystem::create_directories(cache_dir);
+    std::string cache_path = MeshCachePath(cache_dir, keqing);
+    std::remove(cache_path.c_str());
+    double t_load = 0;
+    std::string err;
+    auto optimized_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(keqing, cache_dir, mats, models, pool, kMeshCacheOptimized);
+    }, t_load, err);
+    std::vector<tinyobj::material_t> mats;
+    std::vector<MeshBuffer> cached;
+    bool plain = ReadMeshCache(cache_path, keqing, mats, cached);
+    bool baked = ReadMeshCache(cache_path, keqing, mats, cached, kMeshCacheOptimized);
+    TestExpect(err, std::string(), "Mesh Optimize Cache Load Test");
+    TestExpect(plain, false, "Mesh Optimize Cache Flags Test");
+    TestExpect(baked, true, "Mesh Optimize Cache Test");
+    TestExpect(MeshTriangleSet(cached) == MeshTriangleSet(optimized), true, "Mesh Optimize Cache Triangle Set Test");
+    TestExpect(optimized_buf.second.size(), MeshTriangleSet(cleaned_meshes).size() * 3, "Mesh Optimize Cache Vertex Num Test");
+}
+
+void test_mesh_quantize()
+{
+    float min_cos = 1;
+    const std::array<float, 3> normals[] = {{0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {0, -1, 0}, {0.3f, -0.5f, -0.8f},
+                                            {-0.7f, 0.1f, 0.2f}, {0.577f, 0.577f, -0.577f}, {-1e-4f, 1, -1e-4f}};
+    for (const std::array<float, 3> &normal : normals)
+    {
+        std::array<float, 3> decoded = DecodeOctahedralNormal(EncodeOctahedralNormal(normal));
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float cos_error = (decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2]) / length;
+        min_cos = std::min(min_cos, cos_error);
+    }
+    std::array<float, 3> zero = DecodeOctahedralNormal(EncodeOctahedralNormal({0, 0, 0}));
+    TestExpect(min_cos > 0.99999f, true, "Octahedral Normal Test");
+    TestExpect(zero[0], 0.0f, "Octahedral Zero Normal X Test");
+    TestExpect(zero[1], 0.0f, "Octahedral Zero Normal Y Test");
+    TestExpect(zero[2], 0.0f, "Octahedral Zero Normal Z Test");
+
+    const std::string keqing = "../model/keqing/keqing_from_fbx.obj";
+    ObjMeshData data;
+    ParseObjFast(keqing, data);
+    std::vector<MeshBuffer> meshes;
+    ObjShapesToMeshBuffers(data.attrib, data.shapes, meshes);
+    std::vector<MeshBuffer> quantized;
+    size_t float_bytes = 0, quantized_bytes = 0, vertex_num = 0, index_num = 0;
+    bool position_ok = true, texcoord_ok = true, normal_ok = true;
+    for (const MeshBuffer &mesh : meshes)
+    {
+        quantized.push_back(QuantizeMesh(mesh));
+        const MeshBuffer &q = quantized.back();
+        float_bytes += mesh.vertices.size * sizeof(MeshVertex);
+        quantized_bytes += q.quantized_vertices.size * sizeof(QuantizedMeshVertex);
+        vertex_num += mesh.vertices.size;
+        index_num += mesh.indices.size;
+        for (size_t i = 0; i < mesh.vertices.size; i++)
+        {
+            const MeshVertex &vertex = mesh.vertices[i];
+            MeshVertex decoded = q.GetVertex(i);
+            for (size_t k = 0; k < 3; k++)
+            {
+                position_ok = position_ok && std::fabs(decoded.position[k] - vertex.position[k]) <= q.quantization.position_scale[k] * 0.51f + 1e-6f;
+            }
+            for (size_t k = 0; k < 2; k++)
+            {
+                texcoord_ok = texcoord_ok && std::fabs(decoded.texcoord[k] - vertex.texcoord[k]) <= q.quantization.texcoord_scale[k] * 0.51f + 1e-6f;
+            }
+            float length = std::sqrt(vertex.normal[0] * vertex.normal[0] + vertex.normal[1] * vertex.normal[1] + vertex.normal[2] * vertex.normal[2]);
+            float dot = decoded.normal[0] * vertex.normal[0] + decoded.normal[1] * vertex.normal[1] + decoded.normal[2] * vertex.normal[2];
+            normal_ok = normal_ok && (length == 0 ? dot == 0 : dot > 0.9999f * length);
+        }
+    }
+    std::cout << "keqing vertices: Vertex<double> " << index_num * sizeof(Vertex<double>) / 1024 << " KB, float "
+              << float_bytes / 1024 << " KB, quantized " << quantized_bytes / 1024 << " KB\n";
+    TestExpect(position_ok, true, "Mesh Quantize Position Error Test");
+    TestExpect(texcoord_ok, true, "Mesh Quantize Texcoord Error Test");
+    TestExpect(normal_ok, true, "Mesh Quantize Normal Error Test");
+    TestExpect(quantized_bytes * 2 < float_bytes, true, "Mesh Quantize Float Size Test");
+    TestExpect(quantized_bytes * 4 < vertex_num * sizeof(Vertex<double>), true, "Mesh Quantize Vertex Size Test");
+
+    // the vertex stage decodes quantized vertices while expanding them
+    std::shared_ptr<std::vector<Material<double>>> materials(new std::vector<Material<double>>(data.materials.size()));
+    std::vector<Vertex<double>> float_buf, quantized_buf;
+    double ts = NowTime(1);
+    for (const MeshBuffer &mesh : meshes)
+    {
+        ModelObj<double>(mesh, materials).PushVertexBuffer(float_buf);
+    }
+    double t_float = NowTime(1) - ts;
+    ts = NowTime(1);
+    for (const MeshBuffer &mesh : quantized)
+    {
+        ModelObj<double>(mesh, materials).PushVertexBuffer(quantized_buf);
+    }
+    double t_quantized = NowTime(1) - ts;
+    std::cout << "keqing vertex stream: float " << t_float << " ms, quantized " << t_quantized << " ms\n";
+    TestExpect(quantized_buf.size(), float_buf.size(), "Quantized Vertex Stream Test");
+    size_t material_diff = 0;
+    double position_diff = 0, texcoord_diff = 0;
+    for (size_t i = 0; i < std::min(float_buf.size(), quantized_buf.size()); i++)
+    {
+        material_diff += float_buf[i].material != quantized_buf[i].material ? 1 : 0;
+        position_diff = std::max(position_diff, std::fabs(float_buf[i].position[1] - quantized_buf[i].position[1]));
+        texcoord_diff = std::max(texcoord_diff, std::fabs(float_buf[i].texcoord[0] - quantized_buf[i].texcoord[0]));
+    }
+    TestExpect(material_diff, (size_t)0, "Quantized Vertex Stream Material Test");
+    TestExpect(position_diff < 1e-3, true, "Quantized Vertex Stream Position Test");
+    TestExpect(texcoord_diff < 1e-3, true, "Quantized Vertex Stream Texcoord Test");
+
+    // the optimizations read unquantized vertices, a quantized mesh passes through unchanged
+    MeshBuffer passed = OptimizeMesh(quantized[0]);
+    TestExpect(passed.IsQuantized(), true, "Quantized Mesh Optimize Test");
+    TestExpect(passed.VertexNum(), quantized[0].VertexNum(), "Quantized Mesh Optimize Vertex Num Test");
+    TestExpect(passed.indices.size, quantized[0].indices.size, "Quantized Mesh Optimize Index Num Test");
+    TestExpect(passed.indices.size == quantized[0].indices.size &&
+               std::equal(passed.indices.begin(), passed.indices.end(), quantized[0].indices.begin()), true,
+               "Quantized Mesh Optimize Index Test");
+
+    // quantized meshes are baked into their own cache files
+    const std::string cache_dir = "output/test/mesh_cache";
+    std::filesystem::create_directories(cache_dir);
+    std::string cache_path = MeshCachePath(cache_dir, keqing);
+    std::remove(cache_path.c_str());
+    std::uint32_t flags = kMeshCacheOptimized | kMeshCacheQuantized;
+    double t_load = 0;
+    std::string err;
+    auto cached_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj_cached<double>(keqing, cache_dir, mats, models, pool, flags);
+    }, t_load, err);
+    std::vector<tinyobj::material_t> mats;
+    std::vector<MeshBuffer> cached;
+    bool other = ReadMeshCache(cache_path, keqing, mats, cached, kMeshCacheOptimized);
+    bool baked = ReadMeshCache(cache_path, keqing, mats, cached, flags);
+    TestExpect(err, std::string(), "Quantized Mesh Cache Load Test");
+    TestExpect(other, false, "Quantized Mesh Cache Flags Test");
+    TestExpect(baked, true, "Quantized Mesh Cache Test");
+    TestExpect(cached.size(), meshes.size(), "Quantized Mesh Cache Mesh Num Test");
+    size_t same_num = 0;
+    for (size_t i = 0; i < std::min(cached.size(), meshes.size()); i++)
+    {
+        MeshBuffer expect = QuantizeMesh(OptimizeMesh(meshes[i]));
+        same_num += cached[i].IsQuantized() && cached[i].quantized_vertices.size == expect.quantized_vertices.size &&
+               cached[i].indices.size == expect.indices.size &&
+               memcmp(&cached[i].quantization, &expect.quantization, sizeof(MeshQuantization)) == 0 &&
+               memcmp(cached[i].quantized_vertices.begin(), expect.quantized_vertices.begin(), expect.quantized_vertices.size * sizeof(QuantizedMeshVertex)) == 0 &&
+               memcmp(cached[i].indices.begin(), expect.indices.begin(), expect.indices.size * sizeof(std::uint32_t)) == 0 ? 1 : 0;
+    }
+    TestExpect(same_num, meshes.size(), "Quantized Mesh Cache Content Test");
+    TestExpect(cached_buf.second.empty(), false, "Quantized Mesh Cache Vertex Test");
+}
+
+void test_glb()
+{
+    JsonValue json;
+    std::string text = "{\"a\": [1, -2.5e1, true, null], \"s\": \"x\\u00e9\\ud83d\\ude00\\n\", \"o\": {}}";
+    const char * json_end = ParseJson(text.data(), text.data() + text.size(), json);
+    const std::vector<JsonValue> &a = json.GetArray("a");
+    TestExpect(json_end == nullptr ? (size_t)0 : static_cast<size_t>(json_end - text.data()), text.size(), "JSON Parse End Test");
+    TestExpect(a.size(), (size_t)4, "JSON Array Size Test");
+    TestExpect(a[1].number, -25.0, "JSON Number Test");
+    TestExpect(a[2].boolean, true, "JSON Bool Test");
+    TestExpect(a[3].type == JsonValue::Type::kNull, true, "JSON Null Test");
+    TestExpect(json.GetString("s"), std::string("x\xc3\xa9\xf0\x9f\x98\x80\n"), "JSON String Test");
+    TestExpect(json.Find("o") != nullptr && json.Find("o")->type == JsonValue::Type::kObject, true, "JSON Object Test");
+    std::string broken = "{\"a\": [1, 2}";
+    TestExpect(ParseJson(broken.data(), broken.data() + broken.size(), json) == nullptr, true, "JSON Broken Test");
+
+    // cubic.glb is cubic.obj under a node scaled by 2 and a child node moved by 1 along x
+    double t_load = 0;
+    std::string err_obj, err_glb;
+    auto obj_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_obj<double>("../model/cubic/cubic.obj", std::make_shared<tinyobj::ObjReader>(), mats, models, pool);
+    }, t_load, err_obj);
+    auto glb_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_glb<double>("../model/cubic/cubic.glb", mats, models, pool);
+    }, t_load, err_glb);
+    TestExpect(err_glb, std::string(), "GLB Load Test");
+    TestExpect(glb_buf.first->size(), (size_t)1, "GLB Material Num Test");
+    TestExpect(glb_buf.second.size(), obj_buf.second.size(), "GLB Vertex Num Test");
+    double position_error = 0, normal_error = 0, texcoord_error = 0;
+    size_t other_material = 0;
+    for (size_t i = 0; i < std::min(obj_buf.second.size(), glb_buf.second.size()); i++)
+    {
+        const Vertex<double> &o = obj_buf.second[i], &g = glb_buf.second[i];
+        for (size_t k = 0; k < 3; k++)
+        {
+            position_error = std::max(position_error, std::fabs(g.position[k] - (2 * o.position[k] + (k == 0 ? 2 : 0))));
+            normal_error = std::max(normal_error, std::fabs(g.normal[k] - o.normal[k]));
+        }
+        for (size_t k = 0; k < 2; k++)
+        {
+            texcoord_error = std::max(texcoord_error, std::fabs(g.texcoord[k] - o.texcoord[k]));
+        }
+        other_material += g.material != &glb_buf.first->at(0) ? 1 : 0;
+    }
+    TestExpect(position_error < 1e-5, true, "GLB Node Transform Test");
+    TestExpect(normal_error < 1e-5, true, "GLB Normal Test");
+    TestExpect(texcoord_error < 1e-6, true, "GLB Texcoord Test");
+    TestExpect(other_material, (size_t)0, "GLB Vertex Material Test");
+    const Material<double> &mat = glb_buf.first->at(0);
+    TestExpect(mat.name, std::string("Material"), "GLB Material Name Test");
+    TestExpect(std::fabs(mat.diffuse[0] - 0.8) < 1e-6, true, "GLB Base Color Test");
+    TestExpect(mat.roughness, 0.5, "GLB Roughness Test");
+    TestExpect(mat.diffuse_tex.Empty(), false, "GLB Texture Test");
+
+    // accessors are views into the mapped binary chunk
+    GlbFile file;
+    TestExpect(ReadGlb("../model/cubic/cubic.glb", file), true, "GLB Read Test");
+    const float * positions = file.accessors[0].Typed<float>(GltfComponentType::kFloat);
+    TestExpect(positions != nullptr && reinterpret_cast<const std::uint8_t *>(positions) >= file.mapping.get() &&
+               reinterpret_cast<const std::uint8_t *>(positions + 24 * 3) <= file.mapping.get() + file.size, true, 
+               "GLB Accessor View Test");
+    TestExpect(file.accessors[3].Typed<std::uint32_t>(GltfComponentType::kUnsignedInt) == nullptr, true, "GLB Accessor Type Test");
+    TestExpect(file.accessors[3].ReadIndex(35) < 24, true, "GLB Accessor Index Test");
+
+    std::ifstream glb_in("../model/cubic/cubic.glb", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(glb_in)), std::istreambuf_iterator<char>());
+    std::ofstream truncated("output/test/truncated.glb", std::ios::binary);
+    truncated.write(bytes.data(), bytes.size() / 2);
+    truncated.close();
+    TestExpect(ReadGlb("output/test/truncated.glb", file), false, "GLB Truncated Test");
+    TestExpect(ReadGlb("../model/cubic/missing.glb", file), false, "GLB Missing File Test");
+
+    // a primitive without a material uses the glTF default material
+    std::string err_default;
+    auto default_buf = LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_glb<double>("../model/cubic/no_material.glb", mats, models, pool);
+    }, t_load, err_default);
+    const std::vector<Material<double>> &default_mats = *default_buf.first;
+    TestExpect(err_default, std::string(), "GLB Default Material Load Test");
+    TestExpect(default_mats.size(), (size_t)1, "GLB Default Material Num Test");
+    TestExpect(default_buf.second.size(), (size_t)6, "GLB Default Material Vertex Num Test");
+    if (default_mats.size() == 1 && default_buf.second.size() == 6)
+    {
+        TestExpect(default_mats[0].diffuse[0], 1.0, "GLB Default Base Color Test");
+        TestExpect(default_mats[0].metallic, 1.0, "GLB Default Metallic Test");
+        TestExpect(default_mats[0].roughness, 1.0, "GLB Default Roughness Test");
+        TestExpect(static_cast<const Material<double> *>(default_buf.second[0].material), &default_mats[0], "GLB Default Material Test");
+        TestExpect(static_cast<const Material<double> *>(default_buf.second[5].material), &default_mats[0], "GLB Default Material Last Test");
+        TestExpect(RenderLitPixels(default_buf.second) > 0, true, "GLB Default Material Render Test");
+    }
+
+    // counts beyond the binary chunk, accessors without a buffer view and signed indices are rejected
+    std::ifstream quad_in("../model/cubic/no_material.glb", std::ios::binary);
+    std::string quad((std::istreambuf_iterator<char>(quad_in)), std::istreambuf_iterator<char>());
+    auto patch_json = [&](const std::string &from, const std::string &to, const std::string &path)
+    {
+        std::uint32_t json_size = 0;
+        memcpy(&json_size, quad.data() + 12, 4);
+        std::string json_text = quad.substr(20, json_size);
+        json_text.replace(json_text.find(from), from.size(), to);
+        json_text.append((4 - json_text.size() % 4) % 4, ' ');
+        std::string rest = quad.substr(20 + json_size);
+        std::uint32_t sizes[2] = {static_cast<std::uint32_t>(20 + json_text.size() + rest.size()),
+                                  static_cast<std::uint32_t>(json_text.size())};
+        std::string out = quad.substr(0, 20);
+        memcpy(&out[8], &sizes[0], 4);
+        memcpy(&out[12], &sizes[1], 4);
+        std::ofstream patched(path, std::ios::binary);
+        patched << out << json_text << rest;
+    };
+    patch_json("\"componentType\":5126,\"count\":4", "\"componentType\":5126,\"count\":1e19", "output/test/huge_count.glb");
+    patch_json("\"bufferView\":0,\"componentType\":5126,\"count\":4", "\"componentType\":5126,\"count\":4000000000",
+               "output/test/no_view.glb");
+    patch_json("\"bufferView\":2,\"componentType\":5121,\"count\":6", "\"bufferView\":2,\"componentType\":5121,\"count\":4000000000",
+               "output/test/huge_index_count.glb");
+    patch_json("\"componentType\":5121", "\"componentType\":5120", "output/test/signed_index.glb");
+    TestExpect(ReadGlb("output/test/huge_count.glb", file), false, "GLB Huge Count Test");
+    TestExpect(file.error, std::string("accessor out of the binary chunk"), "GLB Huge Count Error Test");
+    TestExpect(ReadGlb("output/test/no_view.glb", file), false, "GLB No Buffer View Test");
+    TestExpect(file.error, std::string("unsupported accessor"), "GLB No Buffer View Error Test");
+    TestExpect(ReadGlb("output/test/huge_index_count.glb", file), false, "GLB Huge Index Count Test");
+    std::string err_no_view = "";
+    LoadVertexBuffer([&](auto mats, auto models, auto pool)
+    {
+        return load_glb<double>("output/test/no_view.glb", mats, models, pool);
+    }, t_load, err_no_view);
+    TestExpect(err_no_view.empty(), false, "GLB No Buffer View Load Test");
+    GlbFile signed_file;
+    TestExpect(ReadGlb("output/test/signed_index.glb", signed_file), true, "GLB Signed Index Read Test");
+    TestExpect(GltfMeshBuffers(signed_file).size(), (size_t)0, "GLB Signed Index Test");
+}
+
+void test_progressive()
+{
+    // a texture that is not resident yet renders with the flat material color
+    std::shared_ptr<TexturePool<double, 1024>> tex_pool(new TexturePool<double, 1024>());
+    Material<double> mat;
+    mat.diffuse = {0.25, 0.5, 0.75};
+    mat.diffuse_tex = LoadTexture<double>("../model/cubic/keqing.tga", tex_pool);
+    Vertex<double> vertex({0, 0, 0, 1}, {0, 0, 1}, {0.5, 0.5}, &mat);
+    GetTextureColor<double> pending_func;
+    pending_func.wait_textures = false;
+    pending_func.SetMaterial(&mat);
+    m_math::Vector<double, 4> flat = pending_func.GetColor(vertex, vertex, vertex, m_math::Vector<double, 3>({1, 0, 0}));
+    bool pending = mat.diffuse_tex.TryAcquire() == nullptr;
+    tex_pool->Acquire(mat.diffuse_tex.GetHandle());
+    GetTextureColor<double> resident_func;
+    resident_func.wait_textures = false;
+    resident_func.SetMaterial(&mat);
+    TestExpect(pending, true, "Texture Pending Test");
+    TestExpect(flat[0], 0.25, "Texture Fallback Test");
+    TestExpect(flat[1], 0.5, "Texture Fallback Green Test");
+    TestExpect(flat[2], 0.75, "Texture Fallback Blue Test");
+    TestExpect(resident_func.diffuse_tex != nullptr, true, "Texture Resident Test");
+
+    // keqing is rendered as its shapes arrive, the last frame equals a render of the fully loaded model
+    const std::string keqing = "../model/keqing/keqing_from_fbx.obj";
+    Transform transform;
+    transform.trans = m_math::Vector3d({100, 220, 0});
+    transform.rot = m_math::Vector3d({0, 0, 3.14});
+    transform.scal = m_math::Vector3d({1, 1, 1}) * 125;
+    auto make_light = []()
+    {
+        PointLight * light = new PointLight(m_math::Vector3d({0.65, 0.65, 0.65}), m_math::Vector3d({0.65, 0.65, 0.65}),
+                                            m_math::Vector3d({0.65, 0.65, 0.65}));
+        light->transform_origin.trans = m_math::Vector3d({-200, -200, -200});
+        return light;
+    };
+    std::shared_ptr<BlinnPhongShader<double, ColorRGBA_d>> shader(new BlinnPhongShader<double, ColorRGBA_d>());
+    shader->wait_textures = false;
+    Camera camera;
+
+    Scene scene;
+    scene.lights.emplace_back(make_light());
+    Image<ColorRGBA_d> img(200, 225);
+    CameraRender<ColorRGBA_d> camera_render(&img, &camera);
+    camera_render.SetShader(shader);
+    std::shared_ptr<TexturePool<double, 1024>> pool(new TexturePool<double, 1024>());
+    double ts = NowTime(1), t_first = 0;
+    size_t first_meshes = 0;
+    ProgressiveLoader<double, 1024> loader(keqing, pool);
+    size_t frame_num = RenderProgressive(loader, scene, camera_render, [&](size_t frame_index, bool)
+    {
+        if (frame_index == 0)
+        {
+            t_first = NowTime(1) - ts;
+            first_meshes = scene.meshes.size();
+        }
+    }, transform);
+    double t_total = NowTime(1) - ts;
+    std::string err = loader.Wait();
+    std::cout << "keqing progressive: first frame " << t_first << " ms with " << first_meshes << " shapes, all "
+              << loader.ShapeNum() << " shapes in " << frame_num << " frames " << t_total << " ms\n";
+
+    std::shared_ptr<std::vector<Material<double>>> material_pool(new std::vector<Material<double>>());
+    std::shared_ptr<std::vector<ModelObj<double>>> model_pool(new std::vector<ModelObj<double>>());
+    std::shared_ptr<TexturePool<double, 1024>> full_pool(new TexturePool<double, 1024>());
+    load_obj_fast<double>(keqing, material_pool, model_pool, full_pool);
+    std::vector<Vertex<double>> vert_buf;
+    for (const ModelObj<double> &model : *model_pool)
+    {
+        model.PushVertexBuffer(vert_buf);
+    }
+    Scene full_scene;
+    full_scene.lights.emplace_back(make_light());
+    full_scene.meshes.emplace_back(new Mesh(vert_buf));
+    full_scene.meshes[0]->transform_origin = transform;
+    Image<ColorRGBA_d> full_img(200, 225);
+    CameraRender<ColorRGBA_d> full_render(&full_img, &camera);
+    full_render.SetShader(shader);
+    full_render.UpdateFromScene(full_scene);
+    full_render.Clear();
+    full_render.Render();
+    size_t diff_rows = 0;
+    for (size_t y = 0; y < img.GetHeight(); y++)
+    {
+        diff_rows += memcmp(img.Row(y), full_img.Row(y), img.GetWidth() * sizeof(ColorRGBA_d)) == 0 ? 0 : 1;
+    }
+    TestExpect(err, std::string(), "Progressive Load Test");
+    TestExpect(frame_num >= 1, true, "Progressive Frame Num Test");
+    TestExpect(first_meshes >= 1, true, "Progressive First Frame Test");
+    TestExpect(scene.meshes.size(), model_pool->size(), "Progressive Mesh Num Test");
+    TestExpect(diff_rows, (size_t)0, "Progressive Render Test");
+
+    ProgressiveLoader<double, 1024> glb_loader("../model/cubic/cubic.glb", pool);
+    Scene glb_scene;
+    std::string glb_err = glb_loader.Wait();
+    TestExpect(glb_err, std::string(), "Progressive GLB Load Test");
+    TestExpect(glb_loader.Publish(glb_scene), (size_t)1, "Progressive GLB Test");
+    TestExpect(glb_scene.meshes.empty() ? (size_t)0 : glb_scene.meshes[0]->GetVertexList().size(), (size_t)36,
+               "Progressive GLB Vertex Num Test");
+    TestExpect(glb_loader.Publish(glb_scene), (size_t)0, "Progressive GLB Republish Test");
+    ProgressiveLoader<double, 1024> missing_loader("../model/cubic/missing.obj", pool);
+    TestExpect(missing_loader.Wait().empty(), false, "Progressive Missing File Test");
+    ProgressiveLoader<double, 1024> broken_loader("output/test/no_view.glb", pool);
+    TestExpect(broken_loader.Wait().empty(), false, "Progressive Broken GLB Test");
+}
+
 template<class shader_t, class color_t>
 void test_scene(std::shared_ptr<shader_t> shader, const std::string& path)
 {
@@ -54,6 +961,7 @@ void test_scene(std::shared_ptr<shader_t> shader, const std::string& path)
     }
     double te = NowTime(1);
     std::cout << "load success: using "<<te-ts<<" ms\n";
+    TestExpect(tex_pool->LoadCount(), (size_t)5, "Texture Preload Dedup Test");
 
     ts = NowTime(1);
 
@@ -105,8 +1013,8 @@ void test_scene(std::shared_ptr<shader_t> shader, const std::string& path)
     te = NowTime(1);
     std::cout << "render success: using "<<te-ts<<" ms\n";
 
-    std::ofstream file_render("output/test/render_test.ppm");
-    Save2ppm(res_img, file_render);
+    std::ofstream file_render("output/test/render_test.ppm", std::ios::binary);
+    Save2ppmBinary(res_img, file_render);
     file_render.close();
 
     TestExpect(" ", " ", "Scene Render Test");
@@ -116,6 +1024,14 @@ void test_scene(std::shared_ptr<shader_t> shader, const std::string& path)
 int main(int argc, char *argv[])
 {
     // test_obj();
+    test_obj_fast();
+    test_obj_cache();
+    test_obj_compact();
+    test_obj_default_material();
+    test_mesh_optimize();
+    test_mesh_quantize();
+    test_glb();
+    test_progressive();
 
     // std::shared_ptr<PrintShader<double, ColorRGB_d>> print_shader(new PrintShader<double, ColorRGB_d>());
     // test_scene<PrintShader<double, ColorRGB_d>, ColorRGB_d>(print_shader, "../model/cubic/cubic.obj");